@@ -0,0 +1,31 @@
+#ifndef ALLOCCOUNT_H
+#define ALLOCCOUNT_H
+
+///////////////////////////////////////////////////////////////////////////////
+// Heap allocation accounting.
+// The counters are only live in builds configured with SPH_ALLOC_COUNTING,
+// which replaces the global operator new/delete with counting versions.
+// In regular builds allocStats() always returns zeros.
+///////////////////////////////////////////////////////////////////////////////
+
+struct AllocStats {
+    AllocStats() : allocations(0), bytes(0) {}
+    AllocStats(unsigned long a, unsigned long b) : allocations(a), bytes(b) {}
+
+    AllocStats operator-(const AllocStats& s) const { return AllocStats(allocations - s.allocations, bytes - s.bytes); }
+
+    unsigned long allocations;
+    unsigned long bytes;
+};
+
+// true when the allocation counting hook is compiled in
+bool allocCountingEnabled();
+
+// total allocations and bytes requested since program start
+AllocStats allocStats();
+
+// stop counting the allocations of the calling thread, for helper threads
+// whose work is not part of what is measured
+void allocCountingIgnoreThread();
+
+#endif // ALLOCCOUNT_H
@@ -0,0 +1,54 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#define CHECKPOINT_MAGIC   0x43485053 // "SPHC" in a little endian file
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_ALIGN   64 // the particle records start on a multiple of it
+#define CHECKPOINT_CHUNK   (64 << 20) // bytes of particles gathered per write
+#define CHECKPOINT_RANDOM  8192 // bytes for the state of the rain generator, as text
+
+///////////////////////////////////////////////////////////////////////////////
+// Checkpoint file of a particlesystem, see particlesystem::saveCheckpoint().
+//
+// The file is this header, the offsets of every grid cell into the particle
+// records (cellCount + 1 of them, as 64 bit integers), padding up to
+// CHECKPOINT_ALIGN, then the particle records of the current grid, cell by
+// cell. The records are particle objects as the writing machine lays them
+// out, so a restart copies them out of the mapped file without parsing;
+// particleSize rejects files of another layout.
+///////////////////////////////////////////////////////////////////////////////
+struct checkpointheader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int headerSize;
+    unsigned int particleSize;
+
+    // scenario parameters
+    int scenario;
+    int capacity;
+    unsigned int seed;
+    int deterministic;
+    int tumble;
+    float sceneScale;
+    float dt;
+    float particleMass;
+    float viscosity;
+    float surfaceThreshold;
+    float box[3];
+    float gravity[3];
+    // std::mt19937 of the rain as its operator<< writes it, null terminated
+    char random[CHECKPOINT_RANDOM];
+
+    // grid parameters
+    int res[3];
+    int cellCount;
+
+    long long step;
+    // ids handed out so far, and the particles stored
+    long long idCount;
+    long long particles;
+    // file offset of the particle records
+    long long particleOffset;
+};
+
+#endif // CHECKPOINT_H
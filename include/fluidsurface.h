@@ -0,0 +1,89 @@
+#ifndef FLUIDSURFACE_H
+#define FLUIDSURFACE_H
+
+#include <vector>
+#include "vec3f.h"
+#include "simulation.h"
+#include "scalar_field_3D.h"
+#include "marchingcubes.h"
+#include "surfacenets.h"
+#include "particlesnapshot.h"
+
+#define SURFACE_MARGIN 3.0 // smoothing lengths sampled around the fluid bounding box
+#define SURFACE_ISO_LEVEL 0.5 // surface level of the color field, relative to its value in the bulk
+#define SURFACE_BAND 2.0 // smoothing lengths sampled around surface particles by the narrow band
+#define SURFACE_TOLERANCE 0.1 // smoothing lengths a particle moves before the samples around it are computed again
+#define SURFACE_BULK_TOLERANCE 0.01 // relative change of the bulk color value before the whole surface is computed again
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// How the surface is computed, read once per computation
+///////////////////////////////////////////////////////////////////////////////
+struct surfacesettings {
+    surfacesettings() :
+        sampling(SURFACE_SCATTER), extraction(SURFACE_MARCHING_CUBES),
+        narrowBand(true), incremental(true), isoLevel(SURFACE_ISO_LEVEL), particleMass(0) {}
+
+    int sampling;
+    int extraction;
+    // only store and evaluate the color field near surface particles
+    bool narrowBand;
+    // only compute the samples around particles that moved
+    bool incremental;
+    float isoLevel;
+    float particleMass;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The fluid surface, the isoLevel level set of the color field
+// sum_j density_j Wpoly6(x - x_j), computed from particle snapshots.
+// Samples and extracted blocks are kept from one computation to the next
+// and only updated where the particles moved.
+///////////////////////////////////////////////////////////////////////////////
+class fluidsurface {
+public:
+    fluidsurface();
+    ~fluidsurface();
+
+    // bring the surface up to date with the particles of snapshot
+    void compute(const particlesnapshot& snapshot, const surfacesettings& settings);
+
+    // color field, NULL until the first computation
+    const SCALAR_FIELD_3D* grid() const { return _grid; }
+    // fraction of the stored blocks whose samples the last computation computed
+    float updateFraction() const { return _updateFraction; }
+    // times the grid was resampled, which allocates
+    int resamples() const { return _resamples; }
+
+    surfacemesh mesh;
+
+private:
+    void generateGrid(const particlesnapshot& snapshot);
+    void flagMovedParticles(const particlesnapshot& snapshot);
+    void flagBlocks(const VEC3F& position);
+    void updateBand(const particlesnapshot& snapshot);
+    void computeGather(const particlesnapshot& snapshot);
+    void computeScatter(const particlesnapshot& snapshot);
+    void splatSlab(const particlesnapshot& snapshot, int axis, int slab);
+
+    SCALAR_FIELD_3D* _grid;
+    marchingcubes _marchingCubes;
+    surfacenets _surfaceNets;
+    surfacesettings _settings;
+
+    // next computation computes every sample
+    bool _fullUpdate;
+    // state of every block, kept to not reallocate every step
+    vector<unsigned char> _blockStates;
+    // blocks whose samples or state changed since the last computation
+    vector<unsigned char> _blockChanged;
+    // position of every particle, by id, when the samples around it were last computed
+    vector<VEC3F> _referencePositions;
+    // bulk color value the kept samples and the surface were computed with
+    float _bulkValue;
+    float _updateFraction;
+    int _resamples;
+};
+
+#endif // FLUIDSURFACE_H
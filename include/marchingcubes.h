@@ -0,0 +1,21 @@
+#ifndef MARCHINGCUBES_H
+#define MARCHINGCUBES_H
+
+#include "surfaceextractor.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Parallel marching cubes.
+// A vertex sits on every sample edge crossing the level set and belongs to
+// the block holding the edge's lower end, 3 vertex slots per sample.
+///////////////////////////////////////////////////////////////////////////////
+class marchingcubes : public surfaceextractor {
+
+public:
+  marchingcubes();
+
+protected:
+  void createVertices(SCALAR_FIELD_3D& field, float isoValue, block& blk);
+  void createTriangles(SCALAR_FIELD_3D& field, float isoValue, block& blk);
+};
+
+#endif // MARCHINGCUBES_H
@@ -1,14 +1,6 @@
 #ifndef PARTICLE_H
 #define PARTICLE_H
 
-#ifdef __APPLE__
-#include <GLUT/glut.h>
-#else
-#include <GL/glut.h>
-#include <GL/gl.h>
-#include <GL/glu.h>
-#endif
-
 #include "vec3f.h"
 #include <vector>
 #include <iostream>
@@ -31,10 +23,10 @@ public:
   particle();
   particle(const VEC3F& position);
   particle(const VEC3F& position, const VEC3F& velocity);
+  // for bulk initialization, the caller owns id assignment and particle::count
+  particle(const VEC3F& position, const VEC3F& velocity, int id);
   //~PARTICLE();
   
-  // draw to OGL
-  void draw();
 
   // clear all previous accumulated forces
   void clearForce() { _force *= 0; }
@@ -96,7 +88,6 @@ private:
   bool _flag;
   bool _splash;
   int _id;
-  GLUquadricObj* myQuadric;
     
 };
 #endif
@@ -0,0 +1,51 @@
+#ifndef PARTICLEEXPORT_H
+#define PARTICLEEXPORT_H
+
+#include <string>
+#include <vector>
+#include "trajectory.h"
+
+#define EXPORT_CHUNK (1 << 18) // particles encoded together before writing, the threads split a chunk
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// Binary particle files for ParaView and other tools.
+//
+// VTU: a VTK unstructured grid of one vertex cell per particle, every array
+// in the appended section as raw bytes. PLY: binary vertices of x, y, z,
+// vx, vy, vz, density, id and flags, the attributes not captured left out.
+// Both are in the byte order of the machine, which their headers state.
+//
+// The particles of the grid are gathered into attribute arrays in parallel
+// (trajectoryframe::capture()). VTU writes those arrays as they are; the
+// arrays it makes up and the interleaved PLY records are encoded by all
+// threads a chunk at a time, then written. Nothing is formatted per
+// particle, so writing is bound by the disk.
+///////////////////////////////////////////////////////////////////////////////
+class particleexporter {
+public:
+    particleexporter();
+
+    // capture the particles of grid at step, then write them
+    bool writeVtu(const char* filename, FIELD_3D<>& grid, int attributes = TRAJ_ALL, long step = 0);
+    bool writePly(const char* filename, FIELD_3D<>& grid, int attributes = TRAJ_ALL, long step = 0);
+
+    bool writeVtu(const char* filename, const trajectoryframe& frame);
+    bool writePly(const char* filename, const trajectoryframe& frame);
+
+    // size and duration of the last write, capture included
+    long long bytes() const { return _bytes; }
+    double seconds() const { return _seconds; }
+
+private:
+    bool writeChunks(FILE* file, const trajectoryframe& frame, int recordBytes,
+                     void (*encode)(const trajectoryframe& frame, int first, int last, unsigned char* out));
+
+    trajectoryframe _frame;
+    vector<unsigned char> _chunk;
+    long long _bytes;
+    double _seconds;
+};
+
+#endif // PARTICLEEXPORT_H
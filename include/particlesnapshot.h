@@ -0,0 +1,45 @@
+#ifndef PARTICLESNAPSHOT_H
+#define PARTICLESNAPSHOT_H
+
+#include <vector>
+#include "vec3f.h"
+#include "field_3D.h"
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// Copy of what the surface needs from the particles of one step, binned by
+// grid cell: the particles of cell c are [cellStart[c], cellStart[c + 1]).
+// The buffers keep their capacity so capturing does not allocate once the
+// particle count is stable.
+///////////////////////////////////////////////////////////////////////////////
+class particlesnapshot {
+public:
+    particlesnapshot();
+
+    // copy the particles of grid, whose cells are cellSize wide and centered on the origin
+    void capture(FIELD_3D<>& grid, const VEC3F& boxSize, float cellSize);
+
+    // grid cell containing position, clamped to the grid
+    void cell(const VEC3F& position, int& x, int& y, int& z) const;
+    inline int cellIndex(int x, int y, int z) const { return x + res[0] * (y + res[1] * z); }
+
+    int particleCount() const { return (int)positions.size(); }
+
+    // axis aligned bounding box of all the particles
+    void bounds(VEC3F& lower, VEC3F& upper) const;
+
+    float meanDensity() const;
+
+    int res[3];
+    VEC3F boxSize;
+    float cellSize;
+    vector<int> cellStart;
+
+    vector<VEC3F> positions;
+    vector<float> densities;
+    vector<unsigned char> flags;
+    vector<int> ids;
+};
+
+#endif // PARTICLESNAPSHOT_H
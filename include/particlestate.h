@@ -0,0 +1,68 @@
+#ifndef PARTICLESTATE_H
+#define PARTICLESTATE_H
+
+#include <vector>
+#include "vec3f.h"
+#include "field_3D.h"
+
+#define STATE_MAGIC   0x53485053 // "SPHS" in a little endian file
+#define STATE_VERSION 1
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// The particles of one step, sorted by id, to compare runs with.
+//
+// The file is a header (magic, version, scenario, step, particle count)
+// followed by every array in one piece, in the byte order of the machine
+// that wrote it: ids, positions, velocities, densities, pressures.
+///////////////////////////////////////////////////////////////////////////////
+class particlestate {
+public:
+    particlestate();
+
+    void capture(FIELD_3D<>& grid, int scenario, long step);
+
+    bool write(const char* filename) const;
+    // false if the file is missing, truncated or of another version
+    bool read(const char* filename);
+
+    int particleCount() const { return (int)ids.size(); }
+
+    int scenario;
+    long step;
+    vector<int> ids;
+    vector<VEC3F> positions;
+    vector<VEC3F> velocities;
+    vector<float> densities;
+    vector<float> pressures;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Differences of a state against a golden one, over the particles both
+// have. Positions are in units of h, the other fields relative to the root
+// mean square of the golden field
+///////////////////////////////////////////////////////////////////////////////
+struct stateerror {
+    stateerror() : particles(0), missing(0), extra(0) {
+        for (int x = 0; x < 4; x++)
+            maxError[x] = rmsError[x] = 0.0;
+    }
+
+    int particles;
+    // golden particles the state does not have, and the other way around
+    int missing;
+    int extra;
+    // position, velocity, density, pressure
+    double maxError[4];
+    double rmsError[4];
+};
+
+#define STATE_POSITION 0
+#define STATE_VELOCITY 1
+#define STATE_DENSITY  2
+#define STATE_PRESSURE 3
+
+stateerror compareStates(const particlestate& golden, const particlestate& state);
+
+#endif // PARTICLESTATE_H
@@ -6,9 +6,12 @@
 #include "particle.h"
 #include "wall.h"
 #include <vector>
+#include <random>
 #include "field_3D.h"
 #include "simulation.h"
-#include "marchingpoint.h"
+#include "surfacepipeline.h"
+#include "alloccount.h"
+#include "sphkernels.h"
 
 #define h 0.0457 //0.0457 0.02 //0.045
 
@@ -24,8 +27,14 @@
 #define WALL_K 10000.0 // wall spring constant
 #define WALL_DAMPING -0.9 // wall damping constant
 
-#define BOX_SIZE 0.4
-#define MAX_PARTICLES 10000
+#define BOX_SIZE 0.4 // box of the classic scenes, the scalable ones scale it
+#define DEFAULT_CAPACITY 10000 // particles the emitting scenarios stop at, unless loaded with a count
+
+#define CELL_RESERVE 32 // particles reserved per grid cell so rebinning does not reallocate
+#define CELL_RESERVE_BUDGET 3 // at most this many reserved places per particle of capacity, for large grids
+#define CELL_RESERVE_MEMORY (64 << 20) // bytes both grids may reserve for clumps, beyond the budget
+#define DETERMINISTIC_SEED 1 // seed of the random scenarios in deterministic mode when none is set
+#define ALLOC_WARMUP_STEPS 200 // steps after load or emission before the stepper must stop allocating
 
 #define INITIAL_SCENARIO SCENARIO_CUBE
 
@@ -39,18 +48,33 @@ public:
 
     void updateGrid();
 
-    // draw to OGL
-    void draw();
+    // grid cell containing position, clamped to the grid
+    void gridCell(const VEC3F& position, int& x, int& y, int& z) const;
 
     void addParticle(const VEC3F& position);
 
     void addParticle(const VEC3F& position, const VEC3F& velocity);
 
+    // fill a box with a particle lattice, stepping by spacing from start towards end
+    // (end excluded), writing the particles straight into their grid cells.
+    // returns the number of particles added
+    int fillRegion(const VEC3F& start, const VEC3F& end, float spacing, const VEC3F& velocity = VEC3F());
+
     void stepVerlet();
 
+    // the phases of stepVerlet(), in order. emission happens between
+    // integrate() and swapGrids()
+    void densityAndPressureComputation();
+
+    void accelerationComputation();
+
+    void integrate();
+
+    void swapGrids();
+
     void collisionForce(particle& particle, VEC3F& f_collision);
 
-    float Wpoly6(float radiusSquared);
+    static inline float Wpoly6(float radiusSquared) { return kernelPoly6<float>(radiusSquared); }
 
     void Wpoly6Gradient(VEC3F& diffPosition, float radiusSquared, VEC3F& gradient);
 
@@ -76,7 +100,13 @@ public:
 
     void toogleMarchingCube();
 
-    void computeSurface();
+    void toggleSurfaceSampling();
+
+    void toggleSurfaceExtraction();
+
+    void toggleSurfaceNarrowBand();
+
+    void toggleSurfaceIncremental();
 
     void generateFaucetParticleSet();
 
@@ -84,7 +114,33 @@ public:
 
     void generateDamParticleSet();
 
-    void generateSurfaceGrid();
+    // what the viewer shows
+    inline bool gridVisible() const { return _isGridVisible; }
+    inline bool marchingGrid() const { return _marchingGrid; }
+    inline bool marchingCube() const { return _marchingCube; }
+    inline const VEC3F& box() const { return boxSize; }
+
+    // scenario parameters
+    inline float mass() const { return particleMass; }
+    inline float timeStep() const { return dt; }
+    inline float viscosityConstant() const { return viscosity; }
+    inline const vector<wall>& walls() const { return _walls; }
+
+    // true while the surface is computed or its samples displayed
+    inline bool surfaceEnabled() const { return _marchingCube || _marchingGrid; }
+
+    // queue depth and drop policy of the surface pipeline, a depth of 0
+    // computes the surface at the end of every step
+    void surfacePipeline(int depth, int dropPolicy);
+
+    // swap the newest computed surface into surfaceFrame, false if there is none newer
+    bool fetchSurface();
+
+    // wait for the surface of the last step and fetch it
+    void flushSurface();
+
+    // steps whose surface was dropped because the pipeline was full
+    long surfaceFramesDropped() const;
 
     void fatCube();
 
@@ -92,22 +148,67 @@ public:
 
     void setGravityVectorWithViewVector(VEC3F viewVector);
 
-    void densityAndPressureComputation();
-
-    void accelerationComputation();
-
     void smoothTension();
     float C( float);
     //setters
     inline void scenario(const int scenario){ _scenario = scenario;}
+    // seed of the random scenarios, 0 seeds from the clock, or with
+    // DETERMINISTIC_SEED in deterministic mode
+    inline void seed(const unsigned int seed){ _seed = seed;}
+    // deterministic keeps the particles of every cell sorted by id, so the
+    // results are bit-identical whatever the number of threads
+    void deterministic(const bool deterministic);
+    inline void surfaceSampling(const int sampling){ _surfaceSettings.sampling = sampling;}
+    inline void surfaceExtraction(const int extraction){ _surfaceSettings.extraction = extraction;}
+    inline void surfaceNarrowBand(const bool narrowBand){ _surfaceSettings.narrowBand = narrowBand;}
+    inline void surfaceIncremental(const bool incremental){ _surfaceSettings.incremental = incremental;}
 
     //getters
     inline int scenario() const { return _scenario;}
-    void loadScenario(int scenario);
+    inline bool deterministic() const { return _deterministic;}
+    inline int surfaceSampling() const { return _surfaceSettings.sampling;}
+    inline int surfaceExtraction() const { return _surfaceSettings.extraction;}
+    inline bool surfaceNarrowBand() const { return _surfaceSettings.narrowBand;}
+    inline bool surfaceIncremental() const { return _surfaceSettings.incremental;}
+    inline int surfaceQueueDepth() const { return _surfaceQueueDepth;}
+    inline int surfaceDropPolicy() const { return _surfaceDropPolicy;}
+    // fraction of the stored surface blocks whose samples were computed for surfaceFrame
+    inline float surfaceUpdateFraction() const { return surfaceFrame.updateFraction;}
+    // particles 0 loads the classic scene. Otherwise the box and grid are
+    // scaled so that the scene holds about that many particles: the lattice
+    // scenes start with them, the emitting ones stop there
+    void loadScenario(int scenario, int particles = 0);
+
+    // particles the emitting scenarios stop at
+    inline int capacity() const { return _capacity; }
+    inline void capacity(int capacity) { _capacity = capacity; }
+    // size of the box relative to the classic scenes
+    inline float sceneScale() const { return _sceneScale; }
+    // steps simulated since the scenario was loaded
+    inline long stepCount() const { return _frameCount; }
+
+    // write particles, grid, scenario parameters and step to a checkpoint
+    // (see checkpoint.h). It goes to a temporary file renamed over filename
+    // once complete, so a crash while writing keeps the previous checkpoint
+    bool saveCheckpoint(const char* filename) const;
+    // resume from a checkpoint, the particles are copied out of the mapped
+    // file. false, with the system unchanged, if the file is missing,
+    // truncated or of another version or particle layout
+    bool loadCheckpoint(const char* filename);
+
+    // heap allocations done by the last stepVerlet() (zero unless built with SPH_ALLOC_COUNTING)
+    inline const AllocStats& stepAllocations() const { return _stepAllocations; }
+    // allocations and bytes accumulated over all steps since the scenario was loaded
+    inline const AllocStats& totalStepAllocations() const { return _totalStepAllocations; }
+    // number of steps that allocated after warm-up although no particle was emitted
+    inline unsigned long steadyStateAllocationSteps() const { return _steadyStateAllocationSteps; }
+    inline bool isWarmedUp() const { return _stepsSinceGrowth >= ALLOC_WARMUP_STEPS; }
 
     FIELD_3D<>* grid;
     FIELD_3D<>* nextGrid;
-    FIELD_3D<MarchingPoint>* surfaceGrid;
+    // newest surface fetched from the pipeline, a few steps behind the particles
+    surfaceframe surfaceFrame;
+    float surfaceIsoLevel;
 
     float surfaceThreshold;
     VEC3F gravityVector;
@@ -132,8 +233,48 @@ private:
     bool _marchingCube;
 
     VEC3F boxSize;
+    float _sceneScale = 1.f;
+    int _capacity = DEFAULT_CAPACITY;
+
+    long _frameCount;
+    long _stepsSinceGrowth;
+    AllocStats _stepAllocations;
+    AllocStats _totalStepAllocations;
+    unsigned long _steadyStateAllocationSteps;
+
+    // places reserved in every cell, raised when a clump fills a cell
+    size_t _cellReserve = 0;
+    void reserveCells();
+    void sortCells(const vector<int>& cells);
+    void updateSurfaceStorage();
+    void releaseSurfacePipeline();
 
     int _scenario = INITIAL_SCENARIO;
+    unsigned int _seed = 0;
+    // draws the drops of the rain, checkpoints keep its state
+    std::mt19937 _random;
+    bool _deterministic = false;
+
+    // a particle leaving its cell in updateGrid(), with its copy in nextGrid
+    struct movingparticle {
+        int cell;
+        particle current;
+        particle next;
+    };
+    // particles leaving their cell, per thread, and the cells receiving them.
+    // Kept between steps so rebinning does not allocate once warmed up
+    vector<vector<movingparticle> > _movingParticles;
+    vector<int> _receivingCells;
+    vector<char> _isReceiving;
+    // sum of the normal magnitudes per z slice, added up in a fixed order
+    vector<float> _thresholdSlices;
+    surfacesettings _surfaceSettings;
+    // computes the surface off the solver thread, only exists while surfaceEnabled()
+    surfacepipeline* _surfacePipeline;
+    int _surfaceQueueDepth = SURFACE_QUEUE_DEPTH;
+    int _surfaceDropPolicy = SURFACE_DROP_POLICY;
+    // pipeline resamples seen, a resample resets the allocation warm-up
+    int _surfaceResamples = 0;
 };
 
 #endif
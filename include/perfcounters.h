@@ -0,0 +1,49 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <vector>
+
+// hardware events counted
+#define PERF_CYCLES        0
+#define PERF_INSTRUCTIONS  1
+#define PERF_LLC_MISSES    2
+#define PERF_BRANCH_MISSES 3
+#define PERF_COUNTERS      4
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// Hardware performance counters of the OpenMP threads, through Linux
+// perf_event_open. Every thread of the team counts its own user space
+// events; read() sums them over the threads.
+//
+// Counters the kernel or the machine does not provide (no PMU in a virtual
+// machine, perf_event_paranoid, other systems than Linux) are reported as
+// unavailable, the others keep working.
+///////////////////////////////////////////////////////////////////////////////
+class perfcounters {
+public:
+    perfcounters();
+    ~perfcounters();
+
+    // open the counters on every thread of the OpenMP team, whose size must
+    // not change while they are open. false if no counter could be opened
+    bool open();
+    void close();
+
+    bool available(int counter) const { return _available[counter]; }
+    bool anyAvailable() const;
+
+    // counts since open(), summed over the threads and scaled for the time
+    // the kernel multiplexed the counters out. 0 for unavailable counters
+    void read(unsigned long long values[PERF_COUNTERS]) const;
+
+    static const char* name(int counter);
+
+private:
+    // PERF_COUNTERS descriptors per thread, -1 if not open
+    vector<int> _descriptors;
+    bool _available[PERF_COUNTERS];
+};
+
+#endif // PERFCOUNTERS_H
@@ -0,0 +1,81 @@
+#ifndef POSITIONCODEC_H
+#define POSITIONCODEC_H
+
+#include <vector>
+#include "vec3f.h"
+
+#define POSITION_BITS         21 // per axis, three of them make a 63 bit Morton code
+#define POSITION_SEGMENT      65536 // particles coded together, segments decode in parallel
+#define POSITION_KEY_INTERVAL 32 // frames between keyframes
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// Lossy coding of the ids and positions of trajectory frames.
+//
+// Positions are rounded to a grid of quantum spacing over twice the box, so
+// a coordinate is off by at most quantum / 2. A keyframe stores the
+// particles in Morton order of their quantized positions, each one as the
+// difference to the one before. The following frames keep the order of the
+// previous one, new particles last, and store each position as the
+// difference to its linear prediction from the two frames before: moving
+// particles cost a few bits per axis, resting ones almost none.
+//
+// The differences are entropy coded with an adaptive binary range coder:
+// the bit length of a value through a context tree, then its low bits.
+// Every POSITION_SEGMENT particles start over with fresh models, so
+// segments are decoded on their own, in parallel.
+//
+// Encoder and decoder keep the previous frames; a frame that is not a
+// keyframe only decodes right after the frame it was coded against.
+///////////////////////////////////////////////////////////////////////////////
+class positioncodec {
+public:
+    positioncodec();
+
+    // the box centered on the origin the particles are in, and the rounding
+    // step. false if the box holds more than 2^POSITION_BITS steps per axis
+    bool configure(const VEC3F& boxSize, float quantum);
+    float quantum() const { return _quantum; }
+
+    // forget the previous frames, the next one is a keyframe
+    void reset();
+
+    // append the coded particles to out. order receives the particle index
+    // of every coded particle, the order the other attributes are to be
+    // stored in. Returns true for a keyframe, which key forces
+    bool encode(const int* ids, const VEC3F* positions, int count, bool key,
+                vector<int>& order, vector<unsigned char>& out);
+
+    // decode a frame of encode(). false if the data is damaged or the frame
+    // does not follow the one decoded before
+    bool decode(const unsigned char* data, size_t bytes, vector<int>& ids, vector<VEC3F>& positions);
+
+    // whether the frame starting at data is a keyframe, false on damaged data
+    static bool isKeyframe(const unsigned char* data, size_t bytes);
+
+private:
+    void quantize(const VEC3F& position, unsigned int q[3]) const;
+    void keep(int previous);
+
+    VEC3F _origin;
+    float _quantum;
+    unsigned int _limit;
+
+    // the previous frame in coded order: ids, quantized positions, the
+    // positions of the frame before, and whether there is one
+    bool _valid;
+    vector<int> _ids;
+    vector<unsigned int> _q1;
+    vector<unsigned int> _q2;
+    vector<unsigned char> _history;
+
+    // scratch
+    vector<int> _slotOfId;
+    vector<unsigned int> _q;
+    vector<unsigned int> _coded;
+    vector<unsigned long long> _morton;
+    vector<int> _codedIds;
+};
+
+#endif // POSITIONCODEC_H
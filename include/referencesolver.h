@@ -0,0 +1,87 @@
+#ifndef REFERENCESOLVER_H
+#define REFERENCESOLVER_H
+
+#include <vector>
+#include "vec3D.h"
+#include "particlesystem.h"
+
+using namespace std;
+
+// one particle of the reference, in double precision
+struct referenceparticle {
+    int id;
+    VEC3D position;
+    VEC3D velocity;
+    VEC3D acceleration;
+    VEC3D normal;
+    double density;
+    double pressure;
+    bool flag;
+    bool splash;
+};
+
+// largest differences of a solver against the reference, relative to the
+// root mean square of the reference values
+struct referenceerror {
+    referenceerror() : particles(0), missing(0), density(0), pressure(0), acceleration(0),
+                       velocity(0), position(0), flags(0) {}
+
+    int particles;
+    // reference particles the solver does not have
+    int missing;
+    double density;
+    double pressure;
+    double acceleration;
+    double velocity;
+    double position;
+    // particles whose surface flag differs, they are left out of the
+    // acceleration, velocity and position
+    int flags;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The solver step, computed over all pairs of particles in double
+// precision, to validate the accelerated neighbor searches against.
+//
+// It runs the same phases as particlesystem::stepVerlet() with the same
+// kernels (sphkernels.h) and the same walls, minus emission and the
+// surface. load() copies the particles and parameters of a system, so a
+// step of both from the same state can be compared with compare().
+// O(N^2): meant for scenes of a few thousand particles.
+///////////////////////////////////////////////////////////////////////////////
+class referencesolver {
+public:
+    referencesolver();
+
+    void load(const particlesystem& system);
+
+    // the phases of a step, in the order of particlesystem::stepVerlet()
+    void densityAndPressureComputation();
+    void accelerationComputation();
+    void integrate();
+    void step();
+
+    // differences of the current particles of system against the reference,
+    // matched by id
+    referenceerror compare(const particlesystem& system) const;
+
+    // sorted by id
+    const vector<referenceparticle>& particles() const { return _particles; }
+    double surfaceThreshold() const { return _surfaceThreshold; }
+
+private:
+    void collisionForce(const referenceparticle& p, VEC3D& f_collision) const;
+
+    vector<referenceparticle> _particles;
+    // walls as normal and point
+    vector<VEC3D> _wallNormals;
+    vector<VEC3D> _wallPoints;
+
+    double _particleMass;
+    double _viscosity;
+    double _dt;
+    double _surfaceThreshold;
+    VEC3D _gravity;
+};
+
+#endif // REFERENCESOLVER_H
@@ -0,0 +1,136 @@
+#ifndef SCALAR_FIELD_3D_H
+#define SCALAR_FIELD_3D_H
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "assert.h"
+#include "vec3f.h"
+
+#define FIELD_BLOCK 8 // samples per side of the blocks the field is stored by
+#define FIELD_BLOCK_SAMPLES (FIELD_BLOCK * FIELD_BLOCK * FIELD_BLOCK)
+
+// block states, blocks without storage read as a constant
+#define FIELD_BLOCK_OUTSIDE 0 // every sample is 0
+#define FIELD_BLOCK_INSIDE 1  // every sample is insideValue()
+#define FIELD_BLOCK_STORED 2
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// Block sparse grid of floats sampled every spacing from origin.
+// Sample positions are implied by their index. Samples are stored by blocks
+// of FIELD_BLOCK^3, x varying fastest inside a block, and only the blocks
+// marked FIELD_BLOCK_STORED have storage, the others hold a constant.
+///////////////////////////////////////////////////////////////////////////////
+class SCALAR_FIELD_3D {
+
+public:
+  // construction and destruction
+  SCALAR_FIELD_3D();
+  SCALAR_FIELD_3D(int xRes, int yRes, int zRes, const VEC3F& origin, float spacing);
+  virtual ~SCALAR_FIELD_3D();
+
+  // (x,y,z) value, constant blocks included
+  inline float operator()(int x, int y, int z) const {
+    int slot = _blockSlot[blockOf(x, y, z)];
+    if (slot >= 0)
+      return _data[slot * FIELD_BLOCK_SAMPLES + localIndex(x, y, z)];
+    return slot == -1 - FIELD_BLOCK_INSIDE ? _insideValue : 0.0f;
+  }
+
+  // (x,y,z) storage, NULL if its block is constant
+  inline float* sample(int x, int y, int z) {
+    int slot = _blockSlot[blockOf(x, y, z)];
+    return slot >= 0 ? &_data[slot * FIELD_BLOCK_SAMPLES + localIndex(x, y, z)] : NULL;
+  }
+
+  // block holding sample (x,y,z) and the sample's index inside it
+  inline int blockOf(int x, int y, int z) const {
+    return x / FIELD_BLOCK + _blockRes[0] * (y / FIELD_BLOCK + _blockRes[1] * (z / FIELD_BLOCK));
+  }
+  inline int localIndex(int x, int y, int z) const {
+    return x % FIELD_BLOCK + FIELD_BLOCK * (y % FIELD_BLOCK + FIELD_BLOCK * (z % FIELD_BLOCK));
+  }
+
+  // world position of sample (x,y,z)
+  inline VEC3F position(int x, int y, int z) const {
+    return VEC3F(_origin.x + x * _spacing, _origin.y + y * _spacing, _origin.z + z * _spacing);
+  }
+
+  // accessors
+  int xRes() const { return _xRes; }
+  int yRes() const { return _yRes; }
+  int zRes() const { return _zRes; }
+  int totalCells() const { return _xRes * _yRes * _zRes; }
+  const VEC3F& origin() const { return _origin; }
+  float spacing() const { return _spacing; }
+  const int* blockRes() const { return _blockRes; }
+  int totalBlocks() const { return _blockRes[0] * _blockRes[1] * _blockRes[2]; }
+  float insideValue() const { return _insideValue; }
+  void setInsideValue(float value) { _insideValue = value; }
+
+  // world position of the last sample
+  VEC3F upper() const { return position(_xRes - 1, _yRes - 1, _zRes - 1); }
+
+  // state of a block
+  int blockState(int blockIndex) const {
+    int slot = _blockSlot[blockIndex];
+    return slot >= 0 ? FIELD_BLOCK_STORED : -1 - slot;
+  }
+  // samples of a stored block, NULL if it is constant
+  float* blockData(int blockIndex) {
+    int slot = _blockSlot[blockIndex];
+    return slot >= 0 ? &_data[slot * FIELD_BLOCK_SAMPLES] : NULL;
+  }
+  // stored blocks, in increasing order
+  const vector<int>& storedBlocks() const { return _storedBlocks; }
+  int storedCells() const { return (int)_storedBlocks.size() * FIELD_BLOCK_SAMPLES; }
+  // bytes held by the block storage and the block tables
+  size_t memory() const {
+    return _data.capacity() * sizeof(float) +
+           (_blockSlot.capacity() + _storedBlocks.capacity() + _newBlocks.capacity() + _freeSlots.capacity()) * sizeof(int);
+  }
+  // blocks that got storage from the last setBlockStates(), in increasing order
+  const vector<int>& newBlocks() const { return _newBlocks; }
+
+  // samples [lower, upper) of a block, upper is not clipped to the field
+  void blockRange(int blockIndex, int lower[3], int upper[3]) const;
+
+  // set the size and placement of the grid, every block gets state
+  void resize(int xRes, int yRes, int zRes, const VEC3F& origin, float spacing, int state = FIELD_BLOCK_STORED);
+
+  // set the state of every block. blocks already stored keep their
+  // samples, the new ones are set to zero. storage is only reallocated
+  // when it grows
+  void setBlockStates(const vector<unsigned char>& states);
+
+  // set the stored blocks to zero
+  void clear();
+  void clearBlock(int blockIndex);
+
+  // write the resolution, origin, spacing and every sample, x varying
+  // fastest, to a binary file
+  bool write(const char* filename) const;
+
+private:
+  int _xRes;
+  int _yRes;
+  int _zRes;
+  int _blockRes[3];
+  VEC3F _origin;
+  float _spacing;
+  float _insideValue;
+
+  // storage slot of every block, -1 - state for constant blocks
+  vector<int> _blockSlot;
+  vector<int> _storedBlocks;
+  vector<int> _newBlocks;
+  vector<int> _freeSlots;
+
+  int _slotCount;
+  // samples of the stored blocks, by slot
+  vector<float> _data;
+};
+
+#endif
@@ -9,4 +9,21 @@
 #define SCENARIO_RAIN     3
 #define SCENARIO_FATCUBE  4
 
+// particle counts the scalable scenes are benchmarked at
+#define SCENE_SIZE_COUNT 4
+#define SCENE_SIZES { 10000, 100000, 1000000, 10000000 }
+
+// how computeSurface fills the color field
+#define SURFACE_GATHER    0 // every sample sums the particles around it
+#define SURFACE_SCATTER   1 // every particle splats into the samples around it
+
+// how computeSurface triangulates the color field
+#define SURFACE_MARCHING_CUBES 0
+#define SURFACE_NETS           1 // about as many triangles, fewer slivers
+
+// what the surface pipeline does with a snapshot when its queue is full
+#define SURFACE_DROP_OLDEST 0 // replace the oldest queued snapshot, the solver never waits
+#define SURFACE_DROP_NEWEST 1 // skip the new snapshot, the solver never waits
+#define SURFACE_WAIT        2 // the solver waits for room, every step gets a surface
+
 #endif
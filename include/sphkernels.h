@@ -0,0 +1,57 @@
+#ifndef SPHKERNELS_H
+#define SPHKERNELS_H
+
+#include <cmath>
+
+///////////////////////////////////////////////////////////////////////////////
+// Smoothing kernels of radius h, for the float solver and the double
+// precision reference (T the scalar, V the matching vector type). Both only
+// differ in how they find neighbors, never in the kernels.
+//
+// radiusSquared is the squared distance of two particles, diffPosition the
+// vector between them. Coefficients are computed once per scalar type.
+///////////////////////////////////////////////////////////////////////////////
+
+template <class T>
+inline T kernelPoly6(T radiusSquared)
+{
+    static const T hSquared = h*h;
+    static const T coefficient = 315.0/(64.0*M_PI*std::pow(h,9));
+    return coefficient * std::pow(hSquared-radiusSquared, 3);
+}
+
+template <class T, class V>
+inline void kernelPoly6Gradient(const V& diffPosition, T radiusSquared, V& gradient)
+{
+    static const T coefficient = -945.0/(32.0*M_PI*std::pow(h,9));
+    static const T hSquared = h*h;
+    gradient = coefficient * std::pow(hSquared-radiusSquared, 2) * diffPosition;
+}
+
+template <class T>
+inline T kernelPoly6Laplacian(T radiusSquared)
+{
+    static const T coefficient = -945.0/(32.0*M_PI*std::pow(h,9));
+    static const T hSquared = h*h;
+    return coefficient * (hSquared-radiusSquared) * (3.0*hSquared - 7.0*radiusSquared);
+}
+
+template <class T, class V>
+inline void kernelSpikyGradient(const V& diffPosition, T radiusSquared, V& gradient)
+{
+    static const T coefficient = -45.0/(M_PI*std::pow(h,6));
+    T radius = std::sqrt(radiusSquared);
+    // const, VEC3F also has a non-const division by a vector
+    const V scaled = (T)(coefficient * std::pow(h-radius, 2)) * diffPosition;
+    gradient = scaled / radius;
+}
+
+template <class T>
+inline T kernelViscosityLaplacian(T radiusSquared)
+{
+    static const T coefficient = 45.0/(M_PI*std::pow(h,6));
+    T radius = std::sqrt(radiusSquared);
+    return coefficient * (h - radius);
+}
+
+#endif // SPHKERNELS_H
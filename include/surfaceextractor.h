@@ -0,0 +1,120 @@
+#ifndef SURFACEEXTRACTOR_H
+#define SURFACEEXTRACTOR_H
+
+#include <vector>
+#include "vec3f.h"
+#include "scalar_field_3D.h"
+#include "surfacemesh.h"
+
+#define BLOCK_APRON_RES (FIELD_BLOCK + 3) // block samples with one more below and two above
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// Block parallel extraction of a level set of a SCALAR_FIELD_3D.
+//
+// The field is processed by its blocks of FIELD_BLOCK^3 samples, each into
+// its own vertex and index buffers. Only blocks whose cubes can cross the
+// level set are visited: stored blocks, and constant blocks next to a
+// stored block or to a constant block of the other state. Every vertex
+// belongs to one block, found from the sample it is attached to, so
+// vertices shared between blocks are only created once. Vertices are
+// numbered and the block buffers merged in block order, which makes the
+// mesh independent of the thread count.
+//
+// The block buffers are kept between extractions. Triangles refer to their
+// vertices by owning block and slot, so a block only needs to be extracted
+// again when the samples it reads changed.
+///////////////////////////////////////////////////////////////////////////////
+class surfaceextractor {
+
+public:
+  surfaceextractor();
+  virtual ~surfaceextractor() {}
+
+  // triangulate the isoValue level set of field, samples >= isoValue are inside.
+  // triangles are counter clockwise seen from outside.
+  // changed flags the blocks whose samples or state changed since the last
+  // extraction, NULL extracts every block again
+  void extract(SCALAR_FIELD_3D& field, float isoValue, surfacemesh& mesh,
+               const vector<unsigned char>* changed = NULL);
+
+  // free the per block buffers
+  void release();
+
+  // blocks visited and extracted again by the last extraction
+  int visitedBlocks() const { return (int)_visited.size(); }
+  int extractedBlocks() const { return (int)_extracted.size(); }
+
+protected:
+  struct block {
+    block() : index(0), hasVertices(false), firstVertex(0), firstIndex(0) {
+      lower[0] = lower[1] = lower[2] = 0;
+      upper[0] = upper[1] = upper[2] = 0;
+    }
+    int index;
+    // samples [lower, upper) of the block, upper is not clipped to the field
+    int lower[3];
+    int upper[3];
+    // samples [lower - 1, lower + FIELD_BLOCK + 2), clamped to the field
+    vector<float> samples;
+    // vertex index of each vertex slot of the block, -1 if unused
+    vector<int> slotVertex;
+    vector<VEC3F> vertices;
+    vector<VEC3F> normals;
+    // vertex references, see vertexReference()
+    vector<unsigned int> indices;
+    bool hasVertices;
+    unsigned int firstVertex;
+    unsigned int firstIndex;
+  };
+
+  // first pass, fills vertices, normals and slotVertex of the block
+  virtual void createVertices(SCALAR_FIELD_3D& field, float isoValue, block& blk) = 0;
+  // second pass, fills indices of the block with vertexReference()s
+  virtual void createTriangles(SCALAR_FIELD_3D& field, float isoValue, block& blk) = 0;
+
+  // index of sample (x,y,z) in the samples of blk
+  inline int apronIndex(const block& blk, int x, int y, int z) const {
+    return x - blk.lower[0] + 1 + BLOCK_APRON_RES * (y - blk.lower[1] + 1 + BLOCK_APRON_RES * (z - blk.lower[2] + 1));
+  }
+
+  // reference from blk to the vertex in slot of the block holding sample
+  // (x,y,z), which must be blk or one of its neighbors. the neighbor is
+  // stored in the high bits, the slot in the low ones
+  inline unsigned int vertexReference(const block& blk, int x, int y, int z, int slot) const {
+    int neighbor = (x / FIELD_BLOCK - blk.lower[0] / FIELD_BLOCK + 1) +
+               3 * ((y / FIELD_BLOCK - blk.lower[1] / FIELD_BLOCK + 1) +
+               3 *  (z / FIELD_BLOCK - blk.lower[2] / FIELD_BLOCK + 1));
+    return (neighbor << 16) | slot;
+  }
+
+  // allocate and reset the slot table the first time a block gets a vertex
+  void useSlots(block& blk, int slotCount);
+
+  VEC3F gradient(const SCALAR_FIELD_3D& field, const block& blk, int x, int y, int z) const;
+
+private:
+  // update the visited blocks and their buffers, collect those to extract
+  void findVisitedBlocks(const SCALAR_FIELD_3D& field, const vector<unsigned char>* changed);
+  void fetchSamples(const SCALAR_FIELD_3D& field, block& blk) const;
+
+  // the visited blocks in block order
+  vector<int> _visited;
+  // buffers of the blocks extracted again
+  vector<int> _extracted;
+  // buffer of every block, -1 if not visited
+  vector<int> _blockBuffer;
+  vector<int> _freeBuffers;
+  vector<unsigned char> _visit;
+
+  // what the kept buffers were extracted with
+  float _isoValue;
+  int _fieldRes[3];
+  VEC3F _fieldOrigin;
+
+  // per block buffers
+  vector<block> _blocks;
+};
+
+#endif // SURFACEEXTRACTOR_H
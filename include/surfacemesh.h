@@ -0,0 +1,29 @@
+#ifndef SURFACEMESH_H
+#define SURFACEMESH_H
+
+#include <vector>
+#include "vec3f.h"
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// Indexed triangle mesh of the fluid surface
+///////////////////////////////////////////////////////////////////////////////
+class surfacemesh {
+public:
+    void clear() { vertices.clear(); normals.clear(); indices.clear(); }
+
+    int vertexCount() const { return (int)vertices.size(); }
+    int triangleCount() const { return (int)indices.size() / 3; }
+
+    // bytes held by the buffers
+    size_t memory() const {
+        return (vertices.capacity() + normals.capacity()) * sizeof(VEC3F) + indices.capacity() * sizeof(unsigned int);
+    }
+
+    vector<VEC3F> vertices;
+    vector<VEC3F> normals;
+    vector<unsigned int> indices;
+};
+
+#endif // SURFACEMESH_H
@@ -0,0 +1,20 @@
+#ifndef SURFACENETS_H
+#define SURFACENETS_H
+
+#include "surfaceextractor.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Naive surface nets, a lighter alternative to marching cubes.
+// Every cube crossing the level set gets one vertex, at the mean of its edge
+// crossings, and every crossed sample edge joins the vertices of the four
+// cubes around it with a quad. One vertex slot per sample, for the cube
+// whose lower corner it is.
+///////////////////////////////////////////////////////////////////////////////
+class surfacenets : public surfaceextractor {
+
+protected:
+  void createVertices(SCALAR_FIELD_3D& field, float isoValue, block& blk);
+  void createTriangles(SCALAR_FIELD_3D& field, float isoValue, block& blk);
+};
+
+#endif // SURFACENETS_H
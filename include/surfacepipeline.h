@@ -0,0 +1,106 @@
+#ifndef SURFACEPIPELINE_H
+#define SURFACEPIPELINE_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "fluidsurface.h"
+#include "particlesnapshot.h"
+
+#define SURFACE_QUEUE_DEPTH 1 // snapshots waiting for the surface thread, 0 computes the surface in the solver thread
+#define SURFACE_DROP_POLICY SURFACE_DROP_OLDEST
+#define SURFACE_THREADS 1 // OpenMP threads of the surface thread, the others stay with the solver
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// A computed surface, with where its samples are for display
+///////////////////////////////////////////////////////////////////////////////
+struct surfaceframe {
+    surfaceframe() : step(-1), updateFraction(0.f), spacing(0.f) { res[0] = res[1] = res[2] = 0; }
+
+    surfacemesh mesh;
+    // solver step the particles were captured at, -1 before the first surface
+    long step;
+    float updateFraction;
+
+    VEC3F origin;
+    float spacing;
+    int res[3];
+    vector<int> storedBlocks;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Computes the surface on its own thread, from snapshots of the particles,
+// while the solver carries on with the next steps.
+//
+// submit() captures the particles into a free snapshot slot and queues it,
+// what happens when the queue is full is set by the drop policy. The
+// surface thread publishes every surface it finishes and fetch() swaps the
+// newest one in. Snapshots and frames are recycled, so once their sizes
+// settle the pipeline does not allocate.
+///////////////////////////////////////////////////////////////////////////////
+class surfacepipeline {
+public:
+    surfacepipeline(int depth = SURFACE_QUEUE_DEPTH, int dropPolicy = SURFACE_DROP_POLICY, int threads = SURFACE_THREADS);
+    ~surfacepipeline();
+
+    // queue the surface of the particles of grid at step. false if it was dropped
+    bool submit(FIELD_3D<>& grid, const VEC3F& boxSize, float cellSize,
+                const surfacesettings& settings, long step);
+
+    // swap the newest finished surface into frame, false if there is none newer
+    bool fetch(surfaceframe& frame);
+
+    // wait until every queued snapshot has its surface
+    void flush();
+
+    int depth() const { return _depth; }
+    int dropPolicy() const { return _dropPolicy; }
+    // snapshots dropped and surfaces computed so far
+    long dropped() const { return _dropped; }
+    long completed() const { return _completed; }
+    // times the surface grid was resampled, which allocates
+    int resamples() const { return _resamples; }
+
+private:
+    struct job {
+        particlesnapshot snapshot;
+        surfacesettings settings;
+        long step;
+    };
+
+    void run();
+    void process(job& work);
+
+    int _depth;
+    int _dropPolicy;
+    int _threads;
+
+    fluidsurface _surface;
+
+    // snapshot slots: queued ones in order, free ones, and the one computed
+    vector<job> _jobs;
+    vector<int> _queue;
+    int _queueHead;
+    int _queueCount;
+    vector<int> _free;
+    bool _busy;
+    bool _stop;
+    mutex _mutex;
+    condition_variable _queued;
+    condition_variable _done;
+
+    // the newest finished surface not fetched yet
+    surfaceframe _ready;
+    mutex _readyMutex;
+
+    atomic<long> _dropped;
+    atomic<long> _completed;
+    atomic<int> _resamples;
+    thread _thread;
+};
+
+#endif // SURFACEPIPELINE_H
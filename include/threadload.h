@@ -0,0 +1,57 @@
+#ifndef THREADLOAD_H
+#define THREADLOAD_H
+
+#include <atomic>
+
+// solver phases whose parallel loops are measured
+#define LOAD_DENSITY      0
+#define LOAD_ACCELERATION 1
+#define LOAD_INTEGRATE    2
+#define LOAD_UPDATE_GRID  3
+#define LOAD_PHASES       4
+
+#define LOAD_MAX_THREADS 256 // OpenMP threads above this are not measured
+
+///////////////////////////////////////////////////////////////////////////////
+// Busy time of every OpenMP thread in the parallel loops of the solver, to
+// see how evenly the z slices spread the particles over the threads.
+//
+// THREAD_LOAD_SCOPE(phase) goes inside a parallel region, before a loop
+// with nowait, so that it measures the thread's share of the loop without
+// the barrier at the end of the region. Whatever is left of the phase time
+// is the time the thread waited. While it is off a scope costs one relaxed
+// load.
+///////////////////////////////////////////////////////////////////////////////
+
+#define THREAD_LOAD_SCOPE(phase) threadloadscope _threadLoadScope(phase)
+
+extern std::atomic<bool> threadLoadOn;
+
+inline bool threadLoadEnabled() { return threadLoadOn.load(std::memory_order_relaxed); }
+
+void threadLoadEnable(bool enable);
+
+// zero the busy times of every phase and thread
+void threadLoadReset();
+
+// milliseconds the OpenMP thread spent in the phase since the last reset
+double threadLoadBusy(int phase, int thread);
+
+void threadLoadRecord(int phase, unsigned long long nanoseconds);
+
+unsigned long long threadLoadNow();
+
+class threadloadscope {
+public:
+    threadloadscope(int phase) : _phase(phase), _start(threadLoadEnabled() ? threadLoadNow() : 0) {}
+    ~threadloadscope() {
+        if (_start)
+            threadLoadRecord(_phase, threadLoadNow() - _start);
+    }
+
+private:
+    int _phase;
+    unsigned long long _start;
+};
+
+#endif // THREADLOAD_H
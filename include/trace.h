@@ -0,0 +1,52 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+
+#define TRACE_CAPACITY 65536 // events kept per thread, a power of two. older ones are overwritten
+
+///////////////////////////////////////////////////////////////////////////////
+// Timeline of the solver phases, for chrome://tracing and Perfetto.
+//
+// TRACE_SCOPE(name) records one event from where it is declared to the end
+// of the enclosing scope. Every thread writes its events into its own ring
+// buffer, without locks. While tracing is off a scope costs one relaxed
+// load. name must outlive the trace, use string literals.
+///////////////////////////////////////////////////////////////////////////////
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) tracescope TRACE_CONCAT(_traceScope, __LINE__)(name)
+
+extern std::atomic<bool> traceOn;
+
+inline bool traceEnabled() { return traceOn.load(std::memory_order_relaxed); }
+
+void traceEnable(bool enable);
+
+// name the calling thread in the trace
+void traceThreadName(const char* name);
+
+// write the recorded events as Chrome trace JSON. traced code must not run
+// meanwhile, its events could be overwritten while they are read
+bool traceWrite(const char* filename);
+
+// nanoseconds on a monotonic clock, never 0
+unsigned long long traceNow();
+
+void traceRecord(const char* name, unsigned long long start, unsigned long long end);
+
+class tracescope {
+public:
+    tracescope(const char* name) : _name(name), _start(traceEnabled() ? traceNow() : 0) {}
+    ~tracescope() {
+        if (_start)
+            traceRecord(_name, _start, traceNow());
+    }
+
+private:
+    const char* _name;
+    unsigned long long _start;
+};
+
+#endif // TRACE_H
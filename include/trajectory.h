@@ -0,0 +1,211 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <cstdio>
+#include <vector>
+#include "vec3f.h"
+#include "field_3D.h"
+#include "positioncodec.h"
+
+#define TRAJECTORY_MAGIC   0x54485053 // "SPHT" in a little endian file
+#define TRAJECTORY_VERSION 3
+#define FRAME_MAGIC        0x4d415246 // "FRAM"
+#define INDEX_MAGIC        0x58444e49 // "INDX"
+
+// attributes a trajectory stores, the ids always are
+#define TRAJ_POSITION  1
+#define TRAJ_VELOCITY  2
+#define TRAJ_DENSITY   4
+#define TRAJ_FLAGS     8
+#define TRAJ_ALL       (TRAJ_POSITION | TRAJ_VELOCITY | TRAJ_DENSITY | TRAJ_FLAGS)
+#define TRAJ_IDS       16 // block attribute of the ids
+
+// how a block is stored
+#define TRAJ_CODEC_NONE    0
+#define TRAJ_CODEC_DEFLATE 1 // bytes of the 4 byte words grouped by significance, then zlib
+#define TRAJ_CODEC_QUANTIZED 2 // ids and positions together, by positioncodec
+
+#define FRAME_KEYFRAME 1 // frame flag: decodes without the frames before
+
+#define TRAJ_BLOCK_BYTES (4 << 20) // raw bytes of an attribute compressed together
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// Trajectory file: particle attributes of a series of steps, for post
+// processing.
+//
+// A header (magic, version, attributes, quantum, box) is followed by one
+// chunk per frame:
+// a frameheader, then blocks of at most TRAJ_BLOCK_BYTES of one attribute
+// array each, every block with its own blockheader so it is decoded on its
+// own. The arrays come in the order ids, positions, velocities, densities,
+// flags, skipping the attributes the file does not store. Everything is in
+// the byte order of the machine that wrote it.
+//
+// Files with a quantum store ids and positions lossily, in one
+// TRAJ_CODEC_QUANTIZED block of attribute TRAJ_IDS | TRAJ_POSITION that
+// comes first; the other arrays follow in the particle order it decodes to.
+// Its frames are mostly coded against the one before, only keyframes
+// decode on their own.
+//
+// Closing the file appends an index of one frameindexentry per frame and a
+// trajectoryfooter that ends the file, so a reader finds any frame and the
+// keyframe before it without reading the others. A file that was not
+// closed has no index; the reader then builds it from the frame headers.
+///////////////////////////////////////////////////////////////////////////////
+struct trajectoryheader {
+    unsigned int magic;
+    unsigned int version;
+    int attributes;
+    // position rounding step, 0 for exact positions
+    float quantum;
+    // box the particles are in, centered on the origin
+    float box[3];
+    int reserved;
+};
+
+struct frameheader {
+    unsigned int magic;
+    int particles;
+    long long step;
+    int blocks;
+    int flags;
+    // bytes of the blocks that follow, headers included
+    long long bytes;
+};
+
+struct frameindexentry {
+    // of the frameheader from the start of the file
+    long long offset;
+    long long step;
+    int particles;
+    int flags;
+};
+
+struct trajectoryfooter {
+    unsigned int magic;
+    int reserved;
+    long long frames;
+    // of the first frameindexentry
+    long long indexOffset;
+};
+
+struct blockheader {
+    int attribute;
+    int codec;
+    unsigned int rawBytes;
+    unsigned int storedBytes;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// The selected attributes of the particles of one step, in grid cell order.
+// The buffers keep their capacity, so capturing the same number of
+// particles again does not allocate
+///////////////////////////////////////////////////////////////////////////////
+class trajectoryframe {
+public:
+    trajectoryframe();
+
+    void capture(FIELD_3D<>& grid, int attributes, long step);
+
+    int particleCount() const { return (int)ids.size(); }
+
+    long step;
+    int attributes;
+    vector<int> ids;
+    vector<VEC3F> positions;
+    vector<VEC3F> velocities;
+    vector<float> densities;
+    vector<unsigned char> flags;
+
+private:
+    vector<int> _cellStart;
+};
+
+// buffers encodeFrame() reuses from frame to frame
+struct framescratch {
+    vector<unsigned char> bytes;
+    vector<int> order;
+    trajectoryframe ordered;
+};
+
+// append the blocks of frame to out, returns how many. With positions, ids
+// and positions are coded by it, a keyframe when key is set, and key tells
+// whether the frame is one. Without, every frame is a keyframe
+int encodeFrame(const trajectoryframe& frame, int codec, positioncodec* positions, bool& key,
+                framescratch& scratch, vector<unsigned char>& out);
+
+// the codec the writer uses when it is not told otherwise
+int defaultTrajectoryCodec();
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads a trajectory front to back, or from any frame on: seek() goes to
+// the keyframe before it and decodes the positions of the frames in
+// between. Readers of the same file are independent, one per thread
+// processes frame ranges in parallel
+///////////////////////////////////////////////////////////////////////////////
+class trajectoryreader {
+public:
+    trajectoryreader();
+    ~trajectoryreader();
+
+    // false if the file is missing or not a trajectory of this version.
+    // mapped reads the frames straight from a read only mapping of the
+    // file, where there is mmap
+    bool open(const char* filename, bool mapped = false);
+    void close();
+    bool mapped() const { return _mapped != NULL; }
+
+    int attributes() const { return _attributes; }
+    // position rounding step, 0 for exact positions
+    float quantum() const { return _quantum; }
+    const VEC3F& box() const { return _box; }
+
+    // frames in the file and where they are
+    long frameCount() const { return (long)_index.size(); }
+    const frameindexentry& frameEntry(long frame) const { return _index[frame]; }
+    // whether the index came from the footer, not from reading the frames
+    bool indexed() const { return _indexed; }
+    // the frame of step, -1 if there is none
+    long findStep(long long step) const;
+
+    // make frame the one next() reads. false if there is no such frame or
+    // the ones it is coded against are damaged
+    bool seek(long frame);
+    // the frame next() reads
+    long position() const { return _frame; }
+
+    // read the next frame, false at the end of the file or on a damaged frame
+    bool next(trajectoryframe& frame);
+    // size in the file and flags of the frame next() read last
+    long long frameBytes() const { return _frameBytes; }
+    int frameFlags() const { return _frameFlags; }
+
+private:
+    bool readIndex();
+    bool scanIndex();
+    bool read(trajectoryframe& frame, bool positionsOnly);
+    // bytes of the file at offset, copied to data or, for bytesAt(), in the
+    // mapping or _stored. false or NULL past the end of the file
+    bool readAt(long long offset, void* data, size_t bytes);
+    const unsigned char* bytesAt(long long offset, size_t bytes);
+
+    FILE* _file;
+    long long _size;
+    const unsigned char* _mapped;
+    int _attributes;
+    float _quantum;
+    VEC3F _box;
+    positioncodec _positions;
+    long long _frameBytes;
+    int _frameFlags;
+    vector<frameindexentry> _index;
+    bool _indexed;
+    long _frame;
+    vector<unsigned char> _stored;
+    vector<unsigned char> _scratch;
+    trajectoryframe _skipped;
+};
+
+#endif // TRAJECTORY_H
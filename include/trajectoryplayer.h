@@ -0,0 +1,97 @@
+#ifndef TRAJECTORYPLAYER_H
+#define TRAJECTORYPLAYER_H
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "trajectory.h"
+
+#define PLAYBACK_FPS 30 // frames shown per second while playing
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// Plays a trajectory file back without a particlesystem.
+//
+// The file is mapped, and a decoder thread reads the frame asked for next
+// while the one before is shown: while playing, the frame after the one
+// shown is decoded ahead, so showing it is a buffer swap. A seek asks for
+// its frame instead, and the reader decodes from the keyframe before it.
+// update() is called from the display loop and swaps a decoded frame in
+// when it is due.
+///////////////////////////////////////////////////////////////////////////////
+class trajectoryplayer {
+public:
+    trajectoryplayer();
+    ~trajectoryplayer();
+
+    // map filename, start the decoder and show its first frame. false if it
+    // is not a trajectory or has no frames
+    bool open(const char* filename);
+    void close();
+
+    // show the frame that is due, if it is decoded. true when the frame
+    // shown changed
+    bool update();
+
+    void play(bool playing);
+    bool playing() const { return _playing; }
+    // start over at the end instead of stopping
+    void loop(bool loop) { _loop = loop; }
+    bool loop() const { return _loop; }
+    void fps(double fps) { _fps = fps < 1.0 ? 1.0 : fps; }
+    double fps() const { return _fps; }
+
+    // show frame, clamped to the frames of the file, once it is decoded
+    void seek(long frame);
+    // seek relative to the frame shown
+    void skip(long frames) { seek((_wanted >= 0 ? _wanted : _shownFrame) + frames); }
+
+    // the frame shown and its index, -1 before the first one is decoded
+    const trajectoryframe& frame() const { return _shown; }
+    long frameIndex() const { return _shownFrame; }
+    long frameCount() const { return _frameCount; }
+    const VEC3F& box() const { return _box; }
+    // frames shown per second since the last play(), and the slowest decode
+    double shownFps() const;
+    double slowestDecode() const { return _slowestDecode; }
+
+private:
+    void request(long frame);
+    void run();
+
+    trajectoryreader _reader;
+    long _frameCount;
+    VEC3F _box;
+
+    // owned by the display loop
+    trajectoryframe _shown;
+    long _shownFrame;
+    long _wanted;
+    bool _playing;
+    bool _loop;
+    double _fps;
+    std::chrono::steady_clock::time_point _lastShown;
+    std::chrono::steady_clock::time_point _playStart;
+    long _playShown;
+
+    // handed over under the mutex: the frame asked for, the one the decoder
+    // was asked for last, the decoded one and the last that failed to decode
+    long _request;
+    long _requested;
+    trajectoryframe _decoded;
+    long _decodedFrame;
+    long _failedFrame;
+    atomic<double> _slowestDecode;
+    bool _stop;
+    mutex _mutex;
+    condition_variable _requestedCondition;
+
+    // owned by the decoder thread
+    trajectoryframe _decoding;
+    thread _thread;
+};
+
+#endif // TRAJECTORYPLAYER_H
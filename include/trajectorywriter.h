@@ -0,0 +1,118 @@
+#ifndef TRAJECTORYWRITER_H
+#define TRAJECTORYWRITER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "trajectory.h"
+
+#define TRAJECTORY_QUEUE_DEPTH 1 // frames waiting for the writer thread besides the one it writes, 0 writes in the solver thread
+
+using namespace std;
+
+///////////////////////////////////////////////////////////////////////////////
+// Appends frames to a trajectory file from its own thread.
+//
+// submit() copies the selected attributes into a free frame slot and queues
+// it; the writer thread compresses and writes the queued frames oldest
+// first. There are depth + 1 slots, a double buffer with the default depth
+// of one: the solver fills one while the other is written. It only waits
+// when depth frames are queued already, and reports it. Slots and encoding
+// buffers are reused, so once the particle count settles writing does not
+// allocate.
+//
+// With a quantum positions are stored lossily by positioncodec, with a
+// keyframe every keyInterval() frames. close() appends the frame index.
+///////////////////////////////////////////////////////////////////////////////
+struct trajectoryframestats {
+    long step;
+    int particles;
+    bool key;
+    long long rawBytes;
+    long long storedBytes;
+    double encodeSeconds;
+};
+
+class trajectorywriter {
+public:
+    trajectorywriter();
+    ~trajectorywriter();
+
+    // create filename and start the writer thread. false if it cannot be
+    // created. A quantum above 0 rounds positions to it, within the box
+    // centered on the origin; false if it is too fine for the box
+    bool open(const char* filename, int attributes = TRAJ_ALL, int depth = TRAJECTORY_QUEUE_DEPTH,
+              int codec = defaultTrajectoryCodec(), float quantum = 0.f, const VEC3F& box = VEC3F());
+
+    // queue the particles of grid at step. false once a write failed
+    bool submit(FIELD_3D<>& grid, long step);
+
+    // write the queued frames and the index, and close the file. false if
+    // any write failed
+    bool close();
+
+    // frames from one keyframe to the next when positions are quantized, the
+    // most a seek decodes. Takes effect with the next open()
+    void keyInterval(int frames) { _keyInterval = frames < 1 ? 1 : frames; }
+    int keyInterval() const { return _keyInterval; }
+
+    bool isOpen() const { return _file != NULL; }
+    int depth() const { return _depth; }
+    int attributes() const { return _attributes; }
+    // frames written, their size before and after compression
+    long frames() const { return _frames; }
+    long long rawBytes() const { return _rawBytes; }
+    long long storedBytes() const { return _storedBytes; }
+    // submits that waited for the writer, and how long they waited in total
+    long stalls() const { return _stalls; }
+    double stallSeconds() const { return _stallSeconds; }
+    // time spent encoding, and every frame on its own; read them after close()
+    double encodeSeconds() const { return _encodeSeconds; }
+    const vector<trajectoryframestats>& frameStats() const { return _frameStats; }
+
+private:
+    void run();
+    bool write(const trajectoryframe& frame);
+
+    string _filename;
+    FILE* _file;
+    int _attributes;
+    int _depth;
+    int _codec;
+    float _quantum;
+    int _keyInterval;
+
+    // frame slots: queued ones in order, free ones
+    vector<trajectoryframe> _slots;
+    vector<int> _queue;
+    int _queueHead;
+    int _queueCount;
+    vector<int> _free;
+    bool _stop;
+    mutex _mutex;
+    condition_variable _queued;
+    condition_variable _done;
+
+    // owned by the writer thread
+    vector<unsigned char> _encoded;
+    framescratch _scratch;
+    positioncodec _positions;
+    vector<trajectoryframestats> _frameStats;
+    long _lastKey;
+    vector<frameindexentry> _index;
+    long long _offset;
+    double _encodeSeconds;
+
+    atomic<bool> _failed;
+    atomic<long> _frames;
+    atomic<long long> _rawBytes;
+    atomic<long long> _storedBytes;
+    long _stalls;
+    double _stallSeconds;
+    thread _thread;
+};
+
+#endif // TRAJECTORYWRITER_H
@@ -0,0 +1,53 @@
+#ifndef VIEWER_H
+#define VIEWER_H
+
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#include <GL/gl.h>
+#include <GL/glu.h>
+#endif
+
+#include "particlesystem.h"
+#include "trajectoryplayer.h"
+
+#define WALL_DRAW_THICKNESS 0.02
+
+///////////////////////////////////////////////////////////////////////////////
+// OpenGL drawing of a particlesystem. The solver library has no GL
+// dependency, everything that draws lives here.
+///////////////////////////////////////////////////////////////////////////////
+class viewer {
+public:
+    viewer(particlesystem& system) : _system(system) {}
+
+    // draw the particles, the newest surface, the grids and the box to OGL
+    void draw();
+
+    void drawParticle(particle& p);
+
+    void drawWall(wall& w);
+
+private:
+    particlesystem& _system;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// OpenGL drawing of the frame a trajectoryplayer shows, without a
+// particlesystem: the particles as points straight from the frame arrays,
+// colored like the viewer's spheres, and the box. A million of them draw
+// at display rate
+///////////////////////////////////////////////////////////////////////////////
+class playbackviewer {
+public:
+    playbackviewer(trajectoryplayer& player) : _player(player) {}
+
+    void draw();
+
+private:
+    trajectoryplayer& _player;
+    vector<VEC3F> _colors;
+};
+
+#endif // VIEWER_H
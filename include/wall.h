@@ -1,14 +1,6 @@
 #ifndef WALL_H
 #define WALL_H
 
-#ifdef __APPLE__
-#include <GLUT/glut.h>
-#else
-#include <GL/glut.h>
-#include <GL/gl.h>
-#include <GL/glu.h>
-#endif
-
 #include "particle.h"
 #include "vec3f.h"
 #include "field_3D.h"
@@ -20,8 +12,6 @@ public:
   wall();
   wall(const VEC3F& normal, const VEC3F& point);
 
-  // draw to OGL
-  void draw();
   void createwall( double , double, vector<wall>& );
 
   // accessors
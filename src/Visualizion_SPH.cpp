@@ -14,6 +14,7 @@
 #include "../include/glvu.h"
 #include "../include/particle.h"
 #include "../include/particlesystem.h"
+#include "../include/viewer.h"
 #include "../include/particle.h"
 #include "../include/glvu.h"
 #include "../include/particle.h"
@@ -23,8 +24,13 @@
 glvu glvup;
 
 particlesystem *particleSystem;
+viewer *particleViewer;
 bool animate = false;
 
+// playback of a trajectory file instead of a live simulation
+trajectoryplayer *player = NULL;
+playbackviewer *playbackViewer = NULL;
+
 int iterationCount = 0;
 
 double arUtilTimer(void);
@@ -61,10 +67,13 @@ void drawAxes()
  glEnd();
  glLineWidth(1.0f);
 
- // draw frame rate
+ // draw frame rate, or the frame played back
  glRasterPos2f(0.3f, 1.5f);
  glColor3f(0.0f, 0.0f, 0.0f);
  string framerate= "*** " +  std::to_string((double)iterationCount/arUtilTimer()) + "(frame/sec) *** ";
+ if (player)
+   framerate = "*** frame " + std::to_string(player->frameIndex()) + " / " + std::to_string(player->frameCount()) +
+               ", step " + std::to_string(player->frame().step) + (player->playing() ? " (playing)" : "") + " *** ";
  //cout<< "frame rate:::: " << buffer << endl;
  char *c = const_cast<char*>(framerate.c_str());
  for (char *p=c; *p; p++)
@@ -89,7 +98,10 @@ void displayCallback()
   glEnable(GL_DEPTH_TEST);
 
 
-  particleSystem->draw();
+  if (player)
+    playbackViewer->draw();
+  else
+    particleViewer->draw();
 
   drawAxes();
 
@@ -126,11 +138,81 @@ void reshapeCallback(int width, int height)
   gluLookAt(0, 0, 0.5, 0, 0, 0, 0, 1, 0);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Keyboard commands of the playback mode
+///////////////////////////////////////////////////////////////////////////////
+void playbackKeyboard(unsigned char key)
+{
+  switch (key)
+  {
+    case 'q':
+    case 'Q':
+      exit(0);
+      break;
+
+    case 'a':
+    case ' ':
+      player->play(!player->playing());
+      break;
+
+    case '.':
+      player->play(false);
+      player->skip(1);
+      break;
+    case ',':
+      player->play(false);
+      player->skip(-1);
+      break;
+    case '>':
+      player->skip(player->frameCount() / 20 + 1);
+      break;
+    case '<':
+      player->skip(-(player->frameCount() / 20 + 1));
+      break;
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+      player->seek((key - '0') * (player->frameCount() - 1) / 9);
+      break;
+
+    case '+':
+      player->fps(player->fps() * 2.0);
+      cout << "playback: " << player->fps() << " frames/sec" << endl;
+      break;
+    case '-':
+      player->fps(player->fps() / 2.0);
+      cout << "playback: " << player->fps() << " frames/sec" << endl;
+      break;
+    case 'l':
+      player->loop(!player->loop());
+      cout << "playback loop: " << (player->loop() ? "on" : "off") << endl;
+      break;
+
+    case 's':
+      particle::isSurfaceVisible = !particle::isSurfaceVisible;
+      break;
+    case 'S':
+      particle::showSplash = !particle::showSplash;
+      break;
+
+    case 'f':
+      cout << "*** " << player->shownFps() << "(frame/sec) shown, slowest frame decoded in "
+           << 1000.0 * player->slowestDecode() << " ms" << endl;
+      break;
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Keyboard command processing function
 ///////////////////////////////////////////////////////////////////////////////
 void keyboardCallback(unsigned char key, int x, int y)
 {
+  if (player)
+  {
+    playbackKeyboard(key);
+    glvup.Keyboard(key, x, y);
+    glutPostRedisplay();
+    return;
+  }
   switch (key)
   {
     // quit entirely
@@ -176,6 +258,16 @@ void keyboardCallback(unsigned char key, int x, int y)
       cout << "surface threshold: " << particleSystem->surfaceThreshold << endl;
       break;
 
+    case ']':
+      particleSystem->surfaceIsoLevel += 0.05;
+      cout << "surface iso level: " << particleSystem->surfaceIsoLevel << endl;
+      break;
+
+    case '[':
+      particleSystem->surfaceIsoLevel -= 0.05;
+      cout << "surface iso level: " << particleSystem->surfaceIsoLevel << endl;
+      break;
+
     case 's':
       particleSystem->toggleSurfaceVisible();
       break;
@@ -196,6 +288,22 @@ void keyboardCallback(unsigned char key, int x, int y)
     case 't':
       particleSystem->toggleTumble();
       break;
+    case 'n':
+      particleSystem->toggleSurfaceExtraction();
+      cout << "surface extraction: " << (particleSystem->surfaceExtraction() == SURFACE_NETS ? "surface nets" : "marching cubes") << endl;
+      break;
+    case 'w':
+      particleSystem->toggleSurfaceNarrowBand();
+      cout << "surface narrow band: " << (particleSystem->surfaceNarrowBand() ? "on" : "off") << endl;
+      break;
+    case 'i':
+      particleSystem->toggleSurfaceIncremental();
+      cout << "surface incremental update: " << (particleSystem->surfaceIncremental() ? "on" : "off") << endl;
+      break;
+    case 'b':
+      particleSystem->toggleSurfaceSampling();
+      cout << "surface sampling: " << (particleSystem->surfaceSampling() == SURFACE_SCATTER ? "scatter" : "gather") << endl;
+      break;
 
     case '1':
       iterationCount = 0;
@@ -225,6 +333,8 @@ void keyboardCallback(unsigned char key, int x, int y)
     break;
     case 'f':
       cout << "*** "<< (double)iterationCount/arUtilTimer() << "(frame/sec)\n"<<endl;
+      cout << "surface blocks computed for the surface shown: " << 100.f * particleSystem->surfaceUpdateFraction() << "%" << endl;
+      cout << "surfaces dropped: " << particleSystem->surfaceFramesDropped() << endl;
       break;
   }
   glvup.Keyboard(key, x, y);
@@ -253,6 +363,12 @@ void glutMouseMotion(int x, int y)
 ///////////////////////////////////////////////////////////////////////////////
 void idleCallback()
 {
+  if (player)
+  {
+    if (player->update())
+      glutPostRedisplay();
+    return;
+  }
   if (!animate) return;
 
   //particleSystem.stepEuler(dt);
@@ -324,6 +440,34 @@ int main(int argc, char** argv)
 
 
     glutInit(&argc, argv);
+
+    // --play FILE shows a trajectory instead of simulating, --camera FILE
+    // plays a recorded glvu camera path along
+    const char* playFile = NULL;
+    const char* cameraFile = NULL;
+    double fps = PLAYBACK_FPS;
+    bool loop = false;
+    for (int x = 1; x < argc; x++)
+    {
+      string arg = argv[x];
+      if (arg == "--loop")
+        loop = true;
+      else if ((arg == "--play" || arg == "--camera" || arg == "--fps") && x + 1 < argc)
+      {
+        const char* value = argv[++x];
+        if (arg == "--play")
+          playFile = value;
+        else if (arg == "--camera")
+          cameraFile = value;
+        else
+          fps = atof(value);
+      }
+      else
+      {
+        cerr << "usage: " << argv[0] << " [--play TRAJECTORY [--fps N] [--loop] [--camera PATH]]" << endl;
+        return 1;
+      }
+    }
     glvup.Init(title, GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH, 0, 0, 800, 800);
     glShadeModel(GL_SMOOTH);
 
@@ -366,7 +510,24 @@ int main(int argc, char** argv)
     glvuVec3f center(0.0, 0.0, 0.0);
     glvup.SetWorldCenter(center);
 
-    particleSystem = new particlesystem();
+    if (playFile)
+    {
+      player = new trajectoryplayer();
+      if (!player->open(playFile))
+        return 1;
+      player->fps(fps);
+      player->loop(loop);
+      playbackViewer = new playbackviewer(*player);
+      cout << playFile << ": " << player->frameCount() << " frames. space plays and pauses, . and , step, < and > skip, "
+           << "0-9 jump, + and - change the rate, l loops" << endl;
+      if (cameraFile)
+        glvup.StartPlayback(cameraFile);
+    }
+    else
+    {
+      particleSystem = new particlesystem();
+      particleViewer = new viewer(*particleSystem);
+    }
 
     // Let GLUT take over
     glutMainLoop();
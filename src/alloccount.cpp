@@ -0,0 +1,86 @@
+#include "../include/alloccount.h"
+
+#ifdef SPH_ALLOC_COUNTING
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<unsigned long> allocationCount(0);
+static std::atomic<unsigned long> allocationBytes(0);
+static thread_local bool ignoreThread = false;
+
+///////////////////////////////////////////////////////////////////////////////
+// Counting replacements of the global allocation functions
+///////////////////////////////////////////////////////////////////////////////
+void* operator new(std::size_t size)
+{
+    if (!ignoreThread) {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    if (!ignoreThread) {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+bool allocCountingEnabled()
+{
+    return true;
+}
+
+AllocStats allocStats()
+{
+    return AllocStats(allocationCount.load(std::memory_order_relaxed),
+                      allocationBytes.load(std::memory_order_relaxed));
+}
+
+void allocCountingIgnoreThread()
+{
+    ignoreThread = true;
+}
+
+#else
+
+bool allocCountingEnabled()
+{
+    return false;
+}
+
+AllocStats allocStats()
+{
+    return AllocStats();
+}
+
+void allocCountingIgnoreThread()
+{
+}
+
+#endif
@@ -0,0 +1,761 @@
+// <chrono> before the solver headers, which define h
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <omp.h>
+#include "../include/particlesystem.h"
+#include "../include/fluidsurface.h"
+#include "../include/perfcounters.h"
+#include "../include/threadload.h"
+#include "../include/alloccount.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Times every phase of a solver step separately, on each scenario.
+//
+// A repetition is one step run phase by phase, so every phase sees the
+// particles the previous one left. Emission is not part of it. The faucet
+// fills up while it runs, so it is measured at each requested particle
+// count; the other scenarios have the particle count they load with.
+// --particles loads every scenario scaled to the given sizes instead, the
+// faucet then fills its larger box up to them.
+//
+// With --counters every phase also gets the hardware counters of the
+// OpenMP threads, as IPC and misses per particle. The surface phases report
+// the triangles and vertices of their last mesh, and the bytes of the mesh
+// and of the blocks of the color field, to compare the extractions by,
+// and the fraction of the blocks they computed again per step.
+//
+// --scaling strong runs the solver phases of a scenario at 1 to
+// --max-threads threads, --scaling weak scales the scenes with the thread
+// count, to the first --particles size per thread. Next to speedup and
+// efficiency it reports how long every thread waited at the end of each
+// phase: the loops hand out whole z slices, so the threads whose slices
+// hold few particles, or no slice at all, show up as idle.
+//
+// Built with SPH_ALLOC_COUNTING every phase also reports the heap
+// allocations of its timed steps, and each scenario then runs
+// --alloc-steps full steps: the bench fails if one of them allocates
+// after the warm-up of the solver.
+///////////////////////////////////////////////////////////////////////////////
+
+#define BENCH_PHASES 8
+#define BENCH_SOLVER_PHASES 4 // the first phases, run by the parallel loops of the solver
+#define BENCH_MARCHING_CUBES 6 // the surface phases
+#define BENCH_SURFACE_NETS 7
+#define BENCH_ALLOC_STEPS 800 // full steps of the allocation check, ALLOC_WARMUP_STEPS of them warm-up
+
+static const char* phaseNames[BENCH_PHASES] = {
+    "density", "acceleration", "integrate", "updateGrid", "collisionForce",
+    "snapshot", "surface_marching_cubes", "surface_nets"
+};
+
+struct benchoptions {
+    benchoptions() : warmup(20), repetitions(50), threads(0), growthSteps(5000), counters(false), maxThreads(0),
+                     allocSteps(BENCH_ALLOC_STEPS) {}
+
+    vector<int> scenarios;
+    vector<int> counts;
+    // scene sizes, empty for the classic scenes
+    vector<int> particles;
+    int warmup;
+    int repetitions;
+    int threads;
+    // steps the faucet may run to reach a particle count
+    int growthSteps;
+    bool counters;
+    // "strong", "weak" or empty
+    string scaling;
+    int maxThreads;
+    // steps of the allocation check, 0 skips it
+    int allocSteps;
+    string json;
+};
+
+struct benchresult {
+    int scenario;
+    int particles;
+    int phase;
+    int threads;
+    // z slices the solver loops share out
+    int slices;
+    // milliseconds, sorted
+    vector<double> samples;
+    // hardware counts over all the timed repetitions
+    unsigned long long counts[PERF_COUNTERS];
+    // milliseconds per step every thread spent in the loop, solver phases only
+    vector<double> busy;
+    // heap allocations over all the timed repetitions
+    AllocStats allocations;
+    // last surface of the surface phases
+    int triangles;
+    int vertices;
+    size_t meshBytes;
+    int fieldBlocks;
+    size_t fieldBytes;
+    // fraction of the stored blocks computed again, summed over the timed repetitions
+    double updateFraction;
+
+    double median() const {
+        size_t n = samples.size();
+        return n % 2 ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+    }
+    // nearest rank
+    double p95() const { return samples[(size_t)ceil(0.95 * samples.size()) - 1]; }
+    double mean() const {
+        double sum = 0.0;
+        for (double s : samples)
+            sum += s;
+        return sum / samples.size();
+    }
+};
+
+// full steps of a scenario checked for allocations after warm-up
+struct alloccheck {
+    int scenario;
+    int particles;
+    int steps;
+    unsigned long steadyStateSteps;
+    AllocStats allocations;
+};
+
+static const char* scenarioNames[] = { "dam", "faucet", "cube", "rain", "fatcube" };
+
+static inline bool isSurfacePhase(int phase)
+{
+    return phase == BENCH_MARCHING_CUBES || phase == BENCH_SURFACE_NETS;
+}
+
+static int scenarioByName(const string& name)
+{
+    for (int x = 0; x < 5; x++)
+        if (name == scenarioNames[x])
+            return x;
+    return -1;
+}
+
+static void usage(const char* program)
+{
+    cerr << "usage: " << program << " [options]" << endl
+         << "  --scenarios LIST  comma separated scenarios (default dam,faucet,cube,rain,fatcube)" << endl
+         << "  --counts LIST     comma separated particle counts for the faucet (default 1000,2000,4000)," << endl
+         << "                    scaling runs use the first" << endl
+         << "  --particles LIST  scale the scenes to these particle counts, k and M suffixes," << endl
+         << "                    \"canonical\" for 10k,100k,1M,10M. Weak scaling uses the first per thread" << endl
+         << "  --warmup N        untimed steps before measuring (default 20)" << endl
+         << "  --reps N          timed steps (default 50)" << endl
+         << "  --threads N       OpenMP threads (default: OpenMP's choice)" << endl
+         << "  --counters        sample hardware performance counters per phase" << endl
+         << "  --scaling MODE    strong or weak scaling of the solver phases" << endl
+         << "  --max-threads N   largest thread count of a scaling run (default: the processors)" << endl
+         << "  --alloc-steps N   full steps per scenario that must not allocate after warm-up, in builds" << endl
+         << "                    with SPH_ALLOC_COUNTING (default " << BENCH_ALLOC_STEPS << ", 0 skips the check)" << endl
+         << "  --json FILE       write the results as JSON" << endl;
+}
+
+static bool parseList(const char* value, vector<string>& items)
+{
+    items.clear();
+    string list = value;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == string::npos)
+            end = list.size();
+        if (end == start)
+            return false;
+        items.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    return !items.empty();
+}
+
+// a particle count, "100k" and "1M" allowed. -1 if it is not one
+static int parseCount(const char* value)
+{
+    char* end;
+    double count = strtod(value, &end);
+    if (*end == 'k' || *end == 'K') {
+        count *= 1e3;
+        end++;
+    }
+    else if (*end == 'm' || *end == 'M') {
+        count *= 1e6;
+        end++;
+    }
+    if (end == value || *end != '\0' || count < 0 || count > 2e9)
+        return -1;
+    return (int)count;
+}
+
+static bool parseOptions(int argc, char** argv, benchoptions& opts)
+{
+    vector<string> items;
+    for (int x = 1; x < argc; x++) {
+        string arg = argv[x];
+        if (arg == "--counters") {
+            opts.counters = true;
+            continue;
+        }
+        if (arg != "--scenarios" && arg != "--counts" && arg != "--particles" && arg != "--warmup" &&
+            arg != "--reps" && arg != "--threads" && arg != "--scaling" && arg != "--max-threads" &&
+            arg != "--alloc-steps" && arg != "--json") {
+            if (arg != "--help" && arg != "-h")
+                cerr << "unknown option " << arg << endl;
+            return false;
+        }
+        if (x + 1 >= argc) {
+            cerr << "missing value for " << arg << endl;
+            return false;
+        }
+        const char* value = argv[++x];
+        if (arg == "--scenarios") {
+            if (!parseList(value, items))
+                return false;
+            opts.scenarios.clear();
+            for (const string& item : items) {
+                int scenario = scenarioByName(item);
+                if (scenario < 0) {
+                    cerr << "unknown scenario " << item << endl;
+                    return false;
+                }
+                opts.scenarios.push_back(scenario);
+            }
+        }
+        else if (arg == "--counts") {
+            if (!parseList(value, items))
+                return false;
+            opts.counts.clear();
+            for (const string& item : items)
+                opts.counts.push_back(atoi(item.c_str()));
+        }
+        else if (arg == "--particles") {
+            opts.particles.clear();
+            if (string(value) == "canonical") {
+                const int sizes[SCENE_SIZE_COUNT] = SCENE_SIZES;
+                opts.particles.assign(sizes, sizes + SCENE_SIZE_COUNT);
+                continue;
+            }
+            if (!parseList(value, items))
+                return false;
+            for (const string& item : items) {
+                int count = parseCount(item.c_str());
+                if (count <= 0) {
+                    cerr << "bad particle count " << item << endl;
+                    return false;
+                }
+                opts.particles.push_back(count);
+            }
+        }
+        else if (arg == "--warmup")
+            opts.warmup = atoi(value);
+        else if (arg == "--reps")
+            opts.repetitions = atoi(value);
+        else if (arg == "--threads")
+            opts.threads = atoi(value);
+        else if (arg == "--scaling") {
+            opts.scaling = value;
+            if (opts.scaling != "strong" && opts.scaling != "weak") {
+                cerr << "--scaling is strong or weak" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--max-threads")
+            opts.maxThreads = atoi(value);
+        else if (arg == "--alloc-steps")
+            opts.allocSteps = atoi(value);
+        else
+            opts.json = value;
+    }
+    if (opts.warmup < 0 || opts.repetitions <= 0 || opts.threads < 0 || opts.maxThreads < 0 || opts.allocSteps < 0) {
+        cerr << "--warmup, --reps, --threads, --max-threads and --alloc-steps must be positive" << endl;
+        return false;
+    }
+    return true;
+}
+
+static inline double milliseconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Every particle against the walls, like accelerationComputation() does
+///////////////////////////////////////////////////////////////////////////////
+static float collisionSweep(particlesystem& system)
+{
+    FIELD_3D<>& grid = *system.grid;
+    float sum = 0.f;
+#pragma omp parallel for reduction(+:sum)
+    for (int gridCellIndex = 0; gridCellIndex < grid.cellCount(); gridCellIndex++)
+        for (particle& p : grid.data()[gridCellIndex]) {
+            VEC3F collision;
+            system.collisionForce(p, collision);
+            sum += collision.x + collision.y + collision.z;
+        }
+    return sum;
+}
+
+static void runPhase(int phase, particlesystem& system, particlesnapshot& snapshot,
+                     fluidsurface& marchingCubes, const surfacesettings& marchingCubesSettings,
+                     fluidsurface& surfaceNets, const surfacesettings& surfaceNetsSettings)
+{
+    // keeps the collision sweep from being optimized away
+    static volatile float sink = 0.f;
+    switch (phase) {
+    case 0: system.densityAndPressureComputation(); break;
+    case 1: system.accelerationComputation(); break;
+    case 2: system.integrate(); break;
+    case 3: system.swapGrids(); break;
+    case 4: sink = sink + collisionSweep(system); break;
+    case 5: snapshot.capture(*system.grid, system.box(), h); break;
+    case BENCH_MARCHING_CUBES: marchingCubes.compute(snapshot, marchingCubesSettings); break;
+    case BENCH_SURFACE_NETS: surfaceNets.compute(snapshot, surfaceNetsSettings); break;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Times the first phases of the list, with the busy times of the threads
+// for the solver phases when they are measured
+///////////////////////////////////////////////////////////////////////////////
+static void measure(particlesystem& system, int scenario, const benchoptions& opts, int phases,
+                    const perfcounters* counters, vector<benchresult>& results)
+{
+    const size_t first = results.size();
+    for (int phase = 0; phase < phases; phase++) {
+        benchresult result;
+        result.scenario = scenario;
+        result.particles = particle::count;
+        result.phase = phase;
+        result.threads = omp_get_max_threads();
+        result.slices = system.grid->zRes();
+        result.samples.reserve(opts.repetitions);
+        result.triangles = result.vertices = result.fieldBlocks = 0;
+        result.meshBytes = result.fieldBytes = 0;
+        result.updateFraction = 0.0;
+        for (int counter = 0; counter < PERF_COUNTERS; counter++)
+            result.counts[counter] = 0;
+        results.push_back(result);
+    }
+
+    particlesnapshot snapshot;
+    fluidsurface marchingCubes, surfaceNets;
+    surfacesettings marchingCubesSettings, surfaceNetsSettings;
+    marchingCubesSettings.particleMass = surfaceNetsSettings.particleMass = system.mass();
+    surfaceNetsSettings.extraction = SURFACE_NETS;
+
+    for (int rep = 0; rep < opts.warmup + opts.repetitions; rep++) {
+        if (rep == opts.warmup)
+            threadLoadReset();
+        for (int phase = 0; phase < phases; phase++) {
+            // counters are read outside of the timed region
+            unsigned long long before[PERF_COUNTERS], after[PERF_COUNTERS];
+            if (counters)
+                counters->read(before);
+            AllocStats allocationsBefore = allocStats();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            runPhase(phase, system, snapshot, marchingCubes, marchingCubesSettings, surfaceNets, surfaceNetsSettings);
+            double time = milliseconds(start);
+            AllocStats allocations = allocStats() - allocationsBefore;
+            if (counters)
+                counters->read(after);
+            if (rep < opts.warmup)
+                continue;
+            benchresult& result = results[first + phase];
+            result.samples.push_back(time);
+            result.allocations.allocations += allocations.allocations;
+            result.allocations.bytes += allocations.bytes;
+            if (phase == BENCH_MARCHING_CUBES)
+                result.updateFraction += marchingCubes.updateFraction();
+            else if (phase == BENCH_SURFACE_NETS)
+                result.updateFraction += surfaceNets.updateFraction();
+            if (counters)
+                for (int counter = 0; counter < PERF_COUNTERS; counter++)
+                    result.counts[counter] += after[counter] - before[counter];
+        }
+    }
+    for (size_t x = first; x < results.size(); x++) {
+        benchresult& result = results[x];
+        sort(result.samples.begin(), result.samples.end());
+        if (isSurfacePhase(result.phase)) {
+            const fluidsurface& surface = result.phase == BENCH_MARCHING_CUBES ? marchingCubes : surfaceNets;
+            result.triangles = surface.mesh.triangleCount();
+            result.vertices = surface.mesh.vertexCount();
+            result.meshBytes = surface.mesh.memory();
+            result.updateFraction /= opts.repetitions;
+            if (surface.grid()) {
+                result.fieldBlocks = (int)surface.grid()->storedBlocks().size();
+                result.fieldBytes = surface.grid()->memory();
+            }
+        }
+        if (threadLoadEnabled() && result.phase < BENCH_SOLVER_PHASES)
+            for (int thread = 0; thread < result.threads; thread++)
+                result.busy.push_back(threadLoadBusy(result.phase, thread) / opts.repetitions);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs the faucet until it holds count particles, steps counts the steps it
+// has run so far
+///////////////////////////////////////////////////////////////////////////////
+static void growFaucet(particlesystem& system, int count, int& steps, const benchoptions& opts)
+{
+    // the nozzle grows with the box but the box grows faster
+    const int growthSteps = (int)(opts.growthSteps * max(1.f, system.sceneScale()));
+    while ((int)particle::count < count && steps < growthSteps) {
+        system.stepVerlet();
+        steps++;
+    }
+    if ((int)particle::count < count)
+        cerr << "faucet stopped at " << particle::count << " particles, wanted " << count << endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs every scenario for --alloc-steps full steps, at the first --particles
+// size or the classic scene. The steps after the warm-up of the solver must
+// not allocate, nor may the faucet and rain once they stopped emitting.
+// Returns the scenarios that did
+///////////////////////////////////////////////////////////////////////////////
+static int checkAllocations(const benchoptions& opts, vector<alloccheck>& checks)
+{
+    int failed = 0;
+    for (int scenario : opts.scenarios) {
+        particlesystem system;
+        system.scenario(scenario);
+        system.loadScenario(scenario, opts.particles.empty() ? 0 : opts.particles[0]);
+        for (int step = 0; step < opts.allocSteps; step++)
+            system.stepVerlet();
+        alloccheck check;
+        check.scenario = scenario;
+        check.particles = particle::count;
+        check.steps = opts.allocSteps;
+        check.steadyStateSteps = system.steadyStateAllocationSteps();
+        check.allocations = system.totalStepAllocations();
+        checks.push_back(check);
+        if (check.steadyStateSteps > 0)
+            failed++;
+    }
+    return failed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Every scenario at 1 to maxThreads threads, at the first --particles size
+// or the classic scene. Weak scaling multiplies the size by the threads,
+// 1000 particles per thread without --particles
+///////////////////////////////////////////////////////////////////////////////
+static void measureScaling(const benchoptions& opts, vector<benchresult>& results)
+{
+    const bool weak = opts.scaling == "weak";
+    const int maxThreads = opts.maxThreads > 0 ? opts.maxThreads : omp_get_num_procs();
+    threadLoadEnable(true);
+    for (int scenario : opts.scenarios)
+        for (int threads = 1; threads <= maxThreads; threads++) {
+            omp_set_num_threads(threads);
+            int particles = opts.particles.empty() ? 0 : opts.particles[0];
+            if (weak)
+                particles = (particles > 0 ? particles : 1000) * threads;
+            particlesystem system;
+            system.scenario(scenario);
+            system.loadScenario(scenario, particles);
+            if (scenario == SCENARIO_FAUCET) {
+                int steps = 0;
+                growFaucet(system, particles > 0 ? particles : opts.counts[0], steps, opts);
+            }
+            measure(system, scenario, opts, BENCH_SOLVER_PHASES, NULL, results);
+        }
+    threadLoadEnable(false);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Against the single thread run of the same scenario and phase. Weak
+// scaling compares times directly, its speedup is the scaled one
+///////////////////////////////////////////////////////////////////////////////
+static void scalingFigures(const benchoptions& opts, const vector<benchresult>& results, const benchresult& r,
+                           double& speedup, double& efficiency)
+{
+    speedup = efficiency = 0.0;
+    for (const benchresult& base : results) {
+        if (base.threads != 1 || base.scenario != r.scenario || base.phase != r.phase)
+            continue;
+        if (opts.scaling == "weak") {
+            efficiency = base.median() / r.median();
+            speedup = efficiency * r.threads;
+        }
+        else {
+            speedup = base.median() / r.median();
+            efficiency = speedup / r.threads;
+        }
+        return;
+    }
+}
+
+// milliseconds per step the thread waited for the others
+static inline double idle(const benchresult& r, int thread)
+{
+    double time = r.mean() - r.busy[thread];
+    return time > 0.0 ? time : 0.0;
+}
+
+static void printScaling(const benchoptions& opts, const vector<benchresult>& results)
+{
+    printf("%s scaling\n", opts.scaling.c_str());
+    printf("%-8s %9s %6s %7s  %-12s %10s %8s %10s %7s %7s  %s\n", "scenario", "particles", "slices", "threads",
+           "phase", "median ms", "speedup", "efficiency", "idle %", "max %", "busy ms per thread");
+    for (const benchresult& r : results) {
+        double speedup, efficiency;
+        scalingFigures(opts, results, r, speedup, efficiency);
+        double idleSum = 0.0, idleMax = 0.0;
+        for (int thread = 0; thread < r.threads; thread++) {
+            idleSum += idle(r, thread);
+            idleMax = max(idleMax, idle(r, thread));
+        }
+        printf("%-8s %9d %6d %7d  %-12s %10.3f %8.2f %10.2f %7.1f %7.1f ", scenarioNames[r.scenario], r.particles,
+               r.slices, r.threads, phaseNames[r.phase], r.median(), speedup, efficiency,
+               100.0 * idleSum / r.threads / r.mean(), 100.0 * idleMax / r.mean());
+        for (int thread = 0; thread < r.threads; thread++)
+            printf(" %.3f", r.busy[thread]);
+        printf("\n");
+    }
+}
+
+static void printResults(const vector<benchresult>& results, const perfcounters* counters)
+{
+    printf("%-8s %9s  %-24s %10s %10s %10s", "scenario", "particles", "phase", "median ms", "p95 ms", "min ms");
+    if (counters)
+        printf(" %6s %12s", "IPC", "LLC/particle");
+    if (allocCountingEnabled())
+        printf(" %8s %10s", "allocs", "bytes");
+    printf("\n");
+    for (const benchresult& r : results) {
+        printf("%-8s %9d  %-24s %10.3f %10.3f %10.3f", scenarioNames[r.scenario], r.particles,
+               phaseNames[r.phase], r.median(), r.p95(), r.samples.front());
+        if (counters) {
+            if (counters->available(PERF_CYCLES) && counters->available(PERF_INSTRUCTIONS) && r.counts[PERF_CYCLES] > 0)
+                printf(" %6.2f", (double)r.counts[PERF_INSTRUCTIONS] / r.counts[PERF_CYCLES]);
+            else
+                printf(" %6s", "n/a");
+            if (counters->available(PERF_LLC_MISSES) && r.particles > 0)
+                printf(" %12.3f", (double)r.counts[PERF_LLC_MISSES] / r.samples.size() / r.particles);
+            else
+                printf(" %12s", "n/a");
+        }
+        if (allocCountingEnabled())
+            printf(" %8lu %10lu", r.allocations.allocations, r.allocations.bytes);
+        printf("\n");
+    }
+}
+
+static void writeScaling(FILE* file, const benchoptions& opts, const vector<benchresult>& results,
+                         const benchresult& r)
+{
+    double speedup, efficiency;
+    scalingFigures(opts, results, r, speedup, efficiency);
+    fprintf(file, ", \"threads\": %d, \"z_slices\": %d, \"speedup\": %.4f, \"efficiency\": %.4f, \"busy_ms\": [",
+            r.threads, r.slices, speedup, efficiency);
+    for (int thread = 0; thread < r.threads; thread++)
+        fprintf(file, "%s%.6f", thread ? ", " : "", r.busy[thread]);
+    fprintf(file, "], \"idle_ms\": [");
+    for (int thread = 0; thread < r.threads; thread++)
+        fprintf(file, "%s%.6f", thread ? ", " : "", idle(r, thread));
+    fprintf(file, "]");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Hardware figures per step, or null when the counters they need are not
+// available
+///////////////////////////////////////////////////////////////////////////////
+static void writeCount(FILE* file, const char* key, bool available, double value)
+{
+    if (available)
+        fprintf(file, ", \"%s\": %.3f", key, value);
+    else
+        fprintf(file, ", \"%s\": null", key);
+}
+
+static void writeCounters(FILE* file, const benchresult& r, const perfcounters& counters)
+{
+    const double steps = (double)r.samples.size();
+    const double particles = r.particles > 0 ? (double)r.particles : 1.0;
+    for (int counter = 0; counter < PERF_COUNTERS; counter++)
+        writeCount(file, perfcounters::name(counter), counters.available(counter), r.counts[counter] / steps);
+    const bool ipc = counters.available(PERF_CYCLES) && counters.available(PERF_INSTRUCTIONS) &&
+                     r.counts[PERF_CYCLES] > 0;
+    writeCount(file, "ipc", ipc, ipc ? (double)r.counts[PERF_INSTRUCTIONS] / r.counts[PERF_CYCLES] : 0.0);
+    writeCount(file, "llc_misses_per_particle", counters.available(PERF_LLC_MISSES),
+               r.counts[PERF_LLC_MISSES] / steps / particles);
+    writeCount(file, "branch_misses_per_particle", counters.available(PERF_BRANCH_MISSES),
+               r.counts[PERF_BRANCH_MISSES] / steps / particles);
+}
+
+// the surfaces the extractions made, side by side
+static void printSurfaces(const vector<benchresult>& results)
+{
+    printf("%-8s %9s  %-24s %10s %10s %10s %12s %10s %9s\n", "scenario", "particles", "surface", "triangles",
+           "vertices", "mesh KB", "field blocks", "field KB", "updated %");
+    for (const benchresult& r : results)
+        if (isSurfacePhase(r.phase))
+            printf("%-8s %9d  %-24s %10d %10d %10.1f %12d %10.1f %9.1f\n", scenarioNames[r.scenario], r.particles,
+                   phaseNames[r.phase], r.triangles, r.vertices, r.meshBytes / 1024.0, r.fieldBlocks,
+                   r.fieldBytes / 1024.0, 100.0 * r.updateFraction);
+}
+
+static void writeSurface(FILE* file, const benchresult& r)
+{
+    fprintf(file, ", \"triangles\": %d, \"vertices\": %d, \"mesh_bytes\": %zu, \"field_blocks\": %d, \"field_bytes\": %zu"
+                  ", \"update_fraction\": %.4f",
+            r.triangles, r.vertices, r.meshBytes, r.fieldBlocks, r.fieldBytes, r.updateFraction);
+}
+
+static void printAllocationChecks(const vector<alloccheck>& checks)
+{
+    printf("%-8s %9s %6s  %-20s %11s %12s\n", "scenario", "particles", "steps", "allocating after warm-up",
+           "allocations", "bytes");
+    for (const alloccheck& check : checks)
+        printf("%-8s %9d %6d  %-20lu %11lu %12lu\n", scenarioNames[check.scenario], check.particles, check.steps,
+               check.steadyStateSteps, check.allocations.allocations, check.allocations.bytes);
+}
+
+// heap allocations of the timed repetitions, null when they are not counted
+static void writeAllocations(FILE* file, const benchresult& r)
+{
+    if (allocCountingEnabled())
+        fprintf(file, ", \"allocations\": %lu, \"allocated_bytes\": %lu", r.allocations.allocations, r.allocations.bytes);
+    else
+        fprintf(file, ", \"allocations\": null, \"allocated_bytes\": null");
+}
+
+static void writeAllocationChecks(FILE* file, const vector<alloccheck>& checks)
+{
+    fprintf(file, "  \"allocation_check\": [\n");
+    for (size_t x = 0; x < checks.size(); x++) {
+        const alloccheck& check = checks[x];
+        fprintf(file, "    {\"scenario\": \"%s\", \"particles\": %d, \"steps\": %d, "
+                      "\"steady_state_allocation_steps\": %lu, \"allocations\": %lu, \"allocated_bytes\": %lu}%s\n",
+                scenarioNames[check.scenario], check.particles, check.steps, check.steadyStateSteps,
+                check.allocations.allocations, check.allocations.bytes, x + 1 < checks.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+}
+
+static bool writeJson(const char* filename, const benchoptions& opts, const vector<benchresult>& results,
+                      const perfcounters& counters, const vector<alloccheck>& checks)
+{
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        printf("Couldn't open file %s!\n", filename);
+        return false;
+    }
+    fprintf(file, "{\n  \"threads\": %d,\n  \"warmup\": %d,\n  \"repetitions\": %d,\n",
+            omp_get_max_threads(), opts.warmup, opts.repetitions);
+    if (opts.counters)
+        fprintf(file, "  \"counters_available\": %s,\n", counters.anyAvailable() ? "true" : "false");
+    if (!opts.scaling.empty())
+        fprintf(file, "  \"scaling\": \"%s\",\n", opts.scaling.c_str());
+    if (!checks.empty())
+        writeAllocationChecks(file, checks);
+    fprintf(file, "  \"results\": [\n");
+    for (size_t x = 0; x < results.size(); x++) {
+        const benchresult& r = results[x];
+        fprintf(file, "    {\"scenario\": \"%s\", \"particles\": %d, \"phase\": \"%s\", "
+                      "\"median_ms\": %.6f, \"p95_ms\": %.6f, \"min_ms\": %.6f, \"mean_ms\": %.6f",
+                scenarioNames[r.scenario], r.particles, phaseNames[r.phase],
+                r.median(), r.p95(), r.samples.front(), r.mean());
+        writeAllocations(file, r);
+        if (isSurfacePhase(r.phase))
+            writeSurface(file, r);
+        if (opts.counters)
+            writeCounters(file, r, counters);
+        if (!opts.scaling.empty())
+            writeScaling(file, opts, results, r);
+        fprintf(file, "}%s\n", x + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    bool success = !ferror(file);
+    success = fclose(file) == 0 && success;
+    return success;
+}
+
+int main(int argc, char** argv)
+{
+    benchoptions opts;
+    if (!parseOptions(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opts.scenarios.empty())
+        for (int scenario = 0; scenario < 5; scenario++)
+            opts.scenarios.push_back(scenario);
+    if (opts.counts.empty()) {
+        opts.counts.push_back(1000);
+        opts.counts.push_back(2000);
+        opts.counts.push_back(4000);
+    }
+
+    perfcounters counters;
+    vector<benchresult> results;
+    vector<alloccheck> checks;
+    if (!opts.scaling.empty()) {
+        // the counters are opened for one team size
+        if (opts.counters) {
+            cerr << "--counters and --scaling can't be combined" << endl;
+            return 1;
+        }
+        measureScaling(opts, results);
+        printScaling(opts, results);
+        if (!opts.json.empty() && !writeJson(opts.json.c_str(), opts, results, counters, checks))
+            return 1;
+        return 0;
+    }
+
+    if (opts.threads > 0)
+        omp_set_num_threads(opts.threads);
+
+    // opened for the team the phases run with
+    if (opts.counters && !counters.open())
+        cerr << "hardware performance counters are not available, only times are measured" << endl;
+    const perfcounters* sampled = counters.anyAvailable() ? &counters : NULL;
+
+    for (int scenario : opts.scenarios) {
+        particlesystem system;
+        system.scenario(scenario);
+        for (int particles : opts.particles) {
+            system.loadScenario(scenario, particles);
+            if (scenario == SCENARIO_FAUCET) {
+                int steps = 0;
+                growFaucet(system, particles, steps, opts);
+            }
+            measure(system, scenario, opts, BENCH_PHASES, sampled, results);
+        }
+        if (!opts.particles.empty())
+            continue;
+        system.loadScenario(scenario);
+        if (scenario != SCENARIO_FAUCET) {
+            measure(system, scenario, opts, BENCH_PHASES, sampled, results);
+            continue;
+        }
+        int steps = 0;
+        for (int count : opts.counts) {
+            growFaucet(system, count, steps, opts);
+            measure(system, scenario, opts, BENCH_PHASES, sampled, results);
+        }
+    }
+    printResults(results, sampled);
+    printSurfaces(results);
+
+    int allocating = 0;
+    if (allocCountingEnabled() && opts.allocSteps > 0) {
+        allocating = checkAllocations(opts, checks);
+        printAllocationChecks(checks);
+    }
+
+    if (!opts.json.empty() && !writeJson(opts.json.c_str(), opts, results, counters, checks))
+        return 1;
+    if (allocating > 0) {
+        cerr << allocating << " scenarios allocated after warm-up" << endl;
+        return 1;
+    }
+    return 0;
+}
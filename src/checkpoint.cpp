@@ -0,0 +1,282 @@
+#include "../include/particlesystem.h"
+#include "../include/checkpoint.h"
+#include <omp.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <sstream>
+#include <type_traits>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CHECKPOINT_MMAP
+#endif
+
+// particles are stored and copied as raw bytes, which their members (floats,
+// VEC3Fs, bools and an id) allow although VEC3F declares a copy constructor
+static_assert(std::is_standard_layout<particle>::value, "checkpoints store particles as raw records");
+
+///////////////////////////////////////////////////////////////////////////////
+// A checkpoint file mapped read only, or read into memory where there is
+// no mmap
+///////////////////////////////////////////////////////////////////////////////
+class checkpointfile {
+public:
+    checkpointfile() : data(NULL), size(0) {}
+    ~checkpointfile() { close(); }
+
+    bool open(const char* filename)
+    {
+#ifdef CHECKPOINT_MMAP
+        int descriptor = ::open(filename, O_RDONLY);
+        if (descriptor < 0)
+            return false;
+        struct stat status;
+        if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+            void* mapped = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (mapped != MAP_FAILED) {
+                data = (const char*)mapped;
+                size = (size_t)status.st_size;
+                // the records are copied out front to back, once
+                madvise(mapped, size, MADV_SEQUENTIAL);
+                madvise(mapped, size, MADV_WILLNEED);
+            }
+        }
+        ::close(descriptor);
+        return data != NULL;
+#else
+        FILE* file = fopen(filename, "rb");
+        if (file == NULL)
+            return false;
+        bool success = fseek(file, 0, SEEK_END) == 0;
+        long length = success ? ftell(file) : -1;
+        success = length > 0 && fseek(file, 0, SEEK_SET) == 0;
+        if (success) {
+            _buffer.resize((size_t)length);
+            success = fread(&_buffer[0], 1, _buffer.size(), file) == _buffer.size();
+        }
+        fclose(file);
+        if (success) {
+            data = &_buffer[0];
+            size = _buffer.size();
+        }
+        return success;
+#endif
+    }
+
+    void close()
+    {
+#ifdef CHECKPOINT_MMAP
+        if (data)
+            munmap((void*)data, size);
+#else
+        vector<char>().swap(_buffer);
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+    const char* data;
+    size_t size;
+
+private:
+#ifndef CHECKPOINT_MMAP
+    vector<char> _buffer;
+#endif
+};
+
+static inline long long alignUp(long long offset)
+{
+    return (offset + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The file is written front to back in large sequential writes. The
+// particles are gathered in parallel, a run of whole cells at a time, into
+// a staging buffer of CHECKPOINT_CHUNK bytes, so writing does not need a
+// second copy of every particle
+///////////////////////////////////////////////////////////////////////////////
+bool particlesystem::saveCheckpoint(const char* filename) const
+{
+    const int cellCount = grid->cellCount();
+    vector<long long> offsets(cellCount + 1);
+    offsets[0] = 0;
+    for (int cell = 0; cell < cellCount; cell++)
+        offsets[cell + 1] = offsets[cell] + (long long)grid->data()[cell].size();
+
+    checkpointheader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = CHECKPOINT_MAGIC;
+    header.version = CHECKPOINT_VERSION;
+    header.headerSize = sizeof(checkpointheader);
+    header.particleSize = sizeof(particle);
+    header.scenario = _scenario;
+    header.capacity = _capacity;
+    header.seed = _seed;
+    std::ostringstream random;
+    random << _random;
+    if (random.str().size() >= sizeof(header.random)) {
+        printf("The state of the random generator does not fit into checkpoint %s!\n", filename);
+        return false;
+    }
+    random.str().copy(header.random, sizeof(header.random) - 1);
+    header.deterministic = _deterministic ? 1 : 0;
+    header.tumble = _tumble ? 1 : 0;
+    header.sceneScale = _sceneScale;
+    header.dt = dt;
+    header.particleMass = particleMass;
+    header.viscosity = viscosity;
+    header.surfaceThreshold = surfaceThreshold;
+    for (int axis = 0; axis < 3; axis++) {
+        header.box[axis] = boxSize[axis];
+        header.gravity[axis] = gravityVector[axis];
+    }
+    header.res[0] = grid->xRes();
+    header.res[1] = grid->yRes();
+    header.res[2] = grid->zRes();
+    header.cellCount = cellCount;
+    header.step = _frameCount;
+    header.idCount = particle::count;
+    header.particles = offsets[cellCount];
+    const size_t offsetsEnd = sizeof(header) + offsets.size() * sizeof(long long);
+    header.particleOffset = alignUp(offsetsEnd);
+
+    string temporary = string(filename) + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == NULL) {
+        printf("Couldn't open file %s!\n", temporary.c_str());
+        return false;
+    }
+    const char padding[CHECKPOINT_ALIGN] = { 0 };
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+    success = success && fwrite(offsets.data(), sizeof(long long), offsets.size(), file) == offsets.size();
+    success = success && fwrite(padding, 1, (size_t)header.particleOffset - offsetsEnd, file) == (size_t)header.particleOffset - offsetsEnd;
+
+    const long long chunkParticles = std::max<long long>(1, CHECKPOINT_CHUNK / sizeof(particle));
+    vector<particle> staging;
+    for (int first = 0; success && first < cellCount; ) {
+        // whole cells, at least one, a cell larger than the buffer grows it
+        int last = first + 1;
+        while (last < cellCount && offsets[last + 1] - offsets[first] <= chunkParticles)
+            last++;
+        const long long count = offsets[last] - offsets[first];
+        if ((long long)staging.size() < count)
+            staging.resize(count);
+#pragma omp parallel for schedule(dynamic, 256)
+        for (int cell = first; cell < last; cell++) {
+            const vector<particle>& particles = grid->data()[cell];
+            if (!particles.empty())
+                memcpy((void*)&staging[offsets[cell] - offsets[first]], particles.data(), particles.size() * sizeof(particle));
+        }
+        success = fwrite(staging.data(), sizeof(particle), count, file) == (size_t)count;
+        first = last;
+    }
+    success = fflush(file) == 0 && success;
+#ifdef CHECKPOINT_MMAP
+    // on disk before it replaces the previous checkpoint
+    success = success && fsync(fileno(file)) == 0;
+#endif
+    success = fclose(file) == 0 && success;
+    success = success && rename(temporary.c_str(), filename) == 0;
+    if (!success) {
+        printf("Couldn't write checkpoint %s!\n", filename);
+        remove(temporary.c_str());
+    }
+    return success;
+}
+
+// the header and cell offsets describe a file of exactly this size
+static bool validCheckpoint(const checkpointfile& file)
+{
+    if (file.size < sizeof(checkpointheader))
+        return false;
+    const checkpointheader* header = (const checkpointheader*)file.data;
+    if (header->magic != CHECKPOINT_MAGIC || header->version != CHECKPOINT_VERSION ||
+        header->headerSize != sizeof(checkpointheader) || header->particleSize != sizeof(particle))
+        return false;
+    // the state of the rain generator has to be one
+    if (memchr(header->random, '\0', sizeof(header->random)) == NULL)
+        return false;
+    std::istringstream random(header->random);
+    std::mt19937 generator;
+    if (!(random >> generator))
+        return false;
+    if (header->res[0] <= 0 || header->res[1] <= 0 || header->res[2] <= 0 ||
+        (long long)header->res[0] * header->res[1] * header->res[2] != header->cellCount ||
+        header->particles < 0 || header->particles > header->idCount)
+        return false;
+    const long long offsetsEnd = sizeof(checkpointheader) + ((long long)header->cellCount + 1) * (long long)sizeof(long long);
+    if (header->particleOffset != alignUp(offsetsEnd) ||
+        (unsigned long long)header->particleOffset + header->particles * sizeof(particle) != file.size)
+        return false;
+    const long long* offsets = (const long long*)(file.data + sizeof(checkpointheader));
+    if (offsets[0] != 0 || offsets[header->cellCount] != header->particles)
+        return false;
+    for (int cell = 0; cell < header->cellCount; cell++)
+        if (offsets[cell + 1] < offsets[cell])
+            return false;
+    return true;
+}
+
+bool particlesystem::loadCheckpoint(const char* filename)
+{
+    checkpointfile file;
+    if (!file.open(filename)) {
+        printf("Couldn't open file %s!\n", filename);
+        return false;
+    }
+    if (!validCheckpoint(file)) {
+        printf("%s is not a checkpoint of this version and particle layout\n", filename);
+        return false;
+    }
+    const checkpointheader& header = *(const checkpointheader*)file.data;
+    const long long* offsets = (const long long*)(file.data + sizeof(checkpointheader));
+    const particle* records = (const particle*)(file.data + header.particleOffset);
+
+    if (grid) delete grid;
+    if (nextGrid) delete nextGrid;
+    releaseSurfacePipeline();
+    _scenario = header.scenario;
+    _capacity = header.capacity;
+    _seed = header.seed;
+    std::istringstream random(header.random);
+    random >> _random;
+    _deterministic = header.deterministic != 0;
+    _tumble = header.tumble != 0;
+    _sceneScale = header.sceneScale;
+    dt = header.dt;
+    particleMass = header.particleMass;
+    viscosity = header.viscosity;
+    surfaceThreshold = header.surfaceThreshold;
+    boxSize = VEC3F(header.box[0], header.box[1], header.box[2]);
+    gravityVector = VEC3F(header.gravity[0], header.gravity[1], header.gravity[2]);
+    _walls.clear();
+    boundary.createwall(BOX_SIZE * _sceneScale, h, _walls);
+    particle::count = (unsigned int)header.idCount;
+    _frameCount = (long)header.step;
+    _stepsSinceGrowth = 0;
+    _cellReserve = 0;
+    _stepAllocations = AllocStats();
+    _totalStepAllocations = AllocStats();
+    _steadyStateAllocationSteps = 0;
+
+    // reserved before filling, so a cell is allocated once
+    grid = new FIELD_3D<>(header.res[0], header.res[1], header.res[2]);
+    nextGrid = new FIELD_3D<>(header.res[0], header.res[1], header.res[2]);
+    reserveCells();
+
+    // nextGrid only has to hold the same particles at the same places, a
+    // step overwrites everything else of it before reading it
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int cell = 0; cell < header.cellCount; cell++) {
+        grid->data()[cell].assign(records + offsets[cell], records + offsets[cell + 1]);
+        nextGrid->data()[cell].assign(records + offsets[cell], records + offsets[cell + 1]);
+    }
+    file.close();
+
+    updateSurfaceStorage();
+    return true;
+}
@@ -0,0 +1,373 @@
+#include "../include/fluidsurface.h"
+#include "../include/particlesystem.h"
+#include "../include/trace.h"
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor / Destructor
+///////////////////////////////////////////////////////////////////////////////
+fluidsurface::fluidsurface() :
+    _grid(NULL), _fullUpdate(true), _bulkValue(0.f), _updateFraction(1.f), _resamples(0)
+{
+}
+
+fluidsurface::~fluidsurface()
+{
+    if (_grid) delete _grid;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sample the fluid bounding box, padded by SURFACE_MARGIN smoothing lengths,
+// every PARTICLE_DRAW_RADIUS
+///////////////////////////////////////////////////////////////////////////////
+void fluidsurface::generateGrid(const particlesnapshot& snapshot)
+{
+    VEC3F lower, upper;
+    snapshot.bounds(lower, upper);
+    VEC3F margin(SURFACE_MARGIN * h, SURFACE_MARGIN * h, SURFACE_MARGIN * h);
+    lower -= margin;
+    upper += margin;
+
+    const float step = PARTICLE_DRAW_RADIUS;
+    int xRes = (int)floor((upper.x - lower.x) / step) + 1;
+    int yRes = (int)floor((upper.y - lower.y) / step) + 1;
+    int zRes = (int)floor((upper.z - lower.z) / step) + 1;
+    if (!_grid)
+        _grid = new SCALAR_FIELD_3D();
+    // the narrow band only gets storage once the surface particles are known
+    _grid->resize(xRes, yRes, zRes, lower, step, _settings.narrowBand ? FIELD_BLOCK_OUTSIDE : FIELD_BLOCK_STORED);
+    _blockChanged.assign(_grid->totalBlocks(), 1);
+    _fullUpdate = true;
+    _resamples++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// In the bulk, every particle adds density * Wpoly6 and the Wpoly6 sum is
+// density / mass, so the color field sits around density^2 / mass there.
+///////////////////////////////////////////////////////////////////////////////
+void fluidsurface::compute(const particlesnapshot& snapshot, const surfacesettings& settings)
+{
+    TRACE_SCOPE("surface");
+    // the band and the extractor in use decide what the kept buffers hold
+    bool regrid = settings.narrowBand != _settings.narrowBand;
+    if (settings.extraction != _settings.extraction)
+    {
+        if (settings.extraction == SURFACE_NETS)
+            _marchingCubes.release();
+        else
+            _surfaceNets.release();
+    }
+    if (!settings.incremental)
+        _fullUpdate = true;
+    _settings = settings;
+
+    // resample once the fluid leaves the sampled region, the margin keeps this rare
+    VEC3F lower, upper;
+    snapshot.bounds(lower, upper);
+    if (!_grid || regrid ||
+        lower.x < _grid->origin().x + h || lower.y < _grid->origin().y + h || lower.z < _grid->origin().z + h ||
+        upper.x > _grid->upper().x - h || upper.y > _grid->upper().y - h || upper.z > _grid->upper().z - h)
+        generateGrid(snapshot);
+
+    // the kept samples and surface are only valid for the bulk value they were computed with
+    const float density = snapshot.meanDensity();
+    const float bulkValue = density * density / settings.particleMass;
+    if (fabs(bulkValue - _bulkValue) > SURFACE_BULK_TOLERANCE * bulkValue)
+        _fullUpdate = true;
+    if (_fullUpdate)
+        _bulkValue = bulkValue;
+    _grid->setInsideValue(_bulkValue);
+
+    _blockChanged.assign(_grid->totalBlocks(), _fullUpdate);
+    flagMovedParticles(snapshot);
+    if (settings.narrowBand)
+        updateBand(snapshot);
+
+    int updated = 0;
+    for (int block : _grid->storedBlocks())
+        updated += _blockChanged[block];
+    _updateFraction = _grid->storedBlocks().empty() ? 0.f : (float)updated / _grid->storedBlocks().size();
+
+    if (settings.sampling == SURFACE_SCATTER)
+        computeScatter(snapshot);
+    else
+        computeGather(snapshot);
+
+    const vector<unsigned char>* changed = _fullUpdate ? NULL : &_blockChanged;
+    if (settings.extraction == SURFACE_NETS)
+        _surfaceNets.extract(*_grid, settings.isoLevel * _bulkValue, mesh, changed);
+    else
+        _marchingCubes.extract(*_grid, settings.isoLevel * _bulkValue, mesh, changed);
+    _fullUpdate = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Incremental update: a particle that moved more than SURFACE_TOLERANCE
+// smoothing lengths since the samples around it were computed flags the
+// blocks it reaches, at its old and new position. Samples not flagged
+// keep their value, which is off by the moves below the tolerance.
+///////////////////////////////////////////////////////////////////////////////
+void fluidsurface::flagMovedParticles(const particlesnapshot& snapshot)
+{
+    TRACE_SCOPE("surfaceFlag");
+    const float never = std::numeric_limits<float>::max();
+    const int count = snapshot.particleCount();
+    int maxId = -1;
+#pragma omp parallel for reduction(max:maxId)
+    for (int i = 0; i < count; i++)
+        maxId = std::max(maxId, snapshot.ids[i]);
+    if ((int)_referencePositions.size() <= maxId)
+        _referencePositions.resize(maxId + 1, VEC3F(never, never, never));
+    static float tolerance2 = SURFACE_TOLERANCE * h * SURFACE_TOLERANCE * h;
+#pragma omp parallel for
+    for (int i = 0; i < count; i++)
+    {
+        const VEC3F& position = snapshot.positions[i];
+        VEC3F& reference = _referencePositions[snapshot.ids[i]];
+        if (_fullUpdate)
+        {
+            reference = position;
+            continue;
+        }
+        VEC3F moved = position - reference;
+        if (moved.dot(moved) <= tolerance2)
+            continue;
+        if (reference.x != never)
+            flagBlocks(reference);
+        flagBlocks(position);
+        reference = position;
+    }
+}
+
+void fluidsurface::flagBlocks(const VEC3F& position)
+{
+    const int* blockRes = _grid->blockRes();
+    const float overBlockSize = 1.f / (FIELD_BLOCK * _grid->spacing());
+    const VEC3F& origin = _grid->origin();
+    int first[3], last[3];
+    for (int a = 0; a < 3; a++)
+    {
+        first[a] = std::max(0, (int)floor((position[a] - h - origin[a]) * overBlockSize));
+        last[a] = std::min(blockRes[a] - 1, (int)floor((position[a] + h - origin[a]) * overBlockSize));
+    }
+    unsigned char* changed = &_blockChanged[0];
+    for (int bz = first[2]; bz <= last[2]; bz++)
+        for (int by = first[1]; by <= last[1]; by++)
+            for (int bx = first[0]; bx <= last[0]; bx++)
+            {
+                unsigned char& blockChanged = changed[bx + blockRes[0] * (by + blockRes[1] * bz)];
+#pragma omp atomic write
+                blockChanged = 1;
+            }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Narrow band: only the blocks within SURFACE_BAND smoothing lengths of a
+// surface particle are stored. The others are constant, inside the fluid
+// when they hold a particle and outside otherwise, so the surface still
+// closes where the band misses it.
+///////////////////////////////////////////////////////////////////////////////
+void fluidsurface::updateBand(const particlesnapshot& snapshot)
+{
+    TRACE_SCOPE("surfaceBand");
+    _blockStates.assign(_grid->totalBlocks(), FIELD_BLOCK_OUTSIDE);
+    unsigned char* states = &_blockStates[0];
+    const int* blockRes = _grid->blockRes();
+    const float overBlockSize = 1.f / (FIELD_BLOCK * _grid->spacing());
+    const VEC3F& origin = _grid->origin();
+    const int count = snapshot.particleCount();
+
+    // inside blocks first so that marking the band never races with them
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const unsigned char state = pass == 0 ? FIELD_BLOCK_INSIDE : FIELD_BLOCK_STORED;
+        const float reach = pass == 0 ? 0.f : SURFACE_BAND * h;
+#pragma omp parallel for
+        for (int i = 0; i < count; i++)
+        {
+            if (pass == 1 && !snapshot.flags[i])
+                continue;
+            const VEC3F& position = snapshot.positions[i];
+            int first[3], last[3];
+            for (int a = 0; a < 3; a++)
+            {
+                first[a] = std::max(0, (int)floor((position[a] - reach - origin[a]) * overBlockSize));
+                last[a] = std::min(blockRes[a] - 1, (int)floor((position[a] + reach - origin[a]) * overBlockSize));
+            }
+            for (int bz = first[2]; bz <= last[2]; bz++)
+                for (int by = first[1]; by <= last[1]; by++)
+                    for (int bx = first[0]; bx <= last[0]; bx++)
+                    {
+                        unsigned char& blockState = states[bx + blockRes[0] * (by + blockRes[1] * bz)];
+#pragma omp atomic write
+                        blockState = state;
+                    }
+        }
+    }
+    // blocks changing state are extracted again, the new stored ones computed
+    for (int b = 0; b < _grid->totalBlocks(); b++)
+        if (_grid->blockState(b) != _blockStates[b])
+            _blockChanged[b] = 1;
+    _grid->setBlockStates(_blockStates);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Color field by gathering, for every changed stored sample, the particles
+// of the 27 surrounding grid cells
+///////////////////////////////////////////////////////////////////////////////
+void fluidsurface::computeGather(const particlesnapshot& snapshot)
+{
+    TRACE_SCOPE("surfaceSample");
+    static float h2 = h*h;
+    const vector<int>& blocks = _grid->storedBlocks();
+    const int blockCount = (int)blocks.size();
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < blockCount; ++i )
+    {
+        if (!_blockChanged[blocks[i]])
+            continue;
+        int lower[3], upper[3];
+        _grid->blockRange(blocks[i], lower, upper);
+        float* samples = _grid->blockData(blocks[i]);
+        for(int z = lower[2]; z < std::min(upper[2], _grid->zRes()); ++z )
+        {
+            for(int y = lower[1]; y < std::min(upper[1], _grid->yRes()); ++y)
+            {
+                for(int x = lower[0]; x < std::min(upper[0], _grid->xRes()); ++x)
+                {
+                    VEC3F position = _grid->position(x,y,z);
+                    int cellX, cellY, cellZ;
+                    snapshot.cell(position, cellX, cellY, cellZ);
+                    float color = 0.0;
+                    for(int zz = cellZ - 1; zz <= cellZ + 1; ++zz)
+                    {
+                        for(int yy = cellY - 1; yy <= cellY + 1; ++yy)
+                        {
+                            for(int xx = cellX - 1; xx <= cellX + 1; ++xx)
+                            {
+                                if( xx >= 0 &&  xx < snapshot.res[0] && yy >= 0 && yy < snapshot.res[1] && zz >= 0 && zz < snapshot.res[2])
+                                {
+                                    const int cell = snapshot.cellIndex(xx,yy,zz);
+                                    for(int j = snapshot.cellStart[cell]; j < snapshot.cellStart[cell + 1]; j++)
+                                    {
+                                        VEC3F diffPos = position - snapshot.positions[j];
+                                        float distSquared = diffPos.dot(diffPos);
+                                        if( h2 <= distSquared )
+                                            continue;
+                                        color += snapshot.densities[j] * particlesystem::Wpoly6(distSquared);
+                                    }
+                                }
+                            }
+                        }
+                    }
+                    samples[_grid->localIndex(x,y,z)] = color;
+                }
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Color field by scattering, every particle adds its contribution to the
+// changed samples closer than h. Samples are much denser than particles so
+// this touches far fewer pairs than the gather.
+//
+// Grid cells are h wide, so the samples reached from one slab of cells
+// along the longest grid axis only overlap those of the two neighboring
+// slabs. Slabs three apart are therefore splatted concurrently, in three
+// passes. The two border slabs hold clamped particles that may lie
+// anywhere outside the box and are splatted serially afterwards.
+///////////////////////////////////////////////////////////////////////////////
+void fluidsurface::computeScatter(const particlesnapshot& snapshot)
+{
+    TRACE_SCOPE("surfaceSample");
+    const vector<int>& blocks = _grid->storedBlocks();
+    const int blockCount = (int)blocks.size();
+#pragma omp parallel for
+    for (int i = 0; i < blockCount; i++)
+        if (_blockChanged[blocks[i]])
+            _grid->clearBlock(blocks[i]);
+
+    const int* res = snapshot.res;
+    int axis = res[0] >= res[1] && res[0] >= res[2] ? 0 : res[1] >= res[2] ? 1 : 2;
+    for (int phase = 0; phase < 3; ++phase)
+    {
+#pragma omp parallel for schedule(dynamic)
+        for (int slab = 1 + phase; slab < res[axis] - 1; slab += 3)
+            splatSlab(snapshot, axis, slab);
+    }
+    splatSlab(snapshot, axis, 0);
+    if (res[axis] > 1)
+        splatSlab(snapshot, axis, res[axis] - 1);
+}
+
+void fluidsurface::splatSlab(const particlesnapshot& snapshot, int axis, int slab)
+{
+    static float h2 = h*h;
+    const float overSpacing = 1.f / _grid->spacing();
+    const VEC3F& origin = _grid->origin();
+    int lower[3], upper[3];
+    int sampleRes[3] = { _grid->xRes(), _grid->yRes(), _grid->zRes() };
+    const int* blockRes = _grid->blockRes();
+    const unsigned char* changed = &_blockChanged[0];
+    lower[0] = lower[1] = lower[2] = 0;
+    upper[0] = snapshot.res[0]; upper[1] = snapshot.res[1]; upper[2] = snapshot.res[2];
+    lower[axis] = slab;
+    upper[axis] = slab + 1;
+
+    for(int z = lower[2]; z < upper[2]; ++z )
+    {
+        for(int y = lower[1]; y < upper[1]; ++y)
+        {
+            for(int x = lower[0]; x < upper[0]; ++x)
+            {
+                const int cell = snapshot.cellIndex(x,y,z);
+                for(int j = snapshot.cellStart[cell]; j < snapshot.cellStart[cell + 1]; j++)
+                {
+                    const VEC3F& position = snapshot.positions[j];
+                    // samples inside the bounding box of the kernel support
+                    int first[3], last[3];
+                    for (int a = 0; a < 3; a++)
+                    {
+                        first[a] = std::max(0, (int)ceil((position[a] - h - origin[a]) * overSpacing));
+                        last[a] = std::min(sampleRes[a] - 1, (int)floor((position[a] + h - origin[a]) * overSpacing));
+                    }
+                    // most particles reach no changed stored block
+                    if (first[0] > last[0] || first[1] > last[1] || first[2] > last[2])
+                        continue;
+                    bool reached = false;
+                    for (int bz = first[2] / FIELD_BLOCK; bz <= last[2] / FIELD_BLOCK && !reached; bz++)
+                        for (int by = first[1] / FIELD_BLOCK; by <= last[1] / FIELD_BLOCK && !reached; by++)
+                            for (int bx = first[0] / FIELD_BLOCK; bx <= last[0] / FIELD_BLOCK && !reached; bx++)
+                            {
+                                int block = bx + blockRes[0] * (by + blockRes[1] * bz);
+                                reached = changed[block] && _grid->blockState(block) == FIELD_BLOCK_STORED;
+                            }
+                    if (!reached)
+                        continue;
+                    const float density = snapshot.densities[j];
+                    for(int sz = first[2]; sz <= last[2]; ++sz)
+                    {
+                        for(int sy = first[1]; sy <= last[1]; ++sy)
+                        {
+                            for(int sx = first[0]; sx <= last[0]; ++sx)
+                            {
+                                VEC3F diffPos = _grid->position(sx,sy,sz) - position;
+                                float distSquared = diffPos.dot(diffPos);
+                                if( h2 <= distSquared )
+                                    continue;
+                                if (!changed[_grid->blockOf(sx,sy,sz)])
+                                    continue;
+                                float* sample = _grid->sample(sx,sy,sz);
+                                if (sample)
+                                    *sample += density * particlesystem::Wpoly6(distSquared);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,446 @@
+// <chrono> before the solver headers, which define h
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <omp.h>
+#include "../include/particlesystem.h"
+#include "../include/trace.h"
+#include "../include/trajectorywriter.h"
+#include "../include/particleexport.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs a scenario without a window, for machines that have no display
+///////////////////////////////////////////////////////////////////////////////
+
+struct options {
+    options() : scenario(INITIAL_SCENARIO), particles(0), steps(1000), threads(0), every(100), deterministic(false), seed(0),
+                extraction(SURFACE_MARCHING_CUBES), checkpointEvery(0), trajectoryEvery(10), trajectoryAttributes(TRAJ_ALL), trajectoryDepth(TRAJECTORY_QUEUE_DEPTH),
+                trajectoryError(0.0f), trajectoryKeyframes(POSITION_KEY_INTERVAL), trajectoryReport(false),
+                surfaceReport(false) {}
+
+    int scenario;
+    int particles;
+    long steps;
+    int threads;
+    long every;
+    bool deterministic;
+    // 0 seeds the rain from the clock, unless deterministic
+    unsigned int seed;
+    string output;
+    string surface;
+    int extraction;
+    string vtu;
+    string ply;
+    string trace;
+    string checkpoint;
+    // 0 writes the checkpoint at the end only
+    long checkpointEvery;
+    string restart;
+    string trajectory;
+    long trajectoryEvery;
+    int trajectoryAttributes;
+    int trajectoryDepth;
+    // largest position error relative to h, 0 stores them exactly
+    float trajectoryError;
+    int trajectoryKeyframes;
+    bool trajectoryReport;
+    bool surfaceReport;
+};
+
+static void usage(const char* program)
+{
+    cerr << "usage: " << program << " [options]" << endl
+         << "  --scenario NAME   dam, faucet, cube, rain or fatcube (default cube)" << endl
+         << "  --particles N     scale the scene to about N particles, k and M suffixes (default: classic scene)" << endl
+         << "  --steps N         steps to simulate (default 1000)" << endl
+         << "  --threads N       OpenMP threads (default: OpenMP's choice)" << endl
+         << "  --output FILE     write the particles to FILE as text" << endl
+         << "  --every N         steps between written frames (default 100)" << endl
+         << "  --deterministic   identical results whatever the number of threads, the rain seeded with "
+         << DETERMINISTIC_SEED << " unless --seed is given" << endl
+         << "  --seed N          seed of the rain (default: the clock)" << endl
+         << "  --surface FILE    compute the surface and write the last one to FILE as OBJ" << endl
+         << "  --extraction NAME cubes for marching cubes or nets for surface nets (default cubes)" << endl
+         << "  --surface-report  print every surface, with the fraction of its blocks computed again" << endl
+         << "  --vtu FILE        write the last particles to FILE as binary VTK unstructured grid" << endl
+         << "  --ply FILE        write the last particles to FILE as binary PLY" << endl
+         << "  --trace FILE      record the solver phases and write them to FILE as Chrome trace JSON" << endl
+         << "  --checkpoint FILE write a binary checkpoint to FILE at the end" << endl
+         << "  --checkpoint-every N  and every N steps (default: at the end only)" << endl
+         << "  --restart FILE    resume from a checkpoint instead of loading the scenario, then run --steps more" << endl
+         << "  --trajectory FILE write compressed frames to FILE from a background thread" << endl
+         << "  --trajectory-every N  steps between trajectory frames (default 10)" << endl
+         << "  --trajectory-attributes LIST  comma separated position, velocity, density, flags (default all)" << endl
+         << "  --trajectory-depth N  frames queued for the writer before the solver waits (default 1)" << endl
+         << "  --trajectory-error E  store positions within E * h, smaller files (default 0: exact)" << endl
+         << "  --trajectory-keyframes N  frames from one lossy keyframe to the next, the most a seek decodes (default 32)" << endl
+         << "  --trajectory-report   print size and encoding time of every trajectory frame" << endl;
+}
+
+static int scenarioByName(const char* name)
+{
+    const char* names[] = { "dam", "faucet", "cube", "rain", "fatcube" };
+    const int scenarios[] = { SCENARIO_DAM, SCENARIO_FAUCET, SCENARIO_CUBE, SCENARIO_RAIN, SCENARIO_FATCUBE };
+    for (int x = 0; x < 5; x++)
+        if (strcmp(name, names[x]) == 0)
+            return scenarios[x];
+    return -1;
+}
+
+// attribute mask of a list like "position,density", -1 if it is not one
+static int parseAttributes(const string& list)
+{
+    const char* names[] = { "position", "velocity", "density", "flags" };
+    const int attributes[] = { TRAJ_POSITION, TRAJ_VELOCITY, TRAJ_DENSITY, TRAJ_FLAGS };
+    int mask = 0;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == string::npos)
+            end = list.size();
+        int x = 0;
+        while (x < 4 && list.compare(start, end - start, names[x]) != 0)
+            x++;
+        if (x == 4)
+            return -1;
+        mask |= attributes[x];
+        start = end + 1;
+    }
+    return mask;
+}
+
+// a particle count, "100k" and "1M" allowed. -1 if it is not one
+static int parseCount(const char* value)
+{
+    char* end;
+    double count = strtod(value, &end);
+    if (*end == 'k' || *end == 'K') {
+        count *= 1e3;
+        end++;
+    }
+    else if (*end == 'm' || *end == 'M') {
+        count *= 1e6;
+        end++;
+    }
+    if (end == value || *end != '\0' || count < 0 || count > 2e9)
+        return -1;
+    return (int)count;
+}
+
+static bool parseOptions(int argc, char** argv, options& opts)
+{
+    for (int x = 1; x < argc; x++) {
+        string arg = argv[x];
+        if (arg == "--help" || arg == "-h")
+            return false;
+        if (arg == "--deterministic") {
+            opts.deterministic = true;
+            continue;
+        }
+        if (arg == "--trajectory-report") {
+            opts.trajectoryReport = true;
+            continue;
+        }
+        if (arg == "--surface-report") {
+            opts.surfaceReport = true;
+            continue;
+        }
+        if (arg != "--scenario" && arg != "--particles" && arg != "--steps" && arg != "--threads" &&
+            arg != "--every" && arg != "--seed" && arg != "--output" && arg != "--surface" && arg != "--extraction" &&
+            arg != "--trace" && arg != "--vtu" && arg != "--ply" &&
+            arg != "--checkpoint" && arg != "--checkpoint-every" && arg != "--restart" && arg != "--trajectory" &&
+            arg != "--trajectory-every" && arg != "--trajectory-attributes" && arg != "--trajectory-depth" &&
+            arg != "--trajectory-error" && arg != "--trajectory-keyframes") {
+            cerr << "unknown option " << arg << endl;
+            return false;
+        }
+        if (x + 1 >= argc) {
+            cerr << "missing value for " << arg << endl;
+            return false;
+        }
+        const char* value = argv[++x];
+        if (arg == "--scenario") {
+            opts.scenario = scenarioByName(value);
+            if (opts.scenario < 0) {
+                cerr << "unknown scenario " << value << endl;
+                return false;
+            }
+        }
+        else if (arg == "--particles") {
+            opts.particles = parseCount(value);
+            if (opts.particles < 0) {
+                cerr << "bad particle count " << value << endl;
+                return false;
+            }
+        }
+        else if (arg == "--steps")
+            opts.steps = atol(value);
+        else if (arg == "--threads")
+            opts.threads = atoi(value);
+        else if (arg == "--every")
+            opts.every = atol(value);
+        else if (arg == "--seed")
+            opts.seed = (unsigned int)strtoul(value, NULL, 10);
+        else if (arg == "--output")
+            opts.output = value;
+        else if (arg == "--surface")
+            opts.surface = value;
+        else if (arg == "--extraction") {
+            if (string(value) == "cubes")
+                opts.extraction = SURFACE_MARCHING_CUBES;
+            else if (string(value) == "nets")
+                opts.extraction = SURFACE_NETS;
+            else {
+                cerr << "unknown extraction " << value << endl;
+                return false;
+            }
+        }
+        else if (arg == "--vtu")
+            opts.vtu = value;
+        else if (arg == "--ply")
+            opts.ply = value;
+        else if (arg == "--checkpoint")
+            opts.checkpoint = value;
+        else if (arg == "--checkpoint-every")
+            opts.checkpointEvery = atol(value);
+        else if (arg == "--restart")
+            opts.restart = value;
+        else if (arg == "--trajectory")
+            opts.trajectory = value;
+        else if (arg == "--trajectory-every")
+            opts.trajectoryEvery = atol(value);
+        else if (arg == "--trajectory-attributes") {
+            opts.trajectoryAttributes = parseAttributes(value);
+            if (opts.trajectoryAttributes < 0) {
+                cerr << "bad attributes " << value << endl;
+                return false;
+            }
+        }
+        else if (arg == "--trajectory-depth")
+            opts.trajectoryDepth = atoi(value);
+        else if (arg == "--trajectory-error")
+            opts.trajectoryError = atof(value);
+        else if (arg == "--trajectory-keyframes")
+            opts.trajectoryKeyframes = atoi(value);
+        else
+            opts.trace = value;
+    }
+    if (opts.steps < 0 || opts.every <= 0 || opts.threads < 0 || opts.checkpointEvery < 0 ||
+        opts.trajectoryEvery <= 0 || opts.trajectoryDepth < 0 || opts.trajectoryError < 0.0f ||
+        opts.trajectoryKeyframes <= 0) {
+        cerr << "--steps, --every, --threads, --checkpoint-every and the trajectory options must be positive" << endl;
+        return false;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// one frame: a "step particles" line, then "id x y z vx vy vz density" per particle
+///////////////////////////////////////////////////////////////////////////////
+static bool writeFrame(FILE* file, particlesystem& system, long step)
+{
+    FIELD_3D<>& grid = *system.grid;
+    fprintf(file, "step %ld %u\n", step, particle::count);
+    for (int gridCellIndex = 0; gridCellIndex < grid.cellCount(); gridCellIndex++)
+        for (particle& p : grid.data()[gridCellIndex])
+            fprintf(file, "%d %g %g %g %g %g %g %g\n", p.id(),
+                    p.position().x, p.position().y, p.position().z,
+                    p.velocity().x, p.velocity().y, p.velocity().z, p.density());
+    return !ferror(file);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The surfaces fetched from the pipeline, and how much of each was computed
+// again
+///////////////////////////////////////////////////////////////////////////////
+struct surfacestats {
+    surfacestats() : count(0), fractionSum(0.0), fractionMax(0.0) {}
+
+    void add(const surfaceframe& frame, bool report)
+    {
+        count++;
+        fractionSum += frame.updateFraction;
+        fractionMax = std::max(fractionMax, (double)frame.updateFraction);
+        if (report)
+            cout << "  surface of step " << frame.step << ": " << frame.mesh.triangleCount() << " triangles, "
+                 << 100.0 * frame.updateFraction << "% of the blocks computed again" << endl;
+    }
+
+    long count;
+    double fractionSum;
+    double fractionMax;
+};
+
+static bool writeObj(const char* filename, const surfacemesh& mesh)
+{
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        printf("Couldn't open file %s!\n", filename);
+        return false;
+    }
+    for (const VEC3F& v : mesh.vertices)
+        fprintf(file, "v %g %g %g\n", v.x, v.y, v.z);
+    for (const VEC3F& n : mesh.normals)
+        fprintf(file, "vn %g %g %g\n", n.x, n.y, n.z);
+    for (size_t x = 0; x < mesh.indices.size(); x += 3)
+        fprintf(file, "f %u//%u %u//%u %u//%u\n", mesh.indices[x] + 1, mesh.indices[x] + 1,
+                mesh.indices[x + 1] + 1, mesh.indices[x + 1] + 1, mesh.indices[x + 2] + 1, mesh.indices[x + 2] + 1);
+    bool success = !ferror(file);
+    fclose(file);
+    return success;
+}
+
+int main(int argc, char** argv)
+{
+    options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opts.threads > 0)
+        omp_set_num_threads(opts.threads);
+
+    particlesystem system;
+    system.scenario(opts.scenario);
+    system.deterministic(opts.deterministic);
+    system.seed(opts.seed);
+    if (opts.restart.empty())
+        system.loadScenario(opts.scenario, opts.particles);
+    else {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!system.loadCheckpoint(opts.restart.c_str()))
+            return 1;
+        if (opts.deterministic)
+            system.deterministic(true);
+        cout << "restarted from " << opts.restart << " at step " << system.stepCount() << " with "
+             << particle::count << " particles in "
+             << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << endl;
+    }
+    system.surfaceExtraction(opts.extraction);
+    if (!opts.surface.empty())
+        system.toogleMarchingCube();
+    if (!opts.trace.empty()) {
+        traceThreadName("solver");
+        traceEnable(true);
+    }
+
+    FILE* output = NULL;
+    if (!opts.output.empty()) {
+        output = fopen(opts.output.c_str(), "w");
+        if (output == NULL) {
+            printf("Couldn't open file %s!\n", opts.output.c_str());
+            return 1;
+        }
+    }
+
+    trajectorywriter trajectory;
+    trajectory.keyInterval(opts.trajectoryKeyframes);
+    if (!opts.trajectory.empty() &&
+        !trajectory.open(opts.trajectory.c_str(), opts.trajectoryAttributes, opts.trajectoryDepth,
+                         defaultTrajectoryCodec(), 2.0f * opts.trajectoryError * h, system.box()))
+        return 1;
+
+    // steps are counted from the scenario load, also after a restart
+    double simulated = 0.0;
+    surfacestats surfaces;
+    for (long step = 0; step < opts.steps; step++) {
+        if (output && system.stepCount() % opts.every == 0 && !writeFrame(output, system, system.stepCount())) {
+            cerr << "writing " << opts.output << " failed" << endl;
+            return 1;
+        }
+        if (trajectory.isOpen() && system.stepCount() % opts.trajectoryEvery == 0 &&
+            !trajectory.submit(*system.grid, system.stepCount())) {
+            cerr << "writing " << opts.trajectory << " failed" << endl;
+            return 1;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        system.stepVerlet();
+        simulated += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!opts.surface.empty() && system.fetchSurface())
+            surfaces.add(system.surfaceFrame, opts.surfaceReport);
+        if (!opts.checkpoint.empty() && opts.checkpointEvery > 0 && system.stepCount() % opts.checkpointEvery == 0 &&
+            step + 1 < opts.steps && !system.saveCheckpoint(opts.checkpoint.c_str()))
+            return 1;
+    }
+    if (!opts.checkpoint.empty()) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!system.saveCheckpoint(opts.checkpoint.c_str()))
+            return 1;
+        cout << "checkpoint of step " << system.stepCount() << " written to " << opts.checkpoint << " in "
+             << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << endl;
+    }
+    if (trajectory.isOpen()) {
+        if (system.stepCount() % opts.trajectoryEvery == 0)
+            trajectory.submit(*system.grid, system.stepCount());
+        if (!trajectory.close())
+            return 1;
+        cout << trajectory.frames() << " trajectory frames, " << trajectory.rawBytes() / 1048576.0 << " MB written in "
+             << trajectory.storedBytes() / 1048576.0 << " MB, the solver waited " << trajectory.stalls() << " times for "
+             << trajectory.stallSeconds() << " s" << endl;
+        const vector<trajectoryframestats>& frames = trajectory.frameStats();
+        double slowest = 0.0;
+        for (const trajectoryframestats& frame : frames) {
+            double throughput = frame.rawBytes / 1048576.0 / std::max(frame.encodeSeconds, 1e-9);
+            if (&frame == &frames[0] || throughput < slowest)
+                slowest = throughput;
+            if (opts.trajectoryReport)
+                cout << "  frame of step " << frame.step << (frame.key ? " (key)" : "") << ": " << frame.particles
+                     << " particles, " << frame.storedBytes << " bytes, ratio " << (double)frame.rawBytes / frame.storedBytes
+                     << ", encoded in " << 1000.0 * frame.encodeSeconds << " ms" << endl;
+        }
+        if (trajectory.frames() > 0)
+            cout << "trajectory compression ratio " << (double)trajectory.rawBytes() / trajectory.storedBytes() << ", encoded at "
+                 << trajectory.rawBytes() / 1048576.0 / std::max(trajectory.encodeSeconds(), 1e-9) << " MB/s, slowest frame "
+                 << slowest << " MB/s" << endl;
+    }
+    if (output) {
+        bool success = writeFrame(output, system, system.stepCount());
+        success = fclose(output) == 0 && success;
+        if (!success) {
+            cerr << "writing " << opts.output << " failed" << endl;
+            return 1;
+        }
+    }
+
+    if (!opts.surface.empty()) {
+        long last = system.surfaceFrame.step;
+        system.flushSurface();
+        if (system.surfaceFrame.step != last)
+            surfaces.add(system.surfaceFrame, opts.surfaceReport);
+        if (surfaces.count > 0)
+            cout << surfaces.count << " surfaces, " << 100.0 * surfaces.fractionSum / surfaces.count
+                 << "% of their blocks computed again on average, at most " << 100.0 * surfaces.fractionMax << "%" << endl;
+        const surfacemesh& mesh = system.surfaceFrame.mesh;
+        if (!writeObj(opts.surface.c_str(), mesh))
+            return 1;
+        cout << "surface of step " << system.surfaceFrame.step << " written to " << opts.surface << ": "
+             << mesh.triangleCount() << " triangles, " << mesh.vertexCount() << " vertices, "
+             << mesh.memory() / 1024.0 << " KB" << endl;
+    }
+    particleexporter exporter;
+    if (!opts.vtu.empty()) {
+        if (!exporter.writeVtu(opts.vtu.c_str(), *system.grid, TRAJ_ALL, system.stepCount()))
+            return 1;
+        cout << "particles written to " << opts.vtu << " in " << exporter.seconds() << " s, "
+             << exporter.bytes() / 1048576.0 / exporter.seconds() << " MB/s" << endl;
+    }
+    if (!opts.ply.empty()) {
+        if (!exporter.writePly(opts.ply.c_str(), *system.grid, TRAJ_ALL, system.stepCount()))
+            return 1;
+        cout << "particles written to " << opts.ply << " in " << exporter.seconds() << " s, "
+             << exporter.bytes() / 1048576.0 / exporter.seconds() << " MB/s" << endl;
+    }
+    if (!opts.trace.empty()) {
+        system.flushSurface();
+        traceEnable(false);
+        if (!traceWrite(opts.trace.c_str()))
+            return 1;
+    }
+
+    cout << opts.steps << " steps of " << particle::count << " particles on " << omp_get_max_threads()
+         << " threads in " << simulated << " s, " << 1000.0 * simulated / std::max(opts.steps, 1L) << " ms per step" << endl;
+    return 0;
+}
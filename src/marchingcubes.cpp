@@ -0,0 +1,198 @@
+#include "../include/marchingcubes.h"
+#include <algorithm>
+
+#define MAX_CASE_INDICES 36 // upper bound of triangle corners a cube can produce
+
+// cube corners, x varies fastest around the bottom face then the top face
+static const int cornerOffset[8][3] = {
+  {0,0,0}, {1,0,0}, {1,1,0}, {0,1,0}, {0,0,1}, {1,0,1}, {1,1,1}, {0,1,1}
+};
+
+// the two corners of each cube edge
+static const int edgeCorners[12][2] = {
+  {0,1}, {1,2}, {2,3}, {3,0}, {4,5}, {5,6}, {6,7}, {7,4}, {0,4}, {1,5}, {2,6}, {3,7}
+};
+
+// cube faces, corners counter clockwise seen from outside the cube
+static const int faceCorners[6][4] = {
+  {0,3,2,1}, {4,5,6,7}, {0,1,5,4}, {3,7,6,2}, {0,4,7,3}, {1,2,6,5}
+};
+
+// lower corner offset and axis of each cube edge
+static int edgeOrigin[12][4];
+
+// triangle corners, as cube edges, for each of the 256 inside/outside configurations
+static int caseIndices[256][MAX_CASE_INDICES];
+static int caseIndexCount[256];
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the triangle tables rather than transcribing them.
+// On every face, each crossing where the corners go from outside to inside
+// is joined to the next crossing going back outside, walking the face
+// counter clockwise. This isolates the inside corners of ambiguous faces,
+// and since the choice only depends on the face it matches between the two
+// cubes sharing it, which keeps the surface closed. The segments of all the
+// faces chain into loops that are triangulated as fans.
+///////////////////////////////////////////////////////////////////////////////
+static void buildTables()
+{
+  int edgeOf[8][8];
+  for (int e = 0; e < 12; e++) {
+    int a = edgeCorners[e][0], b = edgeCorners[e][1];
+    edgeOf[a][b] = edgeOf[b][a] = e;
+    int lower = cornerOffset[a][0] + cornerOffset[a][1] + cornerOffset[a][2] <
+                cornerOffset[b][0] + cornerOffset[b][1] + cornerOffset[b][2] ? a : b;
+    int upper = lower == a ? b : a;
+    for (int i = 0; i < 3; i++) {
+      edgeOrigin[e][i] = cornerOffset[lower][i];
+      if (cornerOffset[upper][i] != cornerOffset[lower][i])
+        edgeOrigin[e][3] = i;
+    }
+  }
+
+  for (int cubeCase = 0; cubeCase < 256; cubeCase++) {
+    // segment leaving each edge, -1 if none
+    int next[12];
+    for (int e = 0; e < 12; e++)
+      next[e] = -1;
+
+    for (int f = 0; f < 6; f++) {
+      int crossing[4], count = 0;
+      bool outToIn[4];
+      for (int i = 0; i < 4; i++) {
+        int a = faceCorners[f][i], b = faceCorners[f][(i + 1) % 4];
+        bool insideA = (cubeCase >> a) & 1, insideB = (cubeCase >> b) & 1;
+        if (insideA != insideB) {
+          crossing[count] = edgeOf[a][b];
+          outToIn[count++] = insideB;
+        }
+      }
+      for (int i = 0; i < count; i++)
+        if (outToIn[i])
+          next[crossing[i]] = crossing[(i + 1) % count];
+    }
+
+    caseIndexCount[cubeCase] = 0;
+    bool used[12] = { false };
+    for (int start = 0; start < 12; start++) {
+      if (next[start] < 0 || used[start])
+        continue;
+      int loop[12], length = 0;
+      for (int e = start; !used[e]; e = next[e]) {
+        used[e] = true;
+        loop[length++] = e;
+      }
+      for (int i = 1; i + 1 < length; i++) {
+        int* indices = caseIndices[cubeCase] + caseIndexCount[cubeCase];
+        indices[0] = loop[0];
+        indices[1] = loop[i];
+        indices[2] = loop[i + 1];
+        caseIndexCount[cubeCase] += 3;
+      }
+    }
+  }
+
+  // orient the triangles so that they face away from the inside corner
+  // in the single corner case, the rule above gives one orientation for all
+  int* t = caseIndices[1];
+  VEC3F p[3];
+  for (int i = 0; i < 3; i++) {
+    const int* a = cornerOffset[edgeCorners[t[i]][0]];
+    const int* b = cornerOffset[edgeCorners[t[i]][1]];
+    p[i] = VEC3F(a[0] + b[0], a[1] + b[1], a[2] + b[2]) * 0.5f;
+  }
+  VEC3F normal = (p[1] - p[0]) ^ (p[2] - p[0]);
+  if (normal.dot(VEC3F(1,1,1)) < 0)
+    for (int cubeCase = 0; cubeCase < 256; cubeCase++)
+      for (int i = 0; i < caseIndexCount[cubeCase]; i += 3)
+        std::swap(caseIndices[cubeCase][i + 1], caseIndices[cubeCase][i + 2]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////////////
+marchingcubes::marchingcubes()
+{
+  static bool tablesBuilt = (buildTables(), true);
+  (void)tablesBuilt;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A vertex on every crossed edge whose lower end is in the block
+///////////////////////////////////////////////////////////////////////////////
+void marchingcubes::createVertices(SCALAR_FIELD_3D& field, float isoValue, block& blk)
+{
+  int upper[3];
+  int res[3] = { field.xRes(), field.yRes(), field.zRes() };
+  for (int i = 0; i < 3; i++)
+    upper[i] = std::min(blk.upper[i], res[i]);
+
+  const float* data = &blk.samples[0];
+  const int stride[3] = { 1, BLOCK_APRON_RES, BLOCK_APRON_RES * BLOCK_APRON_RES };
+  for (int z = blk.lower[2]; z < upper[2]; z++)
+    for (int y = blk.lower[1]; y < upper[1]; y++) {
+      int index = apronIndex(blk, blk.lower[0], y, z);
+      for (int x = blk.lower[0]; x < upper[0]; x++, index++) {
+        const float value = data[index];
+        const bool inside = value >= isoValue;
+        const int sample[3] = { x, y, z };
+        for (int axis = 0; axis < 3; axis++) {
+          if (sample[axis] + 1 >= res[axis])
+            continue;
+          const float neighborValue = data[index + stride[axis]];
+          if ((neighborValue >= isoValue) == inside)
+            continue;
+
+          useSlots(blk, 3 * FIELD_BLOCK_SAMPLES);
+          blk.slotVertex[axis + 3 * field.localIndex(x, y, z)] = (int)blk.vertices.size();
+
+          int n[3] = { x, y, z };
+          n[axis]++;
+          float t = (isoValue - value) / (neighborValue - value);
+          VEC3F p0 = field.position(x,y,z);
+          VEC3F p1 = field.position(n[0], n[1], n[2]);
+          blk.vertices.push_back(p0 + (p1 - p0) * t);
+          VEC3F g0 = gradient(field, blk, x, y, z);
+          VEC3F g1 = gradient(field, blk, n[0], n[1], n[2]);
+          // the field decreases outwards
+          VEC3F normal = (g0 + (g1 - g0) * t) * -1.f;
+          blk.normals.push_back(normal.normal());
+        }
+      }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Triangles of the cubes whose lower corner is in the block
+///////////////////////////////////////////////////////////////////////////////
+void marchingcubes::createTriangles(SCALAR_FIELD_3D& field, float isoValue, block& blk)
+{
+  int upper[3];
+  int res[3] = { field.xRes(), field.yRes(), field.zRes() };
+  for (int i = 0; i < 3; i++)
+    upper[i] = std::min(blk.upper[i], res[i] - 1);
+
+  const float* data = &blk.samples[0];
+  const int strideY = BLOCK_APRON_RES, strideZ = BLOCK_APRON_RES * BLOCK_APRON_RES;
+  int cornerIndex[8];
+  for (int c = 0; c < 8; c++)
+    cornerIndex[c] = cornerOffset[c][0] + cornerOffset[c][1] * strideY + cornerOffset[c][2] * strideZ;
+
+  for (int z = blk.lower[2]; z < upper[2]; z++)
+    for (int y = blk.lower[1]; y < upper[1]; y++) {
+      int index = apronIndex(blk, blk.lower[0], y, z);
+      for (int x = blk.lower[0]; x < upper[0]; x++, index++) {
+        int cubeCase = 0;
+        for (int c = 0; c < 8; c++)
+          cubeCase |= (data[index + cornerIndex[c]] >= isoValue) << c;
+        if (caseIndexCount[cubeCase] == 0)
+          continue;
+
+        for (int i = 0; i < caseIndexCount[cubeCase]; i++) {
+          const int* edge = edgeOrigin[caseIndices[cubeCase][i]];
+          int sx = x + edge[0], sy = y + edge[1], sz = z + edge[2];
+          blk.indices.push_back(vertexReference(blk, sx, sy, sz, edge[3] + 3 * field.localIndex(sx, sy, sz)));
+        }
+      }
+    }
+}
@@ -0,0 +1,268 @@
+// <chrono> before the solver headers, which define h
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include "../include/particleexport.h"
+#include "../include/trace.h"
+
+// the arrays are written as they are in memory
+static_assert(sizeof(VEC3F) == 3 * sizeof(float), "VEC3F arrays are written as packed floats");
+
+#define EXPORT_BLOCK 4096 // particles a thread encodes at once
+
+static bool littleEndian()
+{
+    const unsigned int one = 1;
+    return *(const unsigned char*)&one == 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////////////
+particleexporter::particleexporter() :
+    _bytes(0), _seconds(0.0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Encode the particles a chunk at a time, every thread a block of it, and
+// write each chunk before encoding the next, so the buffer stays small
+///////////////////////////////////////////////////////////////////////////////
+bool particleexporter::writeChunks(FILE* file, const trajectoryframe& frame, int recordBytes,
+                                   void (*encode)(const trajectoryframe& frame, int first, int last, unsigned char* out))
+{
+    const int count = frame.particleCount();
+    _chunk.resize((size_t)std::min(count, EXPORT_CHUNK) * recordBytes);
+    for (int first = 0; first < count; first += EXPORT_CHUNK)
+    {
+        const int last = std::min(count, first + EXPORT_CHUNK);
+        {
+            TRACE_SCOPE("exportEncode");
+#pragma omp parallel for schedule(static)
+            for (int block = first; block < last; block += EXPORT_BLOCK)
+                encode(frame, block, std::min(last, block + EXPORT_BLOCK), &_chunk[(size_t)(block - first) * recordBytes]);
+        }
+        TRACE_SCOPE("exportWrite");
+        const size_t bytes = (size_t)(last - first) * recordBytes;
+        if (fwrite(_chunk.data(), 1, bytes, file) != bytes)
+            return false;
+        _bytes += bytes;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// VTU
+///////////////////////////////////////////////////////////////////////////////
+// the vertex cells, one per particle
+static void encodeConnectivity(const trajectoryframe&, int first, int last, unsigned char* out)
+{
+    int* connectivity = (int*)out;
+    for (int i = first; i < last; i++)
+        *connectivity++ = i;
+}
+
+static void encodeOffsets(const trajectoryframe&, int first, int last, unsigned char* out)
+{
+    int* offsets = (int*)out;
+    for (int i = first; i < last; i++)
+        *offsets++ = i + 1;
+}
+
+static void encodeTypes(const trajectoryframe&, int first, int last, unsigned char* out)
+{
+    const unsigned char vertex = 1; // VTK_VERTEX
+    memset(out, vertex, last - first);
+}
+
+struct vtuarray {
+    const char* section;
+    const char* name;
+    const char* type;
+    int components;
+    // the array in memory, or NULL for one encoded by encode
+    const void* data;
+    void (*encode)(const trajectoryframe& frame, int first, int last, unsigned char* out);
+    int width;
+};
+
+bool particleexporter::writeVtu(const char* filename, const trajectoryframe& frame)
+{
+    TRACE_SCOPE("exportVtu");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _bytes = 0;
+    if (!(frame.attributes & TRAJ_POSITION) || frame.positions.size() != frame.ids.size()) {
+        printf("Couldn't write %s, the particles have no positions!\n", filename);
+        return false;
+    }
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        printf("Couldn't open file %s!\n", filename);
+        return false;
+    }
+
+    const unsigned long long count = frame.ids.size();
+    vector<vtuarray> arrays;
+    arrays.push_back({ "Points", "position", "Float32", 3, frame.positions.data(), NULL, 12 });
+    if (frame.attributes & TRAJ_VELOCITY)
+        arrays.push_back({ "PointData", "velocity", "Float32", 3, frame.velocities.data(), NULL, 12 });
+    if (frame.attributes & TRAJ_DENSITY)
+        arrays.push_back({ "PointData", "density", "Float32", 1, frame.densities.data(), NULL, 4 });
+    arrays.push_back({ "PointData", "id", "Int32", 1, frame.ids.data(), NULL, 4 });
+    if (frame.attributes & TRAJ_FLAGS)
+        arrays.push_back({ "PointData", "flags", "UInt8", 1, frame.flags.data(), NULL, 1 });
+    arrays.push_back({ "Cells", "connectivity", "Int32", 1, NULL, encodeConnectivity, 4 });
+    arrays.push_back({ "Cells", "offsets", "Int32", 1, NULL, encodeOffsets, 4 });
+    arrays.push_back({ "Cells", "types", "UInt8", 1, NULL, encodeTypes, 1 });
+
+    // every array of the appended data is its byte count, then its bytes
+    string header;
+    header += "<?xml version=\"1.0\"?>\n";
+    header += string("<VTKFile type=\"UnstructuredGrid\" version=\"1.0\" byte_order=\"") +
+              (littleEndian() ? "LittleEndian" : "BigEndian") + "\" header_type=\"UInt64\">\n";
+    header += "  <UnstructuredGrid>\n";
+    header += "    <FieldData>\n";
+    header += "      <DataArray type=\"Int64\" Name=\"step\" NumberOfTuples=\"1\" format=\"ascii\">" +
+              to_string(frame.step) + "</DataArray>\n";
+    header += "    </FieldData>\n";
+    header += "    <Piece NumberOfPoints=\"" + to_string(count) + "\" NumberOfCells=\"" + to_string(count) + "\">\n";
+    unsigned long long offset = 0;
+    const char* section = NULL;
+    for (const vtuarray& array : arrays)
+    {
+        if (section == NULL || strcmp(section, array.section) != 0)
+        {
+            if (section)
+                header += string("      </") + section + ">\n";
+            section = array.section;
+            header += string("      <") + section + ">\n";
+        }
+        header += string("        <DataArray type=\"") + array.type + "\" Name=\"" + array.name + "\"";
+        if (array.components > 1)
+            header += " NumberOfComponents=\"" + to_string(array.components) + "\"";
+        header += " format=\"appended\" offset=\"" + to_string(offset) + "\"/>\n";
+        offset += sizeof(unsigned long long) + count * array.width;
+    }
+    header += string("      </") + section + ">\n";
+    header += "    </Piece>\n";
+    header += "  </UnstructuredGrid>\n";
+    header += "  <AppendedData encoding=\"raw\">\n   _";
+
+    bool success = fwrite(header.data(), 1, header.size(), file) == header.size();
+    _bytes += header.size();
+    for (size_t a = 0; a < arrays.size() && success; a++)
+    {
+        const unsigned long long bytes = count * arrays[a].width;
+        success = fwrite(&bytes, sizeof(bytes), 1, file) == 1;
+        _bytes += sizeof(bytes);
+        if (success && arrays[a].data)
+        {
+            TRACE_SCOPE("exportWrite");
+            success = fwrite(arrays[a].data, 1, bytes, file) == bytes;
+            _bytes += bytes;
+        }
+        else if (success)
+            success = writeChunks(file, frame, arrays[a].width, arrays[a].encode);
+    }
+    const char* footer = "\n  </AppendedData>\n</VTKFile>\n";
+    success = success && fputs(footer, file) >= 0;
+    _bytes += strlen(footer);
+    success = fclose(file) == 0 && success;
+    if (!success)
+        printf("Couldn't write %s!\n", filename);
+    _seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PLY
+///////////////////////////////////////////////////////////////////////////////
+static int plyRecordBytes(int attributes)
+{
+    return 12 + (attributes & TRAJ_VELOCITY ? 12 : 0) + (attributes & TRAJ_DENSITY ? 4 : 0) + 4 +
+           (attributes & TRAJ_FLAGS ? 1 : 0);
+}
+
+static void encodePly(const trajectoryframe& frame, int first, int last, unsigned char* out)
+{
+    const int attributes = frame.attributes;
+    for (int i = first; i < last; i++)
+    {
+        memcpy(out, &frame.positions[i], 12);
+        out += 12;
+        if (attributes & TRAJ_VELOCITY) {
+            memcpy(out, &frame.velocities[i], 12);
+            out += 12;
+        }
+        if (attributes & TRAJ_DENSITY) {
+            memcpy(out, &frame.densities[i], 4);
+            out += 4;
+        }
+        memcpy(out, &frame.ids[i], 4);
+        out += 4;
+        if (attributes & TRAJ_FLAGS)
+            *out++ = frame.flags[i];
+    }
+}
+
+bool particleexporter::writePly(const char* filename, const trajectoryframe& frame)
+{
+    TRACE_SCOPE("exportPly");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _bytes = 0;
+    if (!(frame.attributes & TRAJ_POSITION) || frame.positions.size() != frame.ids.size()) {
+        printf("Couldn't write %s, the particles have no positions!\n", filename);
+        return false;
+    }
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        printf("Couldn't open file %s!\n", filename);
+        return false;
+    }
+
+    string header;
+    header += "ply\n";
+    header += string("format ") + (littleEndian() ? "binary_little_endian" : "binary_big_endian") + " 1.0\n";
+    header += "comment SPH particles of step " + to_string(frame.step) + "\n";
+    header += "element vertex " + to_string(frame.particleCount()) + "\n";
+    header += "property float x\nproperty float y\nproperty float z\n";
+    if (frame.attributes & TRAJ_VELOCITY)
+        header += "property float vx\nproperty float vy\nproperty float vz\n";
+    if (frame.attributes & TRAJ_DENSITY)
+        header += "property float density\n";
+    header += "property int id\n";
+    if (frame.attributes & TRAJ_FLAGS)
+        header += "property uchar flags\n";
+    header += "end_header\n";
+
+    bool success = fwrite(header.data(), 1, header.size(), file) == header.size();
+    _bytes += header.size();
+    success = success && writeChunks(file, frame, plyRecordBytes(frame.attributes), encodePly);
+    success = fclose(file) == 0 && success;
+    if (!success)
+        printf("Couldn't write %s!\n", filename);
+    _seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// From the solver's grid
+///////////////////////////////////////////////////////////////////////////////
+bool particleexporter::writeVtu(const char* filename, FIELD_3D<>& grid, int attributes, long step)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _frame.capture(grid, attributes | TRAJ_POSITION, step);
+    bool success = writeVtu(filename, _frame);
+    _seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return success;
+}
+
+bool particleexporter::writePly(const char* filename, FIELD_3D<>& grid, int attributes, long step)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _frame.capture(grid, attributes | TRAJ_POSITION, step);
+    bool success = writePly(filename, _frame);
+    _seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return success;
+}
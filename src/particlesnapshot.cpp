@@ -0,0 +1,90 @@
+#include "../include/particlesnapshot.h"
+#include "../include/trace.h"
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////////////
+particlesnapshot::particlesnapshot() :
+    cellSize(0)
+{
+    res[0] = res[1] = res[2] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Count the particles of every cell, then copy every cell to its range
+///////////////////////////////////////////////////////////////////////////////
+void particlesnapshot::capture(FIELD_3D<>& grid, const VEC3F& boxSize, float cellSize)
+{
+    TRACE_SCOPE("snapshot");
+    res[0] = grid.xRes(); res[1] = grid.yRes(); res[2] = grid.zRes();
+    this->boxSize = boxSize;
+    this->cellSize = cellSize;
+
+    const int cellCount = grid.cellCount();
+    cellStart.resize(cellCount + 1);
+    int total = 0;
+    for (int gridCellIndex = 0; gridCellIndex < cellCount; gridCellIndex++)
+    {
+        cellStart[gridCellIndex] = total;
+        total += grid.data()[gridCellIndex].size();
+    }
+    cellStart[cellCount] = total;
+
+    positions.resize(total);
+    densities.resize(total);
+    flags.resize(total);
+    ids.resize(total);
+#pragma omp parallel for
+    for (int gridCellIndex = 0; gridCellIndex < cellCount; gridCellIndex++)
+    {
+        int i = cellStart[gridCellIndex];
+        for (particle& p : grid.data()[gridCellIndex])
+        {
+            positions[i] = p.position();
+            densities[i] = p.density();
+            flags[i] = p.flag();
+            ids[i] = p.id();
+            i++;
+        }
+    }
+}
+
+void particlesnapshot::cell(const VEC3F& position, int& x, int& y, int& z) const
+{
+    x = (int)floor((position.x + boxSize.x/2.0)/cellSize);
+    y = (int)floor((position.y + boxSize.y/2.0)/cellSize);
+    z = (int)floor((position.z + boxSize.z/2.0)/cellSize);
+    x = x < 0 ? 0 : x >= res[0] ? res[0] - 1 : x;
+    y = y < 0 ? 0 : y >= res[1] ? res[1] - 1 : y;
+    z = z < 0 ? 0 : z >= res[2] ? res[2] - 1 : z;
+}
+
+void particlesnapshot::bounds(VEC3F& lower, VEC3F& upper) const
+{
+    float minX = std::numeric_limits<float>::max(), minY = minX, minZ = minX;
+    float maxX = -minX, maxY = -minX, maxZ = -minX;
+    const int count = particleCount();
+#pragma omp parallel for reduction(min:minX,minY,minZ) reduction(max:maxX,maxY,maxZ)
+    for (int i = 0; i < count; i++)
+    {
+        const VEC3F& p = positions[i];
+        minX = std::min(minX, p.x); maxX = std::max(maxX, p.x);
+        minY = std::min(minY, p.y); maxY = std::max(maxY, p.y);
+        minZ = std::min(minZ, p.z); maxZ = std::max(maxZ, p.z);
+    }
+    lower = VEC3F(minX, minY, minZ);
+    upper = VEC3F(maxX, maxY, maxZ);
+}
+
+float particlesnapshot::meanDensity() const
+{
+    double density = 0.0;
+    const int count = particleCount();
+#pragma omp parallel for reduction(+:density)
+    for (int i = 0; i < count; i++)
+        density += densities[i];
+    return count > 0 ? density / count : 0.f;
+}
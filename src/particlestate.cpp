@@ -0,0 +1,158 @@
+#include "../include/particlestate.h"
+#include "../include/particle.h"
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+struct stateheader {
+    unsigned int magic;
+    unsigned int version;
+    int scenario;
+    int particles;
+    long long step;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////////////
+particlestate::particlestate() :
+    scenario(-1), step(0)
+{
+}
+
+void particlestate::capture(FIELD_3D<>& grid, int scenario, long step)
+{
+    this->scenario = scenario;
+    this->step = step;
+    vector<particle*> sorted;
+    for (int gridCellIndex = 0; gridCellIndex < grid.cellCount(); gridCellIndex++)
+        for (particle& p : grid.data()[gridCellIndex])
+            sorted.push_back(&p);
+    sort(sorted.begin(), sorted.end(), [](particle* a, particle* b) { return a->id() < b->id(); });
+
+    const int count = (int)sorted.size();
+    ids.resize(count);
+    positions.resize(count);
+    velocities.resize(count);
+    densities.resize(count);
+    pressures.resize(count);
+    for (int i = 0; i < count; i++) {
+        ids[i] = sorted[i]->id();
+        positions[i] = sorted[i]->position();
+        velocities[i] = sorted[i]->velocity();
+        densities[i] = sorted[i]->density();
+        pressures[i] = sorted[i]->pressure();
+    }
+}
+
+bool particlestate::write(const char* filename) const
+{
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        printf("Couldn't open file %s!\n", filename);
+        return false;
+    }
+    stateheader header;
+    header.magic = STATE_MAGIC;
+    header.version = STATE_VERSION;
+    header.scenario = scenario;
+    header.particles = particleCount();
+    header.step = step;
+    const size_t count = ids.size();
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (count > 0) {
+        success = success && fwrite(ids.data(), sizeof(int), count, file) == count;
+        success = success && fwrite(positions.data(), sizeof(VEC3F), count, file) == count;
+        success = success && fwrite(velocities.data(), sizeof(VEC3F), count, file) == count;
+        success = success && fwrite(densities.data(), sizeof(float), count, file) == count;
+        success = success && fwrite(pressures.data(), sizeof(float), count, file) == count;
+    }
+    success = fclose(file) == 0 && success;
+    return success;
+}
+
+bool particlestate::read(const char* filename)
+{
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL)
+        return false;
+    stateheader header;
+    bool success = fread(&header, sizeof(header), 1, file) == 1 &&
+                   header.magic == STATE_MAGIC && header.version == STATE_VERSION && header.particles >= 0;
+    if (success) {
+        scenario = header.scenario;
+        step = (long)header.step;
+        const size_t count = header.particles;
+        ids.resize(count);
+        positions.resize(count);
+        velocities.resize(count);
+        densities.resize(count);
+        pressures.resize(count);
+        if (count > 0) {
+            success = fread(ids.data(), sizeof(int), count, file) == count;
+            success = success && fread(positions.data(), sizeof(VEC3F), count, file) == count;
+            success = success && fread(velocities.data(), sizeof(VEC3F), count, file) == count;
+            success = success && fread(densities.data(), sizeof(float), count, file) == count;
+            success = success && fread(pressures.data(), sizeof(float), count, file) == count;
+        }
+    }
+    fclose(file);
+    return success;
+}
+
+static inline double distance(const VEC3F& a, const VEC3F& b)
+{
+    VEC3F d = a - b;
+    return sqrt((double)d.dot(d));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Both states are sorted by id, so one merge pass matches them
+///////////////////////////////////////////////////////////////////////////////
+stateerror compareStates(const particlestate& golden, const particlestate& state)
+{
+    stateerror error;
+    double scale[4] = { h, 0.0, 0.0, 0.0 };
+    for (int i = 0; i < golden.particleCount(); i++) {
+        scale[STATE_VELOCITY] += golden.velocities[i].dot(golden.velocities[i]);
+        scale[STATE_DENSITY] += golden.densities[i] * golden.densities[i];
+        scale[STATE_PRESSURE] += golden.pressures[i] * golden.pressures[i];
+    }
+    for (int field = STATE_VELOCITY; field <= STATE_PRESSURE; field++) {
+        scale[field] = golden.particleCount() > 0 ? sqrt(scale[field] / golden.particleCount()) : 0.0;
+        if (scale[field] == 0.0)
+            scale[field] = 1.0;
+    }
+
+    double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+    int i = 0, j = 0;
+    while (i < golden.particleCount() || j < state.particleCount()) {
+        if (j == state.particleCount() || (i < golden.particleCount() && golden.ids[i] < state.ids[j])) {
+            error.missing++;
+            i++;
+            continue;
+        }
+        if (i == golden.particleCount() || state.ids[j] < golden.ids[i]) {
+            error.extra++;
+            j++;
+            continue;
+        }
+        double errors[4] = {
+            distance(state.positions[j], golden.positions[i]),
+            distance(state.velocities[j], golden.velocities[i]),
+            fabs((double)state.densities[j] - golden.densities[i]),
+            fabs((double)state.pressures[j] - golden.pressures[i])
+        };
+        for (int field = 0; field < 4; field++) {
+            double e = errors[field] / scale[field];
+            error.maxError[field] = max(error.maxError[field], e);
+            sum[field] += e * e;
+        }
+        error.particles++;
+        i++;
+        j++;
+    }
+    for (int field = 0; field < 4; field++)
+        error.rmsError[field] = error.particles > 0 ? sqrt(sum[field] / error.particles) : 0.0;
+    return error;
+}
@@ -1,8 +1,11 @@
 #include "../include/particlesystem.h"
+#include "../include/trace.h"
+#include "../include/threadload.h"
 #include <omp.h>
 #include <time.h>
 #include <random>
 #include <limits>
+#include <algorithm>
 unsigned int iteration = 0;
 int scenario;
 
@@ -10,32 +13,98 @@ int scenario;
 // Constructor
 ///////////////////////////////////////////////////////////////////////////////
 particlesystem::particlesystem() :
-    _isGridVisible(false),_marchingGrid(false), surfaceThreshold(20), gravityVector(0.0,GRAVITY_ACCELERATION,0.0), grid(NULL), nextGrid(NULL), boundary()
+    _isGridVisible(false),_marchingGrid(false),_marchingCube(false), surfaceThreshold(20), gravityVector(0.0,GRAVITY_ACCELERATION,0.0), grid(NULL), nextGrid(NULL), surfaceIsoLevel(SURFACE_ISO_LEVEL), boundary(), _surfacePipeline(NULL)
 {
     loadScenario(INITIAL_SCENARIO);
 
 }
 
-void particlesystem::loadScenario(int newScenario) {
+///////////////////////////////////////////////////////////////////////////////
+// Scalable scenes
+//
+// The box keeps the proportions of the classic one and h stays the same, so
+// a larger scene has more grid cells of the same size. The lattice scenes
+// fill a region that grows with the box, the emitting ones get a box that
+// holds their capacity as densely as the classic box holds the default one.
+///////////////////////////////////////////////////////////////////////////////
+static VEC3F scenarioBox(float scale)
+{
+    return VEC3F(BOX_SIZE * 2.0 * scale, BOX_SIZE * scale, BOX_SIZE / 2.0 * scale);
+}
+
+// region filled by the lattice scenes, false for the emitting ones
+static bool latticeRegion(int scenario, const VEC3F& boxSize, VEC3F& start, VEC3F& end)
+{
+    const float step = 0.5 * h;
+    if (scenario == SCENARIO_DAM) {
+        start = VEC3F(0.5 * (step - boxSize.x), 0.5 * (boxSize.y - step), 0.5 * (step - boxSize.z));
+        end = VEC3F(- 5 * step, -0.5 * (boxSize.y - step ), 0.5 * (boxSize.z - 0.5 * step));
+    }
+    else if (scenario == SCENARIO_CUBE) {
+        start = VEC3F(- boxSize.z, 0.5 * (step - boxSize.z) + 0.75 * boxSize.y, 0.5 * (step - boxSize.z));
+        end = VEC3F(boxSize.z, 0.5 * (boxSize.z - step) + 0.75 * boxSize.y, 0.5 * (boxSize.z - step));
+    }
+    else if (scenario == SCENARIO_FATCUBE) {
+        start = VEC3F(- 0.5 *boxSize.z, 0.75 * boxSize.y, - 0.5 * boxSize.z);
+        end = VEC3F(0.5 *boxSize.z, 1.25 *boxSize.y, 0.5 *boxSize.z);
+    }
+    else
+        return false;
+    return true;
+}
+
+// particles fillRegion() puts into the region
+static int latticeCount(const VEC3F& start, const VEC3F& end, float spacing)
+{
+    int total = 1;
+    for (int axis = 0; axis < 3; axis++)
+        total *= (int)ceil(fabs(end[axis] - start[axis]) / spacing);
+    return total;
+}
+
+static float scenarioScale(int scenario, int particles)
+{
+    if (particles <= 0)
+        return 1.f;
+    VEC3F start, end;
+    if (!latticeRegion(scenario, scenarioBox(1.f), start, end))
+        return cbrt((float)particles / DEFAULT_CAPACITY);
+    // the lattice is rounded to whole layers, a few rounds settle the scale
+    float scale = 1.f;
+    for (int round = 0; round < 8; round++) {
+        latticeRegion(scenario, scenarioBox(scale), start, end);
+        scale *= cbrt((float)particles / latticeCount(start, end, 0.5 * h));
+    }
+    return scale;
+}
+
+void particlesystem::loadScenario(int newScenario, int particles) {
     // remove all particles
     if (grid) delete grid;
     if (nextGrid) delete nextGrid;
+    // the surface of the old particles is not wanted any more
+    releaseSurfacePipeline();
     surfaceThreshold = 20.f;
     _walls.clear();
     // reset params
     particle::count = 0;
     iteration = 0;
+    _frameCount = 0;
+    _stepsSinceGrowth = 0;
+    _cellReserve = 0;
+    _stepAllocations = AllocStats();
+    _totalStepAllocations = AllocStats();
+    _steadyStateAllocationSteps = 0;
+    _capacity = particles > 0 ? particles : DEFAULT_CAPACITY;
+    _sceneScale = scenarioScale(newScenario, particles);
     // create long grid
-    boxSize.x = BOX_SIZE*2.0;
-    boxSize.y = BOX_SIZE;
-    boxSize.z = BOX_SIZE/2.0;
+    boxSize = scenarioBox(_sceneScale);
     int gridXRes = (int)ceil(boxSize.x/h);
     int gridYRes = (int)ceil(boxSize.y/h);
     int gridZRes = (int)ceil(boxSize.z/h);
-    boundary.createwall(BOX_SIZE, h, _walls);
+    boundary.createwall(BOX_SIZE * _sceneScale, h, _walls);
     grid = new FIELD_3D<>(gridXRes, gridYRes, gridZRes);
     nextGrid = new FIELD_3D<>(gridXRes, gridYRes, gridZRes);
-    surfaceGrid = new FIELD_3D<MarchingPoint>( gridXRes, gridYRes, gridZRes);
 
     if (newScenario == SCENARIO_DAM) {
         dt = 5.0f/1000.f;
@@ -57,7 +126,7 @@ void particlesystem::loadScenario(int newScenario) {
         generateFaucetParticleSet();
     }
     else if(newScenario == SCENARIO_RAIN) {
-        srand(time(NULL));
+        _random.seed(_seed ? _seed : _deterministic ? DETERMINISTIC_SEED : time(NULL));
         dt = 5.f/1000.f;
         particleMass = 0.02;
         viscosity = 15;
@@ -72,25 +141,43 @@ void particlesystem::loadScenario(int newScenario) {
     }
 
     updateGrid();
-    generateSurfaceGrid();
+    reserveCells();
+    updateSurfaceStorage();
 
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Give every grid cell enough capacity that particles migrating in
+// updateGrid() do not reallocate the cell vectors once the run has settled.
+// Cells only ever grow, so capacity reached during warm-up is kept. Large
+// grids reserve less per cell, the empty ones would otherwise outweigh the
+// particles. Once a clump filled a cell, every cell reserves for it as far
+// as CELL_RESERVE_MEMORY allows, the clump moves on to the cells around.
+///////////////////////////////////////////////////////////////////////////////
+void particlesystem::reserveCells()
+{
+    const size_t cells = grid->cellCount();
+    const size_t budget = (size_t)CELL_RESERVE_BUDGET * std::max<size_t>(_capacity, particle::count) / cells;
+    const size_t clumpBudget = std::max<size_t>(budget, (size_t)CELL_RESERVE_MEMORY / (2 * sizeof(particle) * cells));
+    const size_t reserve = std::max(std::min<size_t>(CELL_RESERVE, budget), std::min(_cellReserve, clumpBudget));
+#pragma omp parallel for
+    for (int gridCellIndex = 0; gridCellIndex < grid->cellCount(); gridCellIndex++)
+    {
+        vector<particle>& particles = grid->data()[gridCellIndex];
+        vector<particle>& nextParticles = nextGrid->data()[gridCellIndex];
+        size_t capacity = std::max<size_t>(reserve, 2 * particles.size());
+        particles.reserve(capacity);
+        nextParticles.reserve(capacity);
+    }
+}
+
 void particlesystem::generateDamParticleSet()
 {
 
     // add boundary condition
-    const float step = 0.5 * h;
-    for(float xPos = 0.5 * (step - boxSize.x) ; xPos <  - 5 * step; xPos += step)
-    {
-        for(float yPos = 0.5 * (boxSize.y - step); yPos > -0.5 * (boxSize.y - step ); yPos -= step)
-        {
-            for(float zPos =  0.5 * (step - boxSize.z); zPos < 0.5 * (boxSize.z - 0.5 * step); zPos += step )
-            {
-                addParticle(VEC3F(xPos,yPos,zPos));
-            }
-        }
-    }
+    VEC3F start, end;
+    latticeRegion(SCENARIO_DAM, boxSize, start, end);
+    fillRegion(start, end, 0.5 * h);
     cout << "Loaded dam scenario" << endl;
     cout << "Grid size is " << (*grid).xRes() << "x" << (*grid).yRes() << "x" << (*grid).zRes() << endl;
     cout << "Simulating " << particle::count << " particles" << endl;
@@ -100,17 +187,9 @@ void particlesystem::generateCubeParticleSet()
 {
 
     // add boundary condition
-    const float step =  0.5 *h ;
-    for(float xPos =   - boxSize.z; xPos < boxSize.z ; xPos += step)
-    {
-        for(float yPos =  0.5 * (step - boxSize.z) + 0.75 * boxSize.y; yPos < 0.5 * (boxSize.z - step) + 0.75 * boxSize.y; yPos += step)
-        {
-            for(float zPos =  0.5 * (step - boxSize.z); zPos < 0.5 * (boxSize.z - step); zPos += step )
-            {
-                addParticle(VEC3F(xPos,yPos,zPos));
-            }
-        }
-    }
+    VEC3F start, end;
+    latticeRegion(SCENARIO_CUBE, boxSize, start, end);
+    fillRegion(start, end, 0.5 * h);
     cout << "Loaded cube scenario" << endl;
     cout << "Grid size is " << (*grid).xRes() << "x" << (*grid).yRes() << "x" << (*grid).zRes() << endl;
     cout << "Simulating " << particle::count << " particles" << endl;
@@ -131,34 +210,109 @@ void particlesystem::generateFaucetParticleSet()
 
 void particlesystem::makeItRain(){
 
-    for(int i = 0; i < 3; ++i)
-        addParticle((1.f / 10000) * VEC3F(rand() % static_cast<int>(boxSize.x * 9980) - (boxSize.x * 4990),
+    // as many drops per area of the box as in the classic scene
+    const int drops = std::max(3, (int)(3 * _sceneScale * _sceneScale));
+    const unsigned int xRange = static_cast<unsigned int>(boxSize.x * 9980);
+    const unsigned int zRange = static_cast<unsigned int>(boxSize.z * 9980);
+    for(int i = 0; i < drops; ++i)
+        addParticle((1.f / 10000) * VEC3F((int)(_random() % xRange) - (boxSize.x * 4990),
                                           boxSize.y * 20000,
-                                          rand() % static_cast<int>(boxSize.z * 9980) - (boxSize.z * 4990))
+                                          (int)(_random() % zRange) - (boxSize.z * 4990))
                     );
 }
 
 void particlesystem::fatCube(){
     // add boundary condition
-    const float step =  0.5 * h ;
-    for(float xPos =   - 0.5 *boxSize.z; xPos < 0.5 *boxSize.z ; xPos += step)
+    VEC3F start, end;
+    latticeRegion(SCENARIO_FATCUBE, boxSize, start, end);
+    fillRegion(start, end, 0.5 * h);
+    cout << "Loaded fat cube scenario" << endl;
+    cout << "Grid size is " << (*grid).xRes() << "x" << (*grid).yRes() << "x" << (*grid).zRes() << endl;
+    cout << "Simulating " << particle::count << " particles" << endl;
+}
+void particlesystem::addParticle(const VEC3F& position, const VEC3F& velocity) {
+    particle part(position, velocity);
+    (*grid)(0,0,0).push_back(part);
+    (*nextGrid)(0,0,0).push_back(part);
+    _stepsSinceGrowth = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bulk initialization of a particle lattice.
+// Lattice coordinates and grid cells are both axis aligned, so the lattice
+// indices falling into a cell form one contiguous run per axis. Each cell is
+// then filled independently, in parallel, without going through updateGrid.
+// Ids are given in lattice order so the result does not depend on threads.
+///////////////////////////////////////////////////////////////////////////////
+int particlesystem::fillRegion(const VEC3F& start, const VEC3F& end, float spacing, const VEC3F& velocity)
+{
+    int res[3] = { grid->xRes(), grid->yRes(), grid->zRes() };
+    int count[3];
+    float step[3];
+    // per axis, the lattice indices landing in each cell layer: [first[c], first[c] + length[c])
+    vector<int> first[3], length[3];
+    for (int axis = 0; axis < 3; axis++)
     {
-        for(float yPos =   0.75 * boxSize.y; yPos < 1.25 *boxSize.y ; yPos += step)
+        float extent = end[axis] - start[axis];
+        step[axis] = extent < 0 ? -spacing : spacing;
+        count[axis] = (int)ceil(fabs(extent) / spacing);
+        first[axis].assign(res[axis], 0);
+        length[axis].assign(res[axis], 0);
+        for (int i = 0; i < count[axis]; i++)
         {
-            for(float zPos =   - 0.5 * boxSize.z; zPos < 0.5 *boxSize.z ; zPos += step)
+            VEC3F position;
+            position[axis] = start[axis] + i * step[axis];
+            int cell[3];
+            gridCell(position, cell[0], cell[1], cell[2]);
+            int c = cell[axis];
+            if (length[axis][c]++ == 0)
+                first[axis][c] = i;
+            else
+                first[axis][c] = std::min(first[axis][c], i);
+        }
+    }
+
+    const int total = count[0] * count[1] * count[2];
+    const int firstId = particle::count;
+
+#pragma omp parallel for
+    for(int z = 0; z < grid->zRes(); ++z )
+    {
+        if (length[2][z] == 0)
+            continue;
+        for(int y = 0; y < grid->yRes(); ++y)
+        {
+            if (length[1][y] == 0)
+                continue;
+            for(int x = 0; x < grid->xRes(); ++x)
             {
-                addParticle(VEC3F(xPos,yPos,zPos));
+                if (length[0][x] == 0)
+                    continue;
+                vector<particle>& particles = (*grid)(x,y,z);
+                vector<particle>& nextParticles = (*nextGrid)(x,y,z);
+                size_t size = particles.size() + length[0][x] * length[1][y] * length[2][z];
+                particles.reserve(size);
+                nextParticles.reserve(size);
+                for (int k = first[2][z]; k < first[2][z] + length[2][z]; k++)
+                {
+                    for (int j = first[1][y]; j < first[1][y] + length[1][y]; j++)
+                    {
+                        for (int i = first[0][x]; i < first[0][x] + length[0][x]; i++)
+                        {
+                            VEC3F position(start.x + i * step[0], start.y + j * step[1], start.z + k * step[2]);
+                            particle part(position, velocity, firstId + i + count[0] * (j + count[1] * k));
+                            particles.push_back(part);
+                            nextParticles.push_back(part);
+                        }
+                    }
+                }
             }
         }
     }
-    cout << "Loaded fat cube scenario" << endl;
-    cout << "Grid size is " << (*grid).xRes() << "x" << (*grid).yRes() << "x" << (*grid).zRes() << endl;
-    cout << "Simulating " << particle::count << " particles" << endl;
-}
-void particlesystem::addParticle(const VEC3F& position, const VEC3F& velocity) {
-    particle *part = new particle(position, velocity);
-    (*grid)(0,0,0).push_back(*part);
-    (*nextGrid)(0,0,0).push_back(*part);
+
+    particle::count += total;
+    _stepsSinceGrowth = 0;
+    return total;
 }
 
 void particlesystem::addParticle(const VEC3F& position) {
@@ -167,6 +321,8 @@ void particlesystem::addParticle(const VEC3F& position) {
 
 particlesystem::~particlesystem(){
     if (grid) delete grid;
+    if (nextGrid) delete nextGrid;
+    releaseSurfacePipeline();
 }
 
 void particlesystem::toggleGridVisble() {
@@ -196,11 +352,86 @@ void particlesystem::toggleArrows() {
 
 void particlesystem::toggleMarchingGrid(){
     _marchingGrid = !_marchingGrid;
+    updateSurfaceStorage();
 }
 
 void particlesystem::toogleMarchingCube(){
     _marchingCube = !_marchingCube;
     particle::display = !particle::display;
+    updateSurfaceStorage();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The surface pipeline, its thread and its grid only exist while something
+// uses them
+///////////////////////////////////////////////////////////////////////////////
+void particlesystem::updateSurfaceStorage()
+{
+    if (surfaceEnabled() && !_surfacePipeline)
+    {
+        _surfacePipeline = new surfacepipeline(_surfaceQueueDepth, _surfaceDropPolicy);
+        _surfaceResamples = 0;
+        _stepsSinceGrowth = 0;
+    }
+    else if (!surfaceEnabled())
+        releaseSurfacePipeline();
+}
+
+void particlesystem::releaseSurfacePipeline()
+{
+    if (_surfacePipeline) delete _surfacePipeline;
+    _surfacePipeline = NULL;
+    surfaceFrame = surfaceframe();
+}
+
+void particlesystem::surfacePipeline(int depth, int dropPolicy)
+{
+    _surfaceQueueDepth = depth;
+    _surfaceDropPolicy = dropPolicy;
+    if (_surfacePipeline)
+    {
+        releaseSurfacePipeline();
+        updateSurfaceStorage();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Bring surfaceFrame up to the newest surface the pipeline finished
+///////////////////////////////////////////////////////////////////////////////
+bool particlesystem::fetchSurface()
+{
+    return _surfacePipeline && _surfacePipeline->fetch(surfaceFrame);
+}
+
+void particlesystem::flushSurface()
+{
+    if (_surfacePipeline)
+        _surfacePipeline->flush();
+    fetchSurface();
+}
+
+long particlesystem::surfaceFramesDropped() const
+{
+    return _surfacePipeline ? _surfacePipeline->dropped() : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The surface thread reads the settings with the next snapshot
+///////////////////////////////////////////////////////////////////////////////
+void particlesystem::toggleSurfaceSampling(){
+    _surfaceSettings.sampling = _surfaceSettings.sampling == SURFACE_SCATTER ? SURFACE_GATHER : SURFACE_SCATTER;
+}
+
+void particlesystem::toggleSurfaceNarrowBand(){
+    _surfaceSettings.narrowBand = !_surfaceSettings.narrowBand;
+}
+
+void particlesystem::toggleSurfaceIncremental(){
+    _surfaceSettings.incremental = !_surfaceSettings.incremental;
+}
+
+void particlesystem::toggleSurfaceExtraction(){
+    _surfaceSettings.extraction = _surfaceSettings.extraction == SURFACE_NETS ? SURFACE_MARCHING_CUBES : SURFACE_NETS;
 }
 
 void particlesystem::setGravityVectorWithViewVector(VEC3F viewVector) {
@@ -209,371 +440,372 @@ void particlesystem::setGravityVectorWithViewVector(VEC3F viewVector) {
 
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Grid cell containing a position. The grid starts at the lower corner of the
+// box on every axis; positions outside the box are clamped to the border cells.
+///////////////////////////////////////////////////////////////////////////////
+void particlesystem::gridCell(const VEC3F& position, int& x, int& y, int& z) const
+{
+    x = (int)floor((position.x + boxSize.x/2.0)/h);
+    y = (int)floor((position.y + boxSize.y/2.0)/h);
+    z = (int)floor((position.z + boxSize.z/2.0)/h);
+    x = x < 0 ? 0 : x >= grid->xRes() ? grid->xRes() - 1 : x;
+    y = y < 0 ? 0 : y >= grid->yRes() ? grid->yRes() - 1 : y;
+    z = z < 0 ? 0 : z >= grid->zRes() ? grid->zRes() - 1 : z;
+}
+
 // to update the grid cells particles are located in
-// should be called right after particle positions are updated
+// should be called right after particle positions are updated, with grid
+// holding the new positions. A particle and its copy in nextGrid always
+// move together, so both stay at the same index of the same cell.
+// Every thread takes the leaving particles out of its own cells, then they
+// are moved serially, so no thread writes into a cell another one reads
 void particlesystem::updateGrid() {
-#pragma omp parallel for
-    for(int z = 0; z < grid->zRes(); ++z )
+    const int threads = omp_get_max_threads();
+    if ((int)_movingParticles.size() < threads)
+        _movingParticles.resize(threads);
+    if ((int)_isReceiving.size() != grid->cellCount())
+        _isReceiving.assign(grid->cellCount(), 0);
+    // a team may have fewer threads than the maximum, the lists of the
+    // threads that do not run must not hold the leavers of an earlier step
+    for (vector<movingparticle>& moving : _movingParticles)
+        moving.clear();
+
+#pragma omp parallel
     {
-        for(int y = 0; y < grid->yRes(); ++y)
+        THREAD_LOAD_SCOPE(LOAD_UPDATE_GRID);
+        vector<movingparticle>& moving = _movingParticles[omp_get_thread_num()];
+#pragma omp for nowait
+        for(int z = 0; z < grid->zRes(); ++z )
         {
-            for(int x = 0; x < grid->xRes(); ++x)
+            for(int y = 0; y < grid->yRes(); ++y)
             {
-
-                auto& particlesNext = (*nextGrid)(x,y,z);
-                auto& particles = (*grid)(x,y,z);
-                //On hash avec les données de New
-                for (int p = 0; p < particlesNext.size(); p++)
+                for(int x = 0; x < grid->xRes(); ++x)
                 {
 
-                    auto& particle = particlesNext[p];
-
-                    int newGridCellX = (int)floor((particle.position().x+BOX_SIZE/2.0)/h);
-                    int newGridCellY = (int)floor((particle.position().y+BOX_SIZE/2.0)/h);
-                    int newGridCellZ = (int)floor((particle.position().z+BOX_SIZE/2.0)/h);
-                    newGridCellX = newGridCellX < 0 ? 0 : newGridCellX >= (*grid).xRes() ? (*grid).xRes() - 1 : newGridCellX;
-                    newGridCellY = newGridCellY < 0 ? 0 : newGridCellY >= (*grid).yRes() ? (*grid).yRes() - 1 : newGridCellY;
-                    newGridCellZ = newGridCellZ < 0 ? 0 : newGridCellZ >= (*grid).zRes() ? (*grid).zRes() - 1 : newGridCellZ;
-
-                    // check if particle has moved
-                    if (x != newGridCellX || y != newGridCellY || z != newGridCellZ){
-                        // move the particle to the new grid cell
-#pragma omp critical
-                        {
-
-                            (*grid)(newGridCellX, newGridCellY, newGridCellZ).push_back(std::move(particle));
-                            particles[p] = particles.back();
-                            particles.pop_back();
+                    auto& particles = (*grid)(x,y,z);
+                    auto& particlesNext = (*nextGrid)(x,y,z);
+                    // the staying particles keep their order, a sorted cell stays sorted
+                    size_t kept = 0;
+                    for (size_t p = 0; p < particles.size(); p++)
+                    {
+                        int newGridCellX, newGridCellY, newGridCellZ;
+                        gridCell(particles[p].position(), newGridCellX, newGridCellY, newGridCellZ);
+
+                        // check if particle has moved
+                        if (x != newGridCellX || y != newGridCellY || z != newGridCellZ){
+                            movingparticle leaving = { newGridCellX + grid->xRes() * (newGridCellY + grid->yRes() * newGridCellZ),
+                                                       particles[p], particlesNext[p] };
+                            moving.push_back(leaving);
                         }
-#pragma omp critical
+                        else
                         {
-                            (*nextGrid)(newGridCellX, newGridCellY, newGridCellZ).push_back(std::move(particle));
-                            particlesNext[p] = particlesNext.back();
-                            particlesNext.pop_back();
-                            --p; // important! make sure to redo this index, since a new particle will (probably) be there
+                            if (kept != p)
+                            {
+                                particles[kept] = particles[p];
+                                particlesNext[kept] = particlesNext[p];
+                            }
+                            ++kept;
                         }
                     }
-
+                    particles.erase(particles.begin() + kept, particles.end());
+                    particlesNext.erase(particlesNext.begin() + kept, particlesNext.end());
                 }
             }
         }
     }
 
-
-}
-
-void particlesystem::generateSurfaceGrid()
-{
-    int count = 0;
-    const float step = PARTICLE_DRAW_RADIUS;
-    for( float xPos = -0.9* boxSize.x; xPos <=  0.9 * boxSize.x; xPos += step)
+    // move the particles to their new grid cell
+    _receivingCells.clear();
+    size_t leavers = 0;
+    for (int thread = 0; thread < threads; thread++)
     {
-        for( float yPos = -0.5 * boxSize.y; yPos <= 1.75 * boxSize.y; yPos += step)
+        leavers = std::max(leavers, _movingParticles[thread].size());
+        for (const movingparticle& leaving : _movingParticles[thread])
         {
-            for( float zPos = -1.7 * boxSize.z; zPos <= 1.9 * boxSize.z; zPos += step )
+            // a full cell would reallocate on its own, make room for twice
+            // its particles in all of them instead
+            const vector<particle>& particles = grid->data()[leaving.cell];
+            if (particles.size() == particles.capacity() && particles.size() >= _cellReserve)
             {
-                auto p = MarchingPoint( xPos, yPos, zPos);
-                int cellX = (int)floor((p.getPosition().x+BOX_SIZE/2.0)/h);
-                int cellY = (int)floor((p.getPosition().y+BOX_SIZE/2.0)/h);
-                int cellZ = (int)floor((p.getPosition().z+BOX_SIZE/2.0)/h);
-                cellX = cellX < 0 ? 0 : cellX >= (*surfaceGrid).xRes() ? (*surfaceGrid).xRes() - 1 : cellX;
-                cellY = cellY < 0 ? 0 : cellY >= (*surfaceGrid).yRes() ? (*surfaceGrid).yRes() - 1 : cellY;
-                cellZ = cellZ < 0 ? 0 : cellZ >= (*surfaceGrid).zRes() ? (*surfaceGrid).zRes() - 1 : cellZ;
-                // move the particle to the new grid cell
-                #pragma omp critical
-                {
-                    (*surfaceGrid)(cellX, cellY, cellZ).push_back(std::move(p));
-                }
-                ++count;
+                _cellReserve = 2 * (particles.size() + 1);
+                reserveCells();
+            }
+            grid->data()[leaving.cell].push_back(leaving.current);
+            nextGrid->data()[leaving.cell].push_back(leaving.next);
+            if (!_isReceiving[leaving.cell])
+            {
+                _isReceiving[leaving.cell] = 1;
+                _receivingCells.push_back(leaving.cell);
             }
         }
     }
-    std::cout << "number of marching point is : "<<count<<std::endl;
+    for (int cell : _receivingCells)
+        _isReceiving[cell] = 0;
+    // which thread the particles leave from changes from step to step, every
+    // list gets room for twice the most any of them held
+    for (vector<movingparticle>& moving : _movingParticles)
+        moving.reserve(2 * leavers);
+    _receivingCells.reserve(2 * leavers * threads);
+
+    // which thread took a particle out decides where it lands, sorting the
+    // receiving cells makes the order canonical again
+    if (_deterministic)
+        sortCells(_receivingCells);
 }
 
+static bool byId(const particle& a, const particle& b)
+{
+    return a.id() < b.id();
+}
 
-///////////////////////////////////////////////////////////////////////////////
-// OGL drawing
-///////////////////////////////////////////////////////////////////////////////
-void particlesystem::draw()
+// sort the particles of the cells by id. Both grids hold the same ids in a
+// cell, so sorting them separately keeps a particle and its copy together
+void particlesystem::sortCells(const vector<int>& cells)
 {
-    static VEC3F blackColor(0,0,0);
-    static VEC3F blueColor(0,0,1);
-    static VEC3F whiteColor(1,1,1);
-    static VEC3F greyColor(0.2, 0.2, 0.2);
-    static VEC3F lightGreyColor(0.8,0.8,0.8);
-    //static VEC3F greenColor(34.0 / 255, 139.0 / 255, 34.0 / 255);
-    static float shininess = 10.0;
-    // draw the particles
-    glEnable(GL_LIGHTING);
-    //glMaterialfv(GL_FRONT, GL_DIFFUSE, blueColor);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, whiteColor);
-    glMaterialfv(GL_FRONT, GL_SHININESS, &shininess);
-    //#pragma omp parallel for
-    for (int gridCellIndex = 0; gridCellIndex < (*grid).cellCount(); gridCellIndex++)
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int c = 0; c < (int)cells.size(); c++)
     {
-        vector<particle>& particles = (*grid).data()[gridCellIndex];
-        for (int p = 0; p < particles.size(); p++)
-        {
-            particle& particle = particles[p];
-            glMaterialfv(GL_FRONT, GL_DIFFUSE, blueColor);
-            particle.draw();
-        }
+        vector<particle>& particles = grid->data()[cells[c]];
+        vector<particle>& particlesNext = nextGrid->data()[cells[c]];
+        std::sort(particles.begin(), particles.end(), byId);
+        std::sort(particlesNext.begin(), particlesNext.end(), byId);
     }
-    glDisable(GL_LIGHTING);
-    if (_isGridVisible) {
-        // draw the grid
-        glColor3fv(lightGreyColor);
-        //float offset = -BOX_SIZE/2.0+h/2.0;
-        for(int z = 0; z < grid->zRes(); ++z )
-        {
-            for(int y = 0; y < grid->yRes(); ++y)
-            {
-                for(int x = 0; x < grid->xRes(); ++x)
-                {
-                    glColor3fv(VEC3F(x,y,z) / VEC3F(grid->xRes()-1,grid->yRes()-1,grid->zRes()-1));
-                    glPushMatrix();
-                    glTranslated(x*h-boxSize.x/2.0+h/2.0, y*h-boxSize.y/2.0+h/2.0, z*h-boxSize.z/2.0+h/2.0);
-                    glutWireCube(h);
-                    glPopMatrix();
-                }
-            }
-        }
+}
 
+void particlesystem::deterministic(const bool deterministic)
+{
+    _deterministic = deterministic;
+    if (!_deterministic || grid == NULL)
+        return;
+    // every cell, the grid may have been filled unsorted before
+    vector<int> cells(grid->cellCount());
+    for (int cell = 0; cell < grid->cellCount(); cell++)
+        cells[cell] = cell;
+    sortCells(cells);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Verlet integration
+///////////////////////////////////////////////////////////////////////////////
+void particlesystem::stepVerlet(){
+    TRACE_SCOPE("stepVerlet");
+    AllocStats allocationsBefore = allocStats();
+    densityAndPressureComputation();
+    accelerationComputation();
+    integrate();
+
+    if( _scenario == SCENARIO_FAUCET && particle::count < (unsigned int)_capacity && _frameCount % 5 == 0){//&& frameCount % 5 == 0
+        TRACE_SCOPE("emission");
+        generateFaucetParticleSet();
+//        if(frameCount % 40 == 0)
+//            std::cout << "Particle count : " << particle::count<<std::endl;
     }
-    if (_marchingGrid) {
-        glPointSize(3.f);
-        glBegin(GL_POINTS);
-        // draw the grid
-        //float offset = -BOX_SIZE/2.0+h/2.0;
-        for(int z = 0; z < surfaceGrid->zRes(); ++z )
-        {
-            for(int y = 0; y < surfaceGrid->yRes(); ++y)
-            {
-                for(int x = 0; x < surfaceGrid->xRes(); ++x)
-                {
-                    auto& mvec = (*surfaceGrid)(x,y,z);
-                    for(auto& mp : mvec){
-                        //glColor3fv(mp.getColor());
-                        glColor3fv(VEC3F(x,y,z) / VEC3F(surfaceGrid->xRes()-1,surfaceGrid->yRes()-1,surfaceGrid->zRes()-1));
-                        glPushMatrix();
-                        glVertex3f(mp.getPosition().x,
-                                   mp.getPosition().y,
-                                   mp.getPosition().z);
-                        glPopMatrix();
-                    }
-                }
-            }
-        }
-    glEnd();
+    else if( _scenario == SCENARIO_RAIN && particle::count < (unsigned int)_capacity && _frameCount % 20 == 0){//&& frameCount % 5 == 0
+        TRACE_SCOPE("emission");
+        makeItRain();
     }
-    glColor3fv(greyColor);
-    glPopMatrix();
-    glScaled(boxSize.x, boxSize.y, boxSize.z);
-    glutWireCube(1.0);
-    glPopMatrix();
-}
 
-void particlesystem::computeSurface()
-{
-    static float h2 = h*h;
-    #pragma omp parallel for
-    for(int z = 0; z < surfaceGrid->zRes(); ++z )
+    swapGrids();
+
+    // the surface of this step is computed while the next ones are simulated
+    if(surfaceEnabled())
     {
-        for(int y = 0; y < surfaceGrid->yRes(); ++y)
+        TRACE_SCOPE("surfaceSubmit");
+        _surfaceSettings.isoLevel = surfaceIsoLevel;
+        _surfaceSettings.particleMass = particleMass;
+        _surfacePipeline->submit(*grid, boxSize, h, _surfaceSettings, _frameCount);
+        // resampling the surface grid allocates, like emitting particles
+        if (_surfacePipeline->resamples() != _surfaceResamples)
         {
-            for(int x = 0; x < surfaceGrid->xRes(); ++x)
-            {
-                vector<MarchingPoint>& mvec = (*surfaceGrid)(x,y,z);
-                for(MarchingPoint& mp : mvec)
-                {
-                    float color = 0.0;
-                    for(int zz = z - 1; zz <= z + 1; ++zz)
-                    {
-                        for(int yy = y - 1; yy <= y + 1; ++yy)
-                        {
-                            for(int xx = x - 1; xx <= x + 1; ++xx)
-                            {
-                                if( xx >= 0 &&  xx < grid->xRes() && yy >= 0 && yy < grid->yRes() && zz >= 0 && zz < grid->zRes())
-                                {
-                                    vector<particle>& neighborhood = (*grid)(xx,yy,zz);
-                                    for(particle& neighbor : neighborhood)
-                                    {
-                                        VEC3F diffPos = mp.getPosition() - neighbor.position();
-                                        float distSquared = diffPos.dot(diffPos);
-                                        if( h2 <= distSquared )
-                                            continue;
-                                        color += neighbor.density() * Wpoly6(distSquared);
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    mp.updateColorInfo(color);
-                }
-            }
+            _surfaceResamples = _surfacePipeline->resamples();
+            _stepsSinceGrowth = 0;
         }
     }
+    ++_frameCount;
+
+    //Allocation accounting, emitting particles is the only expected source after warm-up
+    _stepAllocations = allocStats() - allocationsBefore;
+    _totalStepAllocations.allocations += _stepAllocations.allocations;
+    _totalStepAllocations.bytes += _stepAllocations.bytes;
+    if( isWarmedUp() && _stepAllocations.allocations > 0 )
+    {
+        if( _steadyStateAllocationSteps++ == 0 )
+            std::cerr << "warning: step " << _frameCount << " allocated " << _stepAllocations.allocations
+                      << " blocks (" << _stepAllocations.bytes << " bytes) after warm-up" << std::endl;
+    }
+    ++_stepsSinceGrowth;
 }
+
 ///////////////////////////////////////////////////////////////////////////////
-// Verlet integration
+// Velocity and position of the next step from the accelerations
 ///////////////////////////////////////////////////////////////////////////////
-void particlesystem::stepVerlet(){
-    static long int frameCount = 0;
-    accelerationComputation( );
-    VEC3F halfVelocity;
-    static float dt_over_2 = dt / 2;
-#pragma omp parallel for
-    for(int z = 0; z < grid->zRes(); ++z )
+void particlesystem::integrate(){
+    TRACE_SCOPE("integrate");
+#pragma omp parallel
     {
-        for(int y = 0; y < grid->yRes(); ++y)
+        THREAD_LOAD_SCOPE(LOAD_INTEGRATE);
+#pragma omp for nowait
+        for(int z = 0; z < grid->zRes(); ++z )
         {
-            for(int x = 0; x < grid->xRes(); ++x)
+            for(int y = 0; y < grid->yRes(); ++y)
             {
-                vector<particle>& old = grid->operator ()(x,y,z);
-                vector<particle>& next = nextGrid->operator ()(x,y,z);
-                for(int p = 0; p < next.size(); ++p)
+                for(int x = 0; x < grid->xRes(); ++x)
                 {
-                    particle& nextParticle = next.at(p);
-                    particle& oldParticle = old.at(p);
-                    //Position and velocity update
-                    nextParticle.setVelocity(oldParticle.velocity() + (nextParticle.acceleration()  * dt));
-                    nextParticle.setPosition(oldParticle.position() + nextParticle.velocity() * dt );
+                    vector<particle>& old = grid->operator ()(x,y,z);
+                    vector<particle>& next = nextGrid->operator ()(x,y,z);
+                    for(int p = 0; p < next.size(); ++p)
+                    {
+                        particle& nextParticle = next.at(p);
+                        particle& oldParticle = old.at(p);
+                        //Position and velocity update
+                        nextParticle.setVelocity(oldParticle.velocity() + (nextParticle.acceleration()  * dt));
+                        nextParticle.setPosition(oldParticle.position() + nextParticle.velocity() * dt );
+                    }
                 }
             }
         }
     }
+}
 
-    if( _scenario == SCENARIO_FAUCET && particle::count < MAX_PARTICLES && frameCount % 5 == 0){//&& frameCount % 5 == 0
-        generateFaucetParticleSet();
-//        if(frameCount % 40 == 0)
-//            std::cout << "Particle count : " << particle::count<<std::endl;
-    }
-    else if( _scenario == SCENARIO_RAIN && particle::count < MAX_PARTICLES && frameCount % 20 == 0)//&& frameCount % 5 == 0
-        makeItRain();
-
+///////////////////////////////////////////////////////////////////////////////
+// Make the next step the current one and rebin its particles
+///////////////////////////////////////////////////////////////////////////////
+void particlesystem::swapGrids(){
+    TRACE_SCOPE("updateGrid");
     std::swap(grid,nextGrid);
     updateGrid();
-
-    if(_marchingCube)
-        computeSurface();
-    ++frameCount;
 }
 
 
+// pairwise sum, in an order that does not depend on the threads
+static float treeSum(const float* values, int count)
+{
+    if (count <= 2)
+        return count == 2 ? values[0] + values[1] : count == 1 ? values[0] : 0.f;
+    const int half = count / 2;
+    return treeSum(values, half) + treeSum(values + half, count - half);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Calculate the acceleration of each particle using a grid optimized approach.
 // For each particle, only particles in the same grid cell and the (27) neighboring grid cells must be considered,
 // since any particle beyond a grid cell distance away contributes no force.
 ///////////////////////////////////////////////////////////////////////////////
 void particlesystem::accelerationComputation() {
-    densityAndPressureComputation();
+    TRACE_SCOPE("acceleration");
     static float h2 = h*h;
     static float h4 = h2 * h2;
-    float nextThreshold = 0.f;
+    _thresholdSlices.resize(grid->zRes());
     //Goes through all grid cells, z first for cache coherence
-#pragma omp parallel for
-    for(int z = 0; z < grid->zRes(); ++z )
+#pragma omp parallel
     {
-        for(int y = 0; y < grid->yRes(); ++y)
+        THREAD_LOAD_SCOPE(LOAD_ACCELERATION);
+#pragma omp for nowait
+        for(int z = 0; z < grid->zRes(); ++z )
         {
-            for(int x = 0; x < grid->xRes(); ++x)
+            float nextThreshold = 0.f;
+            for(int y = 0; y < grid->yRes(); ++y)
             {
+                for(int x = 0; x < grid->xRes(); ++x)
+                {
 
-                vector<particle>& old = (*grid)(x,y,z);
-                vector<particle>& next = (*nextGrid)(x,y,z);
+                    vector<particle>& old = (*grid)(x,y,z);
+                    vector<particle>& next = (*nextGrid)(x,y,z);
 
-                for( int p = 0; p < old.size(); ++p)
-                {
-                    particle& nextParticle = next.at(p);
-                    particle& oldParticle = old.at(p);
-                    nextParticle.clearForce();
-                    nextParticle.normal() *= 0.;
-                    VEC3F gradient;
-                    VEC3F laplacian;
-                    float coefpi = nextParticle.pressure() / (nextParticle.density() * nextParticle.density());
-                    float curvature = 0;
-                    unsigned int numberCloseNeighbor = 0;
-                    for(int zz = z - 1; zz <= z + 1; ++zz)
+                    for( int p = 0; p < old.size(); ++p)
                     {
-                        for(int yy = y - 1; yy <= y + 1; ++yy)
+                        particle& nextParticle = next.at(p);
+                        particle& oldParticle = old.at(p);
+                        nextParticle.clearForce();
+                        nextParticle.normal() *= 0.;
+                        VEC3F gradient;
+                        VEC3F laplacian;
+                        float coefpi = nextParticle.pressure() / (nextParticle.density() * nextParticle.density());
+                        float curvature = 0;
+                        unsigned int numberCloseNeighbor = 0;
+                        for(int zz = z - 1; zz <= z + 1; ++zz)
                         {
-                            for(int xx = x - 1; xx <= x + 1; ++xx)
+                            for(int yy = y - 1; yy <= y + 1; ++yy)
                             {
-                                if( xx >= 0 &&  xx < grid->xRes() && yy >= 0 && yy < grid->yRes() && zz >= 0 && zz < grid->zRes())
+                                for(int xx = x - 1; xx <= x + 1; ++xx)
                                 {
-                                    vector<particle>& neighborhood = (*grid)(xx,yy,zz);
-                                    vector<particle>& nextNeighborhood = (*nextGrid)(xx,yy,zz);
-                                    for(int k = 0; k < neighborhood.size(); ++k){
-
-                                        particle& neighbor = neighborhood.at(k);
-                                        particle& nextneighbor = nextNeighborhood.at(k);
-                                        if(oldParticle.id() == neighbor.id())
-                                            continue;
-
-                                        VEC3F diffPos = oldParticle.position() - neighbor.position();
-                                        float distSquared = diffPos.dot(diffPos);
-                                        if( h2 <= distSquared )
-                                            continue;
-
-                                        if(h2/1.1 >= distSquared)
-                                            ++numberCloseNeighbor;
-
-                                        float overDens = (1.f / nextneighbor.density());
-                                        float coefpj = nextneighbor.pressure() * overDens * overDens;
-
-                                        //pressure n visco
-                                        VEC3F currentGradient;
-                                        WspikyGradient(diffPos,distSquared,currentGradient);
-                                        gradient += ( coefpi + coefpj ) * currentGradient;
-                                        laplacian += ( WviscosityLaplacian(distSquared) * overDens ) * ( neighbor.velocity() - oldParticle.velocity() );
-
-                                        //normal and curvature
-                                        VEC3F tensionGrad;
-                                        Wpoly6Gradient(diffPos,distSquared,tensionGrad);
-
-                                        nextParticle.normal() += overDens * tensionGrad;
-                                        curvature += overDens * Wpoly6Laplacian(distSquared);
+                                    if( xx >= 0 &&  xx < grid->xRes() && yy >= 0 && yy < grid->yRes() && zz >= 0 && zz < grid->zRes())
+                                    {
+                                        vector<particle>& neighborhood = (*grid)(xx,yy,zz);
+                                        vector<particle>& nextNeighborhood = (*nextGrid)(xx,yy,zz);
+                                        for(int k = 0; k < neighborhood.size(); ++k){
+
+                                            particle& neighbor = neighborhood.at(k);
+                                            particle& nextneighbor = nextNeighborhood.at(k);
+                                            if(oldParticle.id() == neighbor.id())
+                                                continue;
+
+                                            VEC3F diffPos = oldParticle.position() - neighbor.position();
+                                            float distSquared = diffPos.dot(diffPos);
+                                            if( h2 <= distSquared )
+                                                continue;
+
+                                            if(h2/1.1 >= distSquared)
+                                                ++numberCloseNeighbor;
+
+                                            float overDens = (1.f / nextneighbor.density());
+                                            float coefpj = nextneighbor.pressure() * overDens * overDens;
+
+                                            //pressure n visco
+                                            VEC3F currentGradient;
+                                            WspikyGradient(diffPos,distSquared,currentGradient);
+                                            gradient += ( coefpi + coefpj ) * currentGradient;
+                                            laplacian += ( WviscosityLaplacian(distSquared) * overDens ) * ( neighbor.velocity() - oldParticle.velocity() );
+
+                                            //normal and curvature
+                                            VEC3F tensionGrad;
+                                            Wpoly6Gradient(diffPos,distSquared,tensionGrad);
+
+                                            nextParticle.normal() += overDens * tensionGrad;
+                                            curvature += overDens * Wpoly6Laplacian(distSquared);
+                                        }
                                     }
                                 }
                             }
                         }
-                    }
 
-                    /* BODY FORCES */
-                    //pressure gradient
-                    nextParticle.addForce(-1.f * particleMass * gradient * nextParticle.density());
-                    //viscosity force
-                    nextParticle.addForce(viscosity * particleMass * laplacian);
-                    //gravity
-                    nextParticle.addForce(gravityVector * nextParticle.density());
-
-                    nextParticle.normal() *= particleMass;
-                    curvature *= particleMass;
-                    float mag = nextParticle.normal().magnitude();
-                    nextThreshold += mag;
-                    if( nextParticle.flag() = (mag > surfaceThreshold ) )
-                    {
-                        nextParticle.addForce( (-SURFACE_TENSION * curvature ) * nextParticle.normal() / mag);
-                    }
+                        /* BODY FORCES */
+                        //pressure gradient
+                        nextParticle.addForce(-1.f * particleMass * gradient * nextParticle.density());
+                        //viscosity force
+                        nextParticle.addForce(viscosity * particleMass * laplacian);
+                        //gravity
+                        nextParticle.addForce(gravityVector * nextParticle.density());
+
+                        nextParticle.normal() *= particleMass;
+                        curvature *= particleMass;
+                        float mag = nextParticle.normal().magnitude();
+                        nextThreshold += mag;
+                        if( nextParticle.flag() = (mag > surfaceThreshold ) )
+                        {
+                            nextParticle.addForce( (-SURFACE_TENSION * curvature ) * nextParticle.normal() / mag);
+                        }
 
-                    //next.size() gives less good results
-                    nextParticle.splash() = numberCloseNeighbor < 2;
-                    nextParticle.flag() |= nextParticle.splash();
+                        //next.size() gives less good results
+                        nextParticle.splash() = numberCloseNeighbor < 2;
+                        nextParticle.flag() |= nextParticle.splash();
 
-                    //Comment those 4 lines if you uncomment smoothTension() below
+                        //Comment those 4 lines if you uncomment smoothTension() below
 
-                    VEC3F collision;
-                    collisionForce(oldParticle,collision);
-                    nextParticle.addForce(collision * nextParticle.density());
+                        VEC3F collision;
+                        collisionForce(oldParticle,collision);
+                        nextParticle.addForce(collision * nextParticle.density());
 
-                    nextParticle.setAcceleration(( 1.f / nextParticle.density()) * nextParticle.force());
+                        nextParticle.setAcceleration(( 1.f / nextParticle.density()) * nextParticle.force());
+                    }
                 }
             }
+            _thresholdSlices[z] = nextThreshold;
         }
     }
     //smoothTension();
-    surfaceThreshold = nextThreshold / static_cast<float>(particle::count);
+    surfaceThreshold = treeSum(_thresholdSlices.data(), (int)_thresholdSlices.size()) / static_cast<float>(particle::count);
 }
 
 void particlesystem::collisionForce(particle& p, VEC3F& f_collision){
@@ -595,48 +827,53 @@ void particlesystem::collisionForce(particle& p, VEC3F& f_collision){
 }
 
 void particlesystem::densityAndPressureComputation(){
+    TRACE_SCOPE("density");
 
     static float h2 = h*h;
     //Goes through all grid cells, z first for cache coherence
-#pragma omp parallel for
-    for(int z = 0; z < grid->zRes(); ++z )
+#pragma omp parallel
     {
-        for(int y = 0; y < grid->yRes(); ++y)
+        THREAD_LOAD_SCOPE(LOAD_DENSITY);
+#pragma omp for nowait
+        for(int z = 0; z < grid->zRes(); ++z )
         {
-            for(int x = 0; x < grid->xRes(); ++x)
+            for(int y = 0; y < grid->yRes(); ++y)
             {
-
-                vector<particle>& old = (*grid)(x,y,z);
-                vector<particle>& next = (*nextGrid)(x,y,z);
-                //for all the particle in the current cell
-                for(int  p = 0 ; p < old.size(); ++p)
+                for(int x = 0; x < grid->xRes(); ++x)
                 {
-                    float newDensity = 0.;
-                    particle& nextParticle = next.at(p);
-                    particle& oldParticle = old.at(p);
-                    for(int zz = z - 1; zz <= z + 1; ++zz)
+
+                    vector<particle>& old = (*grid)(x,y,z);
+                    vector<particle>& next = (*nextGrid)(x,y,z);
+                    //for all the particle in the current cell
+                    for(int  p = 0 ; p < old.size(); ++p)
                     {
-                        for(int yy = y - 1; yy <= y + 1; ++yy)
+                        float newDensity = 0.;
+                        particle& nextParticle = next.at(p);
+                        particle& oldParticle = old.at(p);
+                        for(int zz = z - 1; zz <= z + 1; ++zz)
                         {
-                            for(int xx = x - 1; xx <= x + 1; ++xx)
+                            for(int yy = y - 1; yy <= y + 1; ++yy)
                             {
-                                if( xx >= 0 &&  xx < grid->xRes() && yy >= 0 && yy < grid->yRes() && zz >= 0 && zz < grid->zRes())
+                                for(int xx = x - 1; xx <= x + 1; ++xx)
                                 {
-                                    for(particle& neighbor : (*grid)(xx,yy,zz)){
-                                        VEC3F diffPos = neighbor.position() - oldParticle.position();
-                                        float distSquared = diffPos.dot(diffPos);
-                                        if(distSquared >= h2)
-                                            continue;
-                                        newDensity += Wpoly6(distSquared);
+                                    if( xx >= 0 &&  xx < grid->xRes() && yy >= 0 && yy < grid->yRes() && zz >= 0 && zz < grid->zRes())
+                                    {
+                                        for(particle& neighbor : (*grid)(xx,yy,zz)){
+                                            VEC3F diffPos = neighbor.position() - oldParticle.position();
+                                            float distSquared = diffPos.dot(diffPos);
+                                            if(distSquared >= h2)
+                                                continue;
+                                            newDensity += Wpoly6(distSquared);
+                                        }
                                     }
                                 }
                             }
                         }
+                        newDensity *= particleMass;
+                        nextParticle.setDensity( newDensity );
+                        float press = GAS_STIFFNESS * ( nextParticle.density() - REST_DENSITY);
+                        nextParticle.setPressure( press > 0 ? press : 0);
                     }
-                    newDensity *= particleMass;
-                    nextParticle.setDensity( newDensity );
-                    float press = GAS_STIFFNESS * ( nextParticle.density() - REST_DENSITY);
-                    nextParticle.setPressure( press > 0 ? press : 0);
                 }
             }
         }
@@ -712,36 +949,21 @@ void particlesystem::smoothTension(){
 
 }
 
-inline float particlesystem::Wpoly6(float radiusSquared) {
-    static float hSquared = h*h;
-    static float coefficient = 315.0/(64.0*M_PI*pow(h,9));
-    static float resultat = coefficient * pow(hSquared-radiusSquared, 3);
-    return coefficient * pow(hSquared-radiusSquared, 3);
-}
-
 inline void particlesystem::Wpoly6Gradient(VEC3F& diffPosition, float radiusSquared, VEC3F& gradient) {
-    static float coefficient = -945.0/(32.0*M_PI*pow(h,9));
-    static float hSquared = h*h;
-    gradient = coefficient * pow(hSquared-radiusSquared, 2) * diffPosition;
+    kernelPoly6Gradient(diffPosition, radiusSquared, gradient);
 }
 
 inline float particlesystem::Wpoly6Laplacian(float radiusSquared) {
-    static float coefficient = -945.0/(32.0*M_PI*pow(h,9));
-    static float hSquared = h*h;
-    return coefficient * (hSquared-radiusSquared) * (3.0*hSquared - 7.0*radiusSquared);
+    return kernelPoly6Laplacian(radiusSquared);
 }
 
 void particlesystem::WspikyGradient(VEC3F& diffPosition, float radiusSquared, VEC3F& gradient) {
-    static float coefficient = -45.0/(M_PI*pow(h,6));
-    float radius = sqrt(radiusSquared);
-    gradient = coefficient * pow(h-radius, 2) * diffPosition / radius;
+    kernelSpikyGradient(diffPosition, radiusSquared, gradient);
 }
 
 
 float particlesystem::WviscosityLaplacian(float radiusSquared) {
-    static float coefficient = 45.0/(M_PI*pow(h,6));
-    float radius = sqrt(radiusSquared);
-    return coefficient * (h - radius);
+    return kernelViscosityLaplacian(radiusSquared);
 }
 
 float particlesystem::C( float r){
@@ -0,0 +1,122 @@
+#include "../include/perfcounters.h"
+#include <omp.h>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////
+// Constructor / Destructor
+///////////////////////////////////////////////////////////////////////
+perfcounters::perfcounters()
+{
+    for (int counter = 0; counter < PERF_COUNTERS; counter++)
+        _available[counter] = false;
+}
+
+perfcounters::~perfcounters()
+{
+    close();
+}
+
+const char* perfcounters::name(int counter)
+{
+    static const char* names[PERF_COUNTERS] = { "cycles", "instructions", "llc_misses", "branch_misses" };
+    return names[counter];
+}
+
+bool perfcounters::anyAvailable() const
+{
+    for (int counter = 0; counter < PERF_COUNTERS; counter++)
+        if (_available[counter])
+            return true;
+    return false;
+}
+
+#ifdef __linux__
+
+///////////////////////////////////////////////////////////////////////
+// A counter is available when every thread could open it
+///////////////////////////////////////////////////////////////////////
+bool perfcounters::open()
+{
+    close();
+    static const unsigned long long configs[PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    const int threads = omp_get_max_threads();
+    _descriptors.assign(threads * PERF_COUNTERS, -1);
+
+    // pid 0 counts the calling thread, so every thread opens its own
+#pragma omp parallel num_threads(threads)
+    {
+        int* descriptors = &_descriptors[omp_get_thread_num() * PERF_COUNTERS];
+        for (int counter = 0; counter < PERF_COUNTERS; counter++) {
+            struct perf_event_attr attributes;
+            memset(&attributes, 0, sizeof(attributes));
+            attributes.size = sizeof(attributes);
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = configs[counter];
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+            attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            descriptors[counter] = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+        }
+    }
+
+    for (int counter = 0; counter < PERF_COUNTERS; counter++) {
+        _available[counter] = true;
+        for (int thread = 0; thread < threads; thread++)
+            _available[counter] = _available[counter] && _descriptors[thread * PERF_COUNTERS + counter] >= 0;
+    }
+    return anyAvailable();
+}
+
+void perfcounters::close()
+{
+    for (int descriptor : _descriptors)
+        if (descriptor >= 0)
+            ::close(descriptor);
+    _descriptors.clear();
+    for (int counter = 0; counter < PERF_COUNTERS; counter++)
+        _available[counter] = false;
+}
+
+void perfcounters::read(unsigned long long values[PERF_COUNTERS]) const
+{
+    const int threads = (int)_descriptors.size() / PERF_COUNTERS;
+    for (int counter = 0; counter < PERF_COUNTERS; counter++) {
+        values[counter] = 0;
+        if (!_available[counter])
+            continue;
+        for (int thread = 0; thread < threads; thread++) {
+            // value, time enabled, time running
+            unsigned long long data[3];
+            if (::read(_descriptors[thread * PERF_COUNTERS + counter], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+                continue;
+            values[counter] += data[2] < data[1] ? (unsigned long long)((double)data[0] * data[1] / data[2]) : data[0];
+        }
+    }
+}
+
+#else
+
+bool perfcounters::open()
+{
+    return false;
+}
+
+void perfcounters::close()
+{
+}
+
+void perfcounters::read(unsigned long long values[PERF_COUNTERS]) const
+{
+    for (int counter = 0; counter < PERF_COUNTERS; counter++)
+        values[counter] = 0;
+}
+
+#endif
@@ -0,0 +1,438 @@
+#include "../include/positioncodec.h"
+#include <omp.h>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////
+// Adaptive binary range coder, as in LZMA. A probability is the chance of
+// a 0 bit in RC_PROB_BITS bits, moved towards every coded bit
+///////////////////////////////////////////////////////////////////////////////
+#define RC_TOP       (1u << 24)
+#define RC_PROB_BITS 11
+#define RC_PROB_ONE  (1 << RC_PROB_BITS)
+#define RC_MOVE_BITS 5
+
+class rangeencoder {
+public:
+    rangeencoder(vector<unsigned char>& out) :
+        _out(out), _low(0), _range(0xFFFFFFFFu), _cache(0), _cacheSize(1) {}
+
+    inline void bit(unsigned short& probability, int bit)
+    {
+        unsigned int bound = (_range >> RC_PROB_BITS) * probability;
+        if (bit == 0) {
+            _range = bound;
+            probability += (RC_PROB_ONE - probability) >> RC_MOVE_BITS;
+        }
+        else {
+            _low += bound;
+            _range -= bound;
+            probability -= probability >> RC_MOVE_BITS;
+        }
+        while (_range < RC_TOP) {
+            _range <<= 8;
+            shiftLow();
+        }
+    }
+
+    // bits with even chances, highest first
+    inline void direct(unsigned int value, int bits)
+    {
+        for (int b = bits - 1; b >= 0; b--) {
+            _range >>= 1;
+            if ((value >> b) & 1)
+                _low += _range;
+            while (_range < RC_TOP) {
+                _range <<= 8;
+                shiftLow();
+            }
+        }
+    }
+
+    void finish()
+    {
+        for (int x = 0; x < 5; x++)
+            shiftLow();
+    }
+
+private:
+    // a carry can still change the bytes held back in cache
+    void shiftLow()
+    {
+        if ((unsigned int)_low < 0xFF000000u || (_low >> 32) != 0) {
+            unsigned char carry = (unsigned char)(_low >> 32);
+            unsigned char held = _cache;
+            do {
+                _out.push_back((unsigned char)(held + carry));
+                held = 0xFF;
+            } while (--_cacheSize != 0);
+            _cache = (unsigned char)((unsigned int)_low >> 24);
+        }
+        _cacheSize++;
+        _low = (unsigned int)_low << 8;
+    }
+
+    vector<unsigned char>& _out;
+    unsigned long long _low;
+    unsigned int _range;
+    unsigned char _cache;
+    unsigned long long _cacheSize;
+};
+
+class rangedecoder {
+public:
+    rangedecoder(const unsigned char* data, size_t bytes) :
+        _data(data), _end(data + bytes), _range(0xFFFFFFFFu), _code(0)
+    {
+        for (int x = 0; x < 5; x++)
+            _code = (_code << 8) | next();
+    }
+
+    inline int bit(unsigned short& probability)
+    {
+        unsigned int bound = (_range >> RC_PROB_BITS) * probability;
+        int bit;
+        if (_code < bound) {
+            _range = bound;
+            probability += (RC_PROB_ONE - probability) >> RC_MOVE_BITS;
+            bit = 0;
+        }
+        else {
+            _code -= bound;
+            _range -= bound;
+            probability -= probability >> RC_MOVE_BITS;
+            bit = 1;
+        }
+        while (_range < RC_TOP) {
+            _range <<= 8;
+            _code = (_code << 8) | next();
+        }
+        return bit;
+    }
+
+    inline unsigned int direct(int bits)
+    {
+        unsigned int value = 0;
+        for (int b = 0; b < bits; b++) {
+            _range >>= 1;
+            unsigned int bit = _code >= _range ? 1 : 0;
+            _code -= _range & (0u - bit);
+            value = (value << 1) | bit;
+            while (_range < RC_TOP) {
+                _range <<= 8;
+                _code = (_code << 8) | next();
+            }
+        }
+        return value;
+    }
+
+private:
+    // past the end of damaged data reads zeros, the frame checks catch it
+    inline unsigned int next() { return _data < _end ? *_data++ : 0; }
+
+    const unsigned char* _data;
+    const unsigned char* _end;
+    unsigned int _range;
+    unsigned int _code;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Unsigned values: their bit length (0 to 32) through a 6 level context
+// tree, then the bits below the leading one
+///////////////////////////////////////////////////////////////////////////////
+struct valuemodel {
+    valuemodel() { for (int x = 0; x < 64; x++) lengths[x] = RC_PROB_ONE / 2; }
+    unsigned short lengths[64];
+};
+
+static inline void encodeValue(rangeencoder& coder, valuemodel& model, unsigned int value)
+{
+    int length = 0;
+    while (length < 32 && (value >> length) != 0)
+        length++;
+    int node = 1;
+    for (int b = 5; b >= 0; b--) {
+        int bit = (length >> b) & 1;
+        coder.bit(model.lengths[node], bit);
+        node = (node << 1) | bit;
+    }
+    if (length > 1)
+        coder.direct(value & ((1u << (length - 1)) - 1), length - 1);
+}
+
+static inline unsigned int decodeValue(rangedecoder& coder, valuemodel& model)
+{
+    int node = 1;
+    for (int b = 0; b < 6; b++)
+        node = (node << 1) | coder.bit(model.lengths[node]);
+    int length = std::min(node - 64, 32);
+    if (length <= 1)
+        return (unsigned int)length;
+    return (1u << (length - 1)) | coder.direct(length - 1);
+}
+
+static inline unsigned int zigzag(int value)
+{
+    return ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+}
+
+static inline int unzigzag(unsigned int value)
+{
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+// models of one segment: ids and positions of keyframe and new particles,
+// prediction residuals of the others
+struct segmentmodels {
+    valuemodel id;
+    valuemodel key[3];
+    valuemodel delta[3];
+};
+
+struct codedheader {
+    int key;
+    int particles;
+    // particles coded against the previous frame, they come first
+    int previous;
+    int segments;
+};
+
+// bits of v at every third place
+static inline unsigned long long spread(unsigned int v)
+{
+    unsigned long long x = v & 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+static inline long long prediction(const unsigned int* q1, const unsigned int* q2, bool history, int axis)
+{
+    return history ? 2LL * q1[axis] - q2[axis] : (long long)q1[axis];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////////////
+positioncodec::positioncodec() :
+    _quantum(0.f), _limit((1u << POSITION_BITS) - 1), _valid(false)
+{
+}
+
+bool positioncodec::configure(const VEC3F& boxSize, float quantum)
+{
+    reset();
+    _quantum = quantum;
+    _origin = VEC3F(-boxSize.x, -boxSize.y, -boxSize.z);
+    for (int axis = 0; axis < 3; axis++)
+        if (quantum <= 0.f || 2.0 * boxSize[axis] / quantum >= _limit)
+            return false;
+    return true;
+}
+
+void positioncodec::reset()
+{
+    _valid = false;
+    _ids.clear();
+    _q1.clear();
+    _q2.clear();
+    _history.clear();
+}
+
+void positioncodec::quantize(const VEC3F& position, unsigned int q[3]) const
+{
+    for (int axis = 0; axis < 3; axis++) {
+        double steps = floor((position[axis] - _origin[axis]) / _quantum + 0.5);
+        q[axis] = steps < 0.0 ? 0 : steps > _limit ? _limit : (unsigned int)steps;
+    }
+}
+
+// the frame just coded, in _codedIds and _coded, becomes the previous one
+void positioncodec::keep(int previous)
+{
+    const int count = (int)_codedIds.size();
+    _q2.swap(_q1);
+    _q2.resize(3 * count);
+    _q1.swap(_coded);
+    _ids.swap(_codedIds);
+    _history.assign(count, 0);
+    for (int i = 0; i < previous; i++)
+        _history[i] = 1;
+    _valid = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Encoder
+///////////////////////////////////////////////////////////////////////////////
+bool positioncodec::encode(const int* ids, const VEC3F* positions, int count, bool key,
+                           vector<int>& order, vector<unsigned char>& out)
+{
+    _q.resize(3 * count);
+    int maxId = 0;
+    for (int i = 0; i < count; i++) {
+        quantize(positions[i], &_q[3 * i]);
+        maxId = std::max(maxId, ids[i]);
+    }
+    _slotOfId.assign(maxId + 1, -1);
+    for (int i = 0; i < count; i++)
+        _slotOfId[ids[i]] = i;
+
+    // a particle of the previous frame that is gone needs a keyframe
+    key = key || !_valid;
+    for (size_t i = 0; i < _ids.size() && !key; i++)
+        key = _ids[i] > maxId || _slotOfId[_ids[i]] < 0;
+    const int previous = key ? 0 : (int)_ids.size();
+
+    // the order of the previous frame, then the new particles in Morton order
+    order.clear();
+    for (int i = 0; i < previous; i++) {
+        order.push_back(_slotOfId[_ids[i]]);
+        _slotOfId[_ids[i]] = -1;
+    }
+    _morton.resize(count);
+    for (int i = 0; i < count; i++) {
+        if (_slotOfId[ids[i]] < 0)
+            continue;
+        const unsigned int* q = &_q[3 * i];
+        _morton[i] = spread(q[0]) | spread(q[1]) << 1 | spread(q[2]) << 2;
+        order.push_back(i);
+    }
+    std::sort(order.begin() + previous, order.end(), [this, ids](int a, int b) {
+        return _morton[a] < _morton[b] || (_morton[a] == _morton[b] && ids[a] < ids[b]);
+    });
+
+    _codedIds.resize(count);
+    _coded.resize(3 * count);
+    for (int i = 0; i < count; i++) {
+        _codedIds[i] = ids[order[i]];
+        for (int axis = 0; axis < 3; axis++)
+            _coded[3 * i + axis] = _q[3 * order[i] + axis];
+    }
+
+    codedheader header;
+    header.key = key ? 1 : 0;
+    header.particles = count;
+    header.previous = previous;
+    header.segments = (count + POSITION_SEGMENT - 1) / POSITION_SEGMENT;
+    const size_t headerAt = out.size();
+    out.resize(headerAt + sizeof(header) + header.segments * sizeof(unsigned int));
+    for (int segment = 0; segment < header.segments; segment++) {
+        const size_t start = out.size();
+        segmentmodels models;
+        rangeencoder coder(out);
+        int lastId = 0;
+        unsigned int last[3] = { 0, 0, 0 };
+        const int end = std::min(count, (segment + 1) * POSITION_SEGMENT);
+        for (int i = segment * POSITION_SEGMENT; i < end; i++) {
+            const unsigned int* q = &_coded[3 * i];
+            if (i < previous) {
+                for (int axis = 0; axis < 3; axis++)
+                    encodeValue(coder, models.delta[axis],
+                                zigzag((int)(q[axis] - prediction(&_q1[3 * i], &_q2[3 * i], _history[i] != 0, axis))));
+            }
+            else {
+                encodeValue(coder, models.id, zigzag(_codedIds[i] - lastId));
+                lastId = _codedIds[i];
+                for (int axis = 0; axis < 3; axis++) {
+                    encodeValue(coder, models.key[axis], zigzag((int)q[axis] - (int)last[axis]));
+                    last[axis] = q[axis];
+                }
+            }
+        }
+        coder.finish();
+        unsigned int bytes = (unsigned int)(out.size() - start);
+        memcpy(&out[headerAt + sizeof(header) + segment * sizeof(unsigned int)], &bytes, sizeof(bytes));
+    }
+    memcpy(&out[headerAt], &header, sizeof(header));
+
+    keep(previous);
+    return key;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decoder, the segments in parallel
+///////////////////////////////////////////////////////////////////////////////
+bool positioncodec::isKeyframe(const unsigned char* data, size_t bytes)
+{
+    codedheader header;
+    if (bytes < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    return header.key == 1;
+}
+
+bool positioncodec::decode(const unsigned char* data, size_t bytes, vector<int>& ids, vector<VEC3F>& positions)
+{
+    codedheader header;
+    if (bytes < sizeof(header))
+        return false;
+    memcpy(&header, data, sizeof(header));
+    const int count = header.particles;
+    if (count < 0 || header.previous < 0 || header.previous > count ||
+        header.segments != (count + POSITION_SEGMENT - 1) / POSITION_SEGMENT ||
+        (header.key ? header.previous != 0 : !_valid || header.previous != (int)_ids.size()) ||
+        bytes < sizeof(header) + header.segments * sizeof(unsigned int))
+        return false;
+    const int previous = header.previous;
+
+    vector<size_t> starts(header.segments + 1);
+    starts[0] = sizeof(header) + header.segments * sizeof(unsigned int);
+    for (int segment = 0; segment < header.segments; segment++) {
+        unsigned int segmentBytes;
+        memcpy(&segmentBytes, data + sizeof(header) + segment * sizeof(unsigned int), sizeof(segmentBytes));
+        starts[segment + 1] = starts[segment] + segmentBytes;
+    }
+    if (starts[header.segments] != bytes)
+        return false;
+
+    _codedIds.resize(count);
+    _coded.resize(3 * count);
+    bool valid = true;
+#pragma omp parallel for schedule(dynamic, 1) reduction(&&:valid)
+    for (int segment = 0; segment < header.segments; segment++) {
+        segmentmodels models;
+        rangedecoder coder(data + starts[segment], starts[segment + 1] - starts[segment]);
+        int lastId = 0;
+        unsigned int last[3] = { 0, 0, 0 };
+        const int end = std::min(count, (segment + 1) * POSITION_SEGMENT);
+        for (int i = segment * POSITION_SEGMENT; i < end; i++) {
+            unsigned int* q = &_coded[3 * i];
+            if (i < previous) {
+                _codedIds[i] = _ids[i];
+                for (int axis = 0; axis < 3; axis++)
+                    q[axis] = (unsigned int)(prediction(&_q1[3 * i], &_q2[3 * i], _history[i] != 0, axis) +
+                                             unzigzag(decodeValue(coder, models.delta[axis])));
+            }
+            else {
+                lastId += unzigzag(decodeValue(coder, models.id));
+                _codedIds[i] = lastId;
+                for (int axis = 0; axis < 3; axis++) {
+                    q[axis] = (unsigned int)((int)last[axis] + unzigzag(decodeValue(coder, models.key[axis])));
+                    last[axis] = q[axis];
+                }
+            }
+            if (_codedIds[i] < 0 || q[0] > _limit || q[1] > _limit || q[2] > _limit)
+                valid = false;
+        }
+    }
+    if (!valid) {
+        reset();
+        return false;
+    }
+
+    ids.resize(count);
+    positions.resize(count);
+#pragma omp parallel for
+    for (int i = 0; i < count; i++) {
+        ids[i] = _codedIds[i];
+        const unsigned int* q = &_coded[3 * i];
+        positions[i] = VEC3F(_origin.x + (double)q[0] * _quantum, _origin.y + (double)q[1] * _quantum,
+                             _origin.z + (double)q[2] * _quantum);
+    }
+    keep(previous);
+    return true;
+}
@@ -0,0 +1,232 @@
+// <chrono> before the solver headers, which define h
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <omp.h>
+#include "../include/particlesystem.h"
+#include "../include/referencesolver.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Checks the solver against the all pairs double precision reference.
+//
+// Every step the reference loads the particles of the solver, then both
+// run the step and the particles are compared, so errors do not add up
+// over the steps. --crossover times both at growing particle counts
+// instead, to see where the grid search starts to pay off.
+///////////////////////////////////////////////////////////////////////////////
+
+struct referenceoptions {
+    referenceoptions() : particles(2000), steps(20), reps(5), threads(0), tolerance(1e-3), crossover(false) {}
+
+    vector<int> scenarios;
+    vector<int> counts;
+    int particles;
+    int steps;
+    int reps;
+    int threads;
+    double tolerance;
+    bool crossover;
+};
+
+static const char* scenarioNames[] = { "dam", "faucet", "cube", "rain", "fatcube" };
+
+static int scenarioByName(const string& name)
+{
+    for (int x = 0; x < 5; x++)
+        if (name == scenarioNames[x])
+            return x;
+    return -1;
+}
+
+static void usage(const char* program)
+{
+    cerr << "usage: " << program << " [options]" << endl
+         << "  --scenarios LIST  comma separated scenarios (default dam,faucet,cube,fatcube)" << endl
+         << "  --particles N     particles of the scaled scenes (default 2000)" << endl
+         << "  --steps N         steps compared (default 20)" << endl
+         << "  --tolerance X     largest relative density and acceleration error (default 1e-3)" << endl
+         << "  --crossover       time the grid against the reference instead" << endl
+         << "  --counts LIST     particle counts of the crossover (default 250,500,1000,2000,4000)" << endl
+         << "  --reps N          steps timed per count (default 5)" << endl
+         << "  --threads N       OpenMP threads (default: OpenMP's choice)" << endl;
+}
+
+static bool parseList(const char* value, vector<string>& items)
+{
+    items.clear();
+    string list = value;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == string::npos)
+            end = list.size();
+        if (end == start)
+            return false;
+        items.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    return !items.empty();
+}
+
+static bool parseOptions(int argc, char** argv, referenceoptions& opts)
+{
+    vector<string> items;
+    for (int x = 1; x < argc; x++) {
+        string arg = argv[x];
+        if (arg == "--crossover") {
+            opts.crossover = true;
+            continue;
+        }
+        if (arg != "--scenarios" && arg != "--particles" && arg != "--steps" && arg != "--tolerance" &&
+            arg != "--counts" && arg != "--reps" && arg != "--threads") {
+            if (arg != "--help" && arg != "-h")
+                cerr << "unknown option " << arg << endl;
+            return false;
+        }
+        if (x + 1 >= argc) {
+            cerr << "missing value for " << arg << endl;
+            return false;
+        }
+        const char* value = argv[++x];
+        if (arg == "--scenarios") {
+            if (!parseList(value, items))
+                return false;
+            opts.scenarios.clear();
+            for (const string& item : items) {
+                int scenario = scenarioByName(item);
+                if (scenario < 0) {
+                    cerr << "unknown scenario " << item << endl;
+                    return false;
+                }
+                opts.scenarios.push_back(scenario);
+            }
+        }
+        else if (arg == "--counts") {
+            if (!parseList(value, items))
+                return false;
+            opts.counts.clear();
+            for (const string& item : items)
+                opts.counts.push_back(atoi(item.c_str()));
+        }
+        else if (arg == "--particles")
+            opts.particles = atoi(value);
+        else if (arg == "--steps")
+            opts.steps = atoi(value);
+        else if (arg == "--tolerance")
+            opts.tolerance = atof(value);
+        else if (arg == "--reps")
+            opts.reps = atoi(value);
+        else
+            opts.threads = atoi(value);
+    }
+    if (opts.particles <= 0 || opts.steps <= 0 || opts.reps <= 0 || opts.threads < 0 || opts.tolerance <= 0) {
+        cerr << "--particles, --steps, --reps, --threads and --tolerance must be positive" << endl;
+        return false;
+    }
+    return true;
+}
+
+static inline double milliseconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Worst error of every field over the steps, false when density or
+// acceleration are off by more than the tolerance
+///////////////////////////////////////////////////////////////////////////////
+static bool validate(const referenceoptions& opts)
+{
+    bool passed = true;
+    printf("%-8s %9s %10s %10s %10s %10s %10s %6s  %s\n", "scenario", "particles", "density", "pressure",
+           "accel", "velocity", "position", "flags", "");
+    for (int scenario : opts.scenarios) {
+        particlesystem system;
+        system.scenario(scenario);
+        system.loadScenario(scenario, opts.particles);
+        referencesolver reference;
+        referenceerror worst;
+        for (int step = 0; step < opts.steps; step++) {
+            reference.load(system);
+            reference.step();
+            system.stepVerlet();
+            referenceerror error = reference.compare(system);
+            worst.particles = max(worst.particles, error.particles);
+            worst.missing += error.missing;
+            worst.density = max(worst.density, error.density);
+            worst.pressure = max(worst.pressure, error.pressure);
+            worst.acceleration = max(worst.acceleration, error.acceleration);
+            worst.velocity = max(worst.velocity, error.velocity);
+            worst.position = max(worst.position, error.position);
+            worst.flags = max(worst.flags, error.flags);
+        }
+        bool ok = worst.missing == 0 && worst.density <= opts.tolerance && worst.acceleration <= opts.tolerance;
+        passed = passed && ok;
+        printf("%-8s %9d %10.2e %10.2e %10.2e %10.2e %10.2e %6d  %s\n", scenarioNames[scenario], worst.particles,
+               worst.density, worst.pressure, worst.acceleration, worst.velocity, worst.position, worst.flags,
+               ok ? "ok" : "FAILED");
+    }
+    return passed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Milliseconds per step of the grid solver and of the reference on the
+// scaled cube, which has no emission
+///////////////////////////////////////////////////////////////////////////////
+static void crossover(const referenceoptions& opts)
+{
+    printf("%9s %10s %12s %8s\n", "particles", "grid ms", "reference ms", "ratio");
+    int wins = -1;
+    for (int count : opts.counts) {
+        particlesystem system;
+        system.scenario(SCENARIO_CUBE);
+        system.loadScenario(SCENARIO_CUBE, count);
+        referencesolver reference;
+        reference.load(system);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int rep = 0; rep < opts.reps; rep++)
+            system.stepVerlet();
+        double gridTime = milliseconds(start) / opts.reps;
+
+        start = std::chrono::steady_clock::now();
+        for (int rep = 0; rep < opts.reps; rep++)
+            reference.step();
+        double referenceTime = milliseconds(start) / opts.reps;
+
+        if (wins < 0 && gridTime < referenceTime)
+            wins = particle::count;
+        printf("%9u %10.3f %12.3f %8.2f\n", particle::count, gridTime, referenceTime, referenceTime / gridTime);
+    }
+    if (wins < 0)
+        printf("the reference is faster at every count\n");
+    else
+        printf("the grid search is faster from %d particles\n", wins);
+}
+
+int main(int argc, char** argv)
+{
+    referenceoptions opts;
+    if (!parseOptions(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opts.scenarios.empty()) {
+        opts.scenarios.push_back(SCENARIO_DAM);
+        opts.scenarios.push_back(SCENARIO_FAUCET);
+        opts.scenarios.push_back(SCENARIO_CUBE);
+        opts.scenarios.push_back(SCENARIO_FATCUBE);
+    }
+    if (opts.counts.empty())
+        for (int count = 250; count <= 4000; count *= 2)
+            opts.counts.push_back(count);
+    if (opts.threads > 0)
+        omp_set_num_threads(opts.threads);
+
+    if (opts.crossover) {
+        crossover(opts);
+        return 0;
+    }
+    return validate(opts) ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+#include "../include/referencesolver.h"
+#include <omp.h>
+#include <algorithm>
+
+static inline VEC3D toDouble(const VEC3F& v)
+{
+    return VEC3D(v.x, v.y, v.z);
+}
+
+static inline double magnitude(const VEC3D& v)
+{
+    return sqrt(v.dot(v));
+}
+
+///////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////
+referencesolver::referencesolver() :
+    _particleMass(0), _viscosity(0), _dt(0), _surfaceThreshold(0)
+{
+}
+
+void referencesolver::load(const particlesystem& system)
+{
+    FIELD_3D<>& grid = *system.grid;
+    _particles.clear();
+    for (int gridCellIndex = 0; gridCellIndex < grid.cellCount(); gridCellIndex++)
+        for (particle& p : grid.data()[gridCellIndex]) {
+            referenceparticle r;
+            r.id = p.id();
+            r.position = toDouble(p.position());
+            r.velocity = toDouble(p.velocity());
+            r.acceleration = toDouble(p.acceleration());
+            r.normal = toDouble(p.normal());
+            r.density = p.density();
+            r.pressure = p.pressure();
+            r.flag = p.flag();
+            r.splash = p.splash();
+            _particles.push_back(r);
+        }
+    sort(_particles.begin(), _particles.end(),
+         [](const referenceparticle& a, const referenceparticle& b) { return a.id < b.id; });
+
+    _wallNormals.clear();
+    _wallPoints.clear();
+    for (wall w : system.walls()) {
+        _wallNormals.push_back(toDouble(w.getNormal()));
+        _wallPoints.push_back(toDouble(w.getPoint()));
+    }
+    _particleMass = system.mass();
+    _viscosity = system.viscosityConstant();
+    _dt = system.timeStep();
+    _surfaceThreshold = system.surfaceThreshold;
+    _gravity = toDouble(system.gravityVector);
+}
+
+void referencesolver::step()
+{
+    densityAndPressureComputation();
+    accelerationComputation();
+    integrate();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Every particle against every particle, itself included
+///////////////////////////////////////////////////////////////////////////////
+void referencesolver::densityAndPressureComputation()
+{
+    const double h2 = h*h;
+    const int count = (int)_particles.size();
+#pragma omp parallel for
+    for (int i = 0; i < count; i++) {
+        referenceparticle& p = _particles[i];
+        double density = 0.0;
+        for (int j = 0; j < count; j++) {
+            VEC3D diffPos = _particles[j].position - p.position;
+            double distSquared = diffPos.dot(diffPos);
+            if (distSquared >= h2)
+                continue;
+            density += kernelPoly6(distSquared);
+        }
+        p.density = density * _particleMass;
+        double press = GAS_STIFFNESS * (p.density - REST_DENSITY);
+        p.pressure = press > 0 ? press : 0;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pressure, viscosity, surface tension, gravity and walls, like
+// particlesystem::accelerationComputation(). The accelerations are written
+// once every particle has read the velocities, so the pass is order free
+///////////////////////////////////////////////////////////////////////////////
+void referencesolver::accelerationComputation()
+{
+    const double h2 = h*h;
+    const int count = (int)_particles.size();
+    vector<VEC3D> accelerations(count);
+    vector<double> magnitudes(count);
+#pragma omp parallel for
+    for (int i = 0; i < count; i++) {
+        referenceparticle& p = _particles[i];
+        VEC3D gradient;
+        VEC3D laplacian;
+        VEC3D normal;
+        double coefpi = p.pressure / (p.density * p.density);
+        double curvature = 0;
+        unsigned int numberCloseNeighbor = 0;
+        for (int j = 0; j < count; j++) {
+            const referenceparticle& neighbor = _particles[j];
+            if (neighbor.id == p.id)
+                continue;
+            VEC3D diffPos = p.position - neighbor.position;
+            double distSquared = diffPos.dot(diffPos);
+            if (h2 <= distSquared)
+                continue;
+            if (h2/1.1 >= distSquared)
+                ++numberCloseNeighbor;
+
+            double overDens = 1.0 / neighbor.density;
+            double coefpj = neighbor.pressure * overDens * overDens;
+
+            VEC3D currentGradient;
+            kernelSpikyGradient(diffPos, distSquared, currentGradient);
+            gradient += (coefpi + coefpj) * currentGradient;
+            laplacian += (kernelViscosityLaplacian(distSquared) * overDens) * (neighbor.velocity - p.velocity);
+
+            VEC3D tensionGrad;
+            kernelPoly6Gradient(diffPos, distSquared, tensionGrad);
+            normal += overDens * tensionGrad;
+            curvature += overDens * kernelPoly6Laplacian(distSquared);
+        }
+
+        VEC3D force = -1.0 * _particleMass * gradient * p.density;
+        force += _viscosity * _particleMass * laplacian;
+        force += _gravity * p.density;
+
+        normal *= _particleMass;
+        curvature *= _particleMass;
+        double mag = magnitude(normal);
+        magnitudes[i] = mag;
+        p.normal = normal;
+        if ((p.flag = mag > _surfaceThreshold))
+            force += (-SURFACE_TENSION * curvature) * normal / mag;
+
+        p.splash = numberCloseNeighbor < 2;
+        p.flag |= p.splash;
+
+        VEC3D collision;
+        collisionForce(p, collision);
+        force += collision * p.density;
+
+        accelerations[i] = (1.0 / p.density) * force;
+    }
+
+    double threshold = 0.0;
+    for (int i = 0; i < count; i++) {
+        _particles[i].acceleration = accelerations[i];
+        threshold += magnitudes[i];
+    }
+    if (count > 0)
+        _surfaceThreshold = threshold / count;
+}
+
+void referencesolver::collisionForce(const referenceparticle& p, VEC3D& f_collision) const
+{
+    for (size_t x = 0; x < _wallNormals.size(); x++) {
+        const VEC3D& normal = _wallNormals[x];
+        double inOrOut = normal.dot(_wallPoints[x] - p.position) + 0.01;
+        if (inOrOut < 0.00)
+            continue;
+        f_collision += (WALL_DAMPING * p.velocity.dot(normal)) * normal;
+        f_collision += WALL_K * inOrOut * normal;
+    }
+}
+
+void referencesolver::integrate()
+{
+    const int count = (int)_particles.size();
+#pragma omp parallel for
+    for (int i = 0; i < count; i++) {
+        referenceparticle& p = _particles[i];
+        p.velocity += p.acceleration * _dt;
+        p.position += p.velocity * _dt;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Relative to the root mean square of the reference, so that values near
+// zero do not blow the error up
+///////////////////////////////////////////////////////////////////////////////
+referenceerror referencesolver::compare(const particlesystem& system) const
+{
+    referenceerror error;
+    error.particles = (int)_particles.size();
+    vector<particle*> byId(error.particles, NULL);
+    FIELD_3D<>& grid = *system.grid;
+    for (int gridCellIndex = 0; gridCellIndex < grid.cellCount(); gridCellIndex++)
+        for (particle& p : grid.data()[gridCellIndex]) {
+            vector<referenceparticle>::const_iterator match = lower_bound(_particles.begin(), _particles.end(), p.id(),
+                [](const referenceparticle& r, int id) { return r.id < id; });
+            if (match != _particles.end() && match->id == p.id())
+                byId[match - _particles.begin()] = &p;
+        }
+
+    double rms[5] = { 0, 0, 0, 0, 0 };
+    double worst[5] = { 0, 0, 0, 0, 0 };
+    for (int i = 0; i < error.particles; i++) {
+        const referenceparticle& r = _particles[i];
+        rms[0] += r.density * r.density;
+        rms[1] += r.pressure * r.pressure;
+        rms[2] += r.acceleration.dot(r.acceleration);
+        rms[3] += r.velocity.dot(r.velocity);
+        rms[4] += r.position.dot(r.position);
+        if (!byId[i]) {
+            error.missing++;
+            continue;
+        }
+        particle& p = *byId[i];
+        worst[0] = max(worst[0], fabs(p.density() - r.density));
+        worst[1] = max(worst[1], fabs(p.pressure() - r.pressure));
+        // a normal right at the threshold may flip the flag, and with it the
+        // surface tension. Such particles are counted, not measured
+        if (p.flag() != r.flag) {
+            error.flags++;
+            continue;
+        }
+        worst[2] = max(worst[2], magnitude(toDouble(p.acceleration()) - r.acceleration));
+        worst[3] = max(worst[3], magnitude(toDouble(p.velocity()) - r.velocity));
+        worst[4] = max(worst[4], magnitude(toDouble(p.position()) - r.position));
+    }
+    double* fields[5] = { &error.density, &error.pressure, &error.acceleration, &error.velocity, &error.position };
+    for (int x = 0; x < 5; x++) {
+        double scale = error.particles > 0 ? sqrt(rms[x] / error.particles) : 0.0;
+        *fields[x] = scale > 0.0 ? worst[x] / scale : worst[x];
+    }
+    return error;
+}
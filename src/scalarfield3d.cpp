@@ -0,0 +1,138 @@
+#include "../include/scalar_field_3D.h"
+#include <cstdio>
+
+///////////////////////////////////////////////////////////////////////
+// Constructor / Destructor
+///////////////////////////////////////////////////////////////////////
+SCALAR_FIELD_3D::SCALAR_FIELD_3D() :
+  _xRes(0), _yRes(0), _zRes(0), _spacing(0), _insideValue(0), _slotCount(0)
+{
+  _blockRes[0] = _blockRes[1] = _blockRes[2] = 0;
+}
+
+SCALAR_FIELD_3D::SCALAR_FIELD_3D(int xRes, int yRes, int zRes, const VEC3F& origin, float spacing) :
+  _xRes(0), _yRes(0), _zRes(0), _spacing(0), _insideValue(0), _slotCount(0)
+{
+  resize(xRes, yRes, zRes, origin, spacing);
+}
+
+SCALAR_FIELD_3D::~SCALAR_FIELD_3D()
+{
+}
+
+///////////////////////////////////////////////////////////////////////
+// Samples [lower, upper) of a block
+///////////////////////////////////////////////////////////////////////
+void SCALAR_FIELD_3D::blockRange(int blockIndex, int lower[3], int upper[3]) const
+{
+  int b[3] = { blockIndex % _blockRes[0], (blockIndex / _blockRes[0]) % _blockRes[1], blockIndex / (_blockRes[0] * _blockRes[1]) };
+  for (int i = 0; i < 3; i++) {
+    lower[i] = b[i] * FIELD_BLOCK;
+    upper[i] = lower[i] + FIELD_BLOCK;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////
+// set the size of the array
+///////////////////////////////////////////////////////////////////////
+void SCALAR_FIELD_3D::resize(int xRes, int yRes, int zRes, const VEC3F& origin, float spacing, int state)
+{
+  _xRes = xRes;
+  _yRes = yRes;
+  _zRes = zRes;
+  _origin = origin;
+  _spacing = spacing;
+  _blockRes[0] = (xRes + FIELD_BLOCK - 1) / FIELD_BLOCK;
+  _blockRes[1] = (yRes + FIELD_BLOCK - 1) / FIELD_BLOCK;
+  _blockRes[2] = (zRes + FIELD_BLOCK - 1) / FIELD_BLOCK;
+  _blockSlot.assign(totalBlocks(), -1 - FIELD_BLOCK_OUTSIDE);
+  _freeSlots.clear();
+  _slotCount = 0;
+  setBlockStates(vector<unsigned char>(totalBlocks(), state));
+}
+
+///////////////////////////////////////////////////////////////////////
+// blocks that stay stored keep their slot and samples, the slots of
+// the others are reused for the new ones
+///////////////////////////////////////////////////////////////////////
+void SCALAR_FIELD_3D::setBlockStates(const vector<unsigned char>& states)
+{
+  const int blocks = totalBlocks();
+  for (int b = 0; b < blocks; b++)
+    if (_blockSlot[b] >= 0 && states[b] != FIELD_BLOCK_STORED) {
+      _freeSlots.push_back(_blockSlot[b]);
+      _blockSlot[b] = -1 - states[b];
+    }
+
+  _storedBlocks.clear();
+  _newBlocks.clear();
+  for (int b = 0; b < blocks; b++) {
+    if (states[b] != FIELD_BLOCK_STORED) {
+      _blockSlot[b] = -1 - states[b];
+      continue;
+    }
+    if (_blockSlot[b] < 0) {
+      if (_freeSlots.empty())
+        _blockSlot[b] = _slotCount++;
+      else {
+        _blockSlot[b] = _freeSlots.back();
+        _freeSlots.pop_back();
+      }
+      _newBlocks.push_back(b);
+    }
+    _storedBlocks.push_back(b);
+  }
+
+  if (_slotCount * FIELD_BLOCK_SAMPLES > (int)_data.size()) {
+    // some slack, the band grows and shrinks with the surface
+    _data.resize(_slotCount * FIELD_BLOCK_SAMPLES + _slotCount * FIELD_BLOCK_SAMPLES / 4);
+  }
+  const int newBlocks = (int)_newBlocks.size();
+#pragma omp parallel for
+  for (int i = 0; i < newBlocks; i++)
+    clearBlock(_newBlocks[i]);
+}
+
+///////////////////////////////////////////////////////////////////////
+// set to zero
+///////////////////////////////////////////////////////////////////////
+void SCALAR_FIELD_3D::clear()
+{
+  const int blocks = (int)_storedBlocks.size();
+#pragma omp parallel for
+  for (int i = 0; i < blocks; i++)
+    clearBlock(_storedBlocks[i]);
+}
+
+void SCALAR_FIELD_3D::clearBlock(int blockIndex)
+{
+  float* samples = blockData(blockIndex);
+  for (int x = 0; x < FIELD_BLOCK_SAMPLES; x++)
+    samples[x] = 0.0f;
+}
+
+///////////////////////////////////////////////////////////////////////
+// dump to disk: 3 ints of resolution, 4 floats of origin and spacing,
+// then the samples with x varying fastest
+///////////////////////////////////////////////////////////////////////
+bool SCALAR_FIELD_3D::write(const char* filename) const
+{
+  FILE* file = fopen(filename, "wb");
+  if (file == NULL) {
+    printf("Couldn't open file %s!\n", filename);
+    return false;
+  }
+  int res[3] = { _xRes, _yRes, _zRes };
+  float placement[4] = { _origin.x, _origin.y, _origin.z, _spacing };
+  bool success = fwrite(res, sizeof(int), 3, file) == 3 &&
+                 fwrite(placement, sizeof(float), 4, file) == 4;
+  vector<float> row(_xRes);
+  for (int z = 0; z < _zRes && success; z++)
+    for (int y = 0; y < _yRes && success; y++) {
+      for (int x = 0; x < _xRes; x++)
+        row[x] = (*this)(x, y, z);
+      success = fwrite(&row[0], sizeof(float), _xRes, file) == (size_t)_xRes;
+    }
+  fclose(file);
+  return success;
+}
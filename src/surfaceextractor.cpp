@@ -0,0 +1,212 @@
+#include "../include/surfaceextractor.h"
+#include "../include/trace.h"
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////////////
+surfaceextractor::surfaceextractor() :
+  _isoValue(0)
+{
+  _fieldRes[0] = _fieldRes[1] = _fieldRes[2] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Free the per block buffers
+///////////////////////////////////////////////////////////////////////////////
+void surfaceextractor::release()
+{
+  vector<block>().swap(_blocks);
+  vector<int>().swap(_visited);
+  vector<int>().swap(_extracted);
+  vector<int>().swap(_blockBuffer);
+  vector<int>().swap(_freeBuffers);
+  vector<unsigned char>().swap(_visit);
+}
+
+void surfaceextractor::useSlots(block& blk, int slotCount)
+{
+  if (!blk.hasVertices) {
+    blk.slotVertex.assign(slotCount, -1);
+    blk.hasVertices = true;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Central difference gradient, one sided on the border
+///////////////////////////////////////////////////////////////////////////////
+VEC3F surfaceextractor::gradient(const SCALAR_FIELD_3D& field, const block& blk, int x, int y, int z) const
+{
+  int x0 = std::max(x - 1, 0), x1 = std::min(x + 1, field.xRes() - 1);
+  int y0 = std::max(y - 1, 0), y1 = std::min(y + 1, field.yRes() - 1);
+  int z0 = std::max(z - 1, 0), z1 = std::min(z + 1, field.zRes() - 1);
+  const float* samples = &blk.samples[0];
+  return VEC3F((samples[apronIndex(blk, x1,y,z)] - samples[apronIndex(blk, x0,y,z)]) / std::max(x1 - x0, 1),
+               (samples[apronIndex(blk, x,y1,z)] - samples[apronIndex(blk, x,y0,z)]) / std::max(y1 - y0, 1),
+               (samples[apronIndex(blk, x,y,z1)] - samples[apronIndex(blk, x,y,z0)]) / std::max(z1 - z0, 1));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The cubes of a block reach into the blocks above it along each axis.
+// Unless one of those is stored, or they are constant with different
+// states, the level set cannot cross them.
+//
+// A visited block that keeps its buffer is only extracted again when one
+// of the blocks it reads samples from, itself and its 26 neighbors, changed.
+///////////////////////////////////////////////////////////////////////////////
+void surfaceextractor::findVisitedBlocks(const SCALAR_FIELD_3D& field, const vector<unsigned char>* changed)
+{
+  const int* blockRes = field.blockRes();
+  const int blockCount = field.totalBlocks();
+  if (!changed) {
+    _blockBuffer.assign(blockCount, -1);
+    _freeBuffers.clear();
+    for (int i = (int)_blocks.size() - 1; i >= 0; i--)
+      _freeBuffers.push_back(i);
+  }
+
+  _visit.resize(blockCount);
+#pragma omp parallel for
+  for (int b = 0; b < blockCount; b++) {
+    int bx = b % blockRes[0], by = (b / blockRes[0]) % blockRes[1], bz = b / (blockRes[0] * blockRes[1]);
+    int state = field.blockState(b);
+    bool visit = state == FIELD_BLOCK_STORED;
+    for (int n = 1; n < 8 && !visit; n++) {
+      int nx = bx + (n & 1), ny = by + ((n >> 1) & 1), nz = bz + ((n >> 2) & 1);
+      if (nx >= blockRes[0] || ny >= blockRes[1] || nz >= blockRes[2])
+        continue;
+      visit = field.blockState(nx + blockRes[0] * (ny + blockRes[1] * nz)) != state;
+    }
+    _visit[b] = visit;
+  }
+
+  // buffers are handed out serially so that they do not depend on the thread count
+  _visited.clear();
+  _extracted.clear();
+  for (int b = 0; b < blockCount; b++) {
+    int& buffer = _blockBuffer[b];
+    if (!_visit[b]) {
+      if (buffer >= 0)
+        _freeBuffers.push_back(buffer);
+      buffer = -1;
+      continue;
+    }
+    bool extract = !changed || buffer < 0;
+    if (buffer < 0) {
+      if (_freeBuffers.empty()) {
+        buffer = (int)_blocks.size();
+        _blocks.push_back(block());
+      }
+      else {
+        buffer = _freeBuffers.back();
+        _freeBuffers.pop_back();
+      }
+      _blocks[buffer].index = b;
+    }
+    if (!extract) {
+      int bx = b % blockRes[0], by = (b / blockRes[0]) % blockRes[1], bz = b / (blockRes[0] * blockRes[1]);
+      for (int nz = std::max(bz - 1, 0); nz <= std::min(bz + 1, blockRes[2] - 1) && !extract; nz++)
+        for (int ny = std::max(by - 1, 0); ny <= std::min(by + 1, blockRes[1] - 1) && !extract; ny++)
+          for (int nx = std::max(bx - 1, 0); nx <= std::min(bx + 1, blockRes[0] - 1) && !extract; nx++)
+            extract = (*changed)[nx + blockRes[0] * (ny + blockRes[1] * nz)] != 0;
+    }
+    _visited.push_back(b);
+    if (extract)
+      _extracted.push_back(buffer);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copy the samples a block reads, clamped to the field, so that the passes
+// never look up other blocks
+///////////////////////////////////////////////////////////////////////////////
+void surfaceextractor::fetchSamples(const SCALAR_FIELD_3D& field, block& blk) const
+{
+  blk.samples.resize(BLOCK_APRON_RES * BLOCK_APRON_RES * BLOCK_APRON_RES);
+  int clamped[3][BLOCK_APRON_RES];
+  int res[3] = { field.xRes(), field.yRes(), field.zRes() };
+  for (int a = 0; a < 3; a++)
+    for (int i = 0; i < BLOCK_APRON_RES; i++)
+      clamped[a][i] = std::min(std::max(blk.lower[a] - 1 + i, 0), res[a] - 1);
+
+  float* samples = &blk.samples[0];
+  for (int k = 0; k < BLOCK_APRON_RES; k++)
+    for (int j = 0; j < BLOCK_APRON_RES; j++)
+      for (int i = 0; i < BLOCK_APRON_RES; i++)
+        *samples++ = field(clamped[0][i], clamped[1][j], clamped[2][k]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Extract the surface: vertices per block, their global numbering in block
+// order, triangles per block, then the buffers are merged in block order
+///////////////////////////////////////////////////////////////////////////////
+void surfaceextractor::extract(SCALAR_FIELD_3D& field, float isoValue, surfacemesh& mesh,
+                               const vector<unsigned char>* changed)
+{
+  TRACE_SCOPE("surfaceExtract");
+  // the kept buffers are only valid for the same level and samples
+  if (isoValue != _isoValue || (int)_blockBuffer.size() != field.totalBlocks() ||
+      field.xRes() != _fieldRes[0] || field.yRes() != _fieldRes[1] || field.zRes() != _fieldRes[2] ||
+      field.origin().x != _fieldOrigin.x || field.origin().y != _fieldOrigin.y || field.origin().z != _fieldOrigin.z)
+    changed = NULL;
+  _isoValue = isoValue;
+  _fieldRes[0] = field.xRes(); _fieldRes[1] = field.yRes(); _fieldRes[2] = field.zRes();
+  _fieldOrigin = field.origin();
+
+  findVisitedBlocks(field, changed);
+  const int visitedCount = (int)_visited.size();
+  const int extractedCount = (int)_extracted.size();
+
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < extractedCount; i++) {
+    block& blk = _blocks[_extracted[i]];
+    field.blockRange(blk.index, blk.lower, blk.upper);
+    fetchSamples(field, blk);
+    blk.vertices.clear();
+    blk.normals.clear();
+    blk.hasVertices = false;
+    createVertices(field, isoValue, blk);
+  }
+
+  unsigned int vertexCount = 0;
+  for (int i = 0; i < visitedCount; i++) {
+    block& blk = _blocks[_blockBuffer[_visited[i]]];
+    blk.firstVertex = vertexCount;
+    vertexCount += blk.vertices.size();
+  }
+
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < extractedCount; i++) {
+    block& blk = _blocks[_extracted[i]];
+    blk.indices.clear();
+    createTriangles(field, isoValue, blk);
+  }
+
+  unsigned int indexCount = 0;
+  for (int i = 0; i < visitedCount; i++) {
+    block& blk = _blocks[_blockBuffer[_visited[i]]];
+    blk.firstIndex = indexCount;
+    indexCount += blk.indices.size();
+  }
+
+  // block index offset of each neighbor of a vertex reference
+  const int* blockRes = field.blockRes();
+  int neighborOffset[27];
+  for (int n = 0; n < 27; n++)
+    neighborOffset[n] = (n % 3 - 1) + blockRes[0] * ((n / 3 % 3 - 1) + blockRes[1] * (n / 9 - 1));
+
+  mesh.vertices.resize(vertexCount);
+  mesh.normals.resize(vertexCount);
+  mesh.indices.resize(indexCount);
+#pragma omp parallel for schedule(dynamic)
+  for (int i = 0; i < visitedCount; i++) {
+    const block& blk = _blocks[_blockBuffer[_visited[i]]];
+    std::copy(blk.vertices.begin(), blk.vertices.end(), mesh.vertices.begin() + blk.firstVertex);
+    std::copy(blk.normals.begin(), blk.normals.end(), mesh.normals.begin() + blk.firstVertex);
+    unsigned int* indices = mesh.indices.data() + blk.firstIndex;
+    for (unsigned int reference : blk.indices) {
+      const block& owner = _blocks[_blockBuffer[blk.index + neighborOffset[reference >> 16]]];
+      *indices++ = owner.firstVertex + owner.slotVertex[reference & 0xffff];
+    }
+  }
+}
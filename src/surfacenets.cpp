@@ -0,0 +1,125 @@
+#include "../include/surfacenets.h"
+#include <algorithm>
+
+// cube corners, bit i of the index is the offset along axis i
+static const int cornerOffset[8][3] = {
+  {0,0,0}, {1,0,0}, {0,1,0}, {1,1,0}, {0,0,1}, {1,0,1}, {0,1,1}, {1,1,1}
+};
+
+// the two corners of each cube edge
+static const int edgeCorners[12][2] = {
+  {0,1}, {2,3}, {4,5}, {6,7}, {0,2}, {1,3}, {4,6}, {5,7}, {0,4}, {1,5}, {2,6}, {3,7}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// A vertex for every cube crossing the level set whose lower corner is in
+// the block, placed at the mean of the crossings on the cube edges
+///////////////////////////////////////////////////////////////////////////////
+void surfacenets::createVertices(SCALAR_FIELD_3D& field, float isoValue, block& blk)
+{
+  int upper[3];
+  int res[3] = { field.xRes(), field.yRes(), field.zRes() };
+  for (int i = 0; i < 3; i++)
+    upper[i] = std::min(blk.upper[i], res[i] - 1);
+
+  const float* data = &blk.samples[0];
+  const int strideY = BLOCK_APRON_RES, strideZ = BLOCK_APRON_RES * BLOCK_APRON_RES;
+  int cornerIndex[8];
+  for (int c = 0; c < 8; c++)
+    cornerIndex[c] = cornerOffset[c][0] + cornerOffset[c][1] * strideY + cornerOffset[c][2] * strideZ;
+
+  for (int z = blk.lower[2]; z < upper[2]; z++)
+    for (int y = blk.lower[1]; y < upper[1]; y++) {
+      int index = apronIndex(blk, blk.lower[0], y, z);
+      for (int x = blk.lower[0]; x < upper[0]; x++, index++) {
+        float value[8];
+        int mask = 0;
+        for (int c = 0; c < 8; c++) {
+          value[c] = data[index + cornerIndex[c]];
+          mask |= (value[c] >= isoValue) << c;
+        }
+        if (mask == 0 || mask == 255)
+          continue;
+
+        VEC3F position;
+        int crossings = 0;
+        for (int e = 0; e < 12; e++) {
+          int a = edgeCorners[e][0], b = edgeCorners[e][1];
+          if (((mask >> a) & 1) == ((mask >> b) & 1))
+            continue;
+          float t = (isoValue - value[a]) / (value[b] - value[a]);
+          VEC3F pa(cornerOffset[a][0], cornerOffset[a][1], cornerOffset[a][2]);
+          VEC3F pb(cornerOffset[b][0], cornerOffset[b][1], cornerOffset[b][2]);
+          position += pa + (pb - pa) * t;
+          crossings++;
+        }
+
+        // gradient of the trilinear interpolant at the cube center, from the corners alone
+        VEC3F normal;
+        for (int c = 0; c < 8; c++)
+          normal += VEC3F(cornerOffset[c][0] - 0.5f, cornerOffset[c][1] - 0.5f, cornerOffset[c][2] - 0.5f) * value[c];
+
+        useSlots(blk, FIELD_BLOCK_SAMPLES);
+        blk.slotVertex[field.localIndex(x, y, z)] = (int)blk.vertices.size();
+        blk.vertices.push_back(field.position(x, y, z) + position * (field.spacing() / crossings));
+        // the field decreases outwards
+        normal *= -1.f;
+        blk.normals.push_back(normal.normal());
+      }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Two triangles for every crossed sample edge whose lower end is in the
+// block, joining the four cubes around the edge
+///////////////////////////////////////////////////////////////////////////////
+void surfacenets::createTriangles(SCALAR_FIELD_3D& field, float isoValue, block& blk)
+{
+  int upper[3];
+  int res[3] = { field.xRes(), field.yRes(), field.zRes() };
+  for (int i = 0; i < 3; i++)
+    upper[i] = std::min(blk.upper[i], res[i]);
+
+  const float* data = &blk.samples[0];
+  const int stride[3] = { 1, BLOCK_APRON_RES, BLOCK_APRON_RES * BLOCK_APRON_RES };
+  for (int z = blk.lower[2]; z < upper[2]; z++)
+    for (int y = blk.lower[1]; y < upper[1]; y++) {
+      int index = apronIndex(blk, blk.lower[0], y, z);
+      for (int x = blk.lower[0]; x < upper[0]; x++, index++) {
+        const bool inside = data[index] >= isoValue;
+        const int sample[3] = { x, y, z };
+        for (int axis = 0; axis < 3; axis++) {
+          int u = (axis + 1) % 3, v = (axis + 2) % 3;
+          // the edge and the four cubes around it must exist
+          if (sample[axis] + 1 >= res[axis] ||
+              sample[u] < 1 || sample[u] + 1 >= res[u] ||
+              sample[v] < 1 || sample[v] + 1 >= res[v])
+            continue;
+          if ((data[index + stride[axis]] >= isoValue) == inside)
+            continue;
+
+          // the four cubes around the edge, counter clockwise seen from +axis
+          int cube[4][3];
+          for (int c = 0; c < 4; c++) {
+            cube[c][0] = x; cube[c][1] = y; cube[c][2] = z;
+          }
+          cube[1][u]--;
+          cube[2][u]--; cube[2][v]--;
+          cube[3][v]--;
+          unsigned int quad[4];
+          for (int c = 0; c < 4; c++)
+            quad[c] = vertexReference(blk, cube[c][0], cube[c][1], cube[c][2], field.localIndex(cube[c][0], cube[c][1], cube[c][2]));
+
+          // the outside is on the side of the lower value
+          if (inside) {
+            blk.indices.push_back(quad[0]); blk.indices.push_back(quad[1]); blk.indices.push_back(quad[2]);
+            blk.indices.push_back(quad[0]); blk.indices.push_back(quad[2]); blk.indices.push_back(quad[3]);
+          }
+          else {
+            blk.indices.push_back(quad[0]); blk.indices.push_back(quad[2]); blk.indices.push_back(quad[1]);
+            blk.indices.push_back(quad[0]); blk.indices.push_back(quad[3]); blk.indices.push_back(quad[2]);
+          }
+        }
+      }
+    }
+}
@@ -0,0 +1,175 @@
+#include "../include/surfacepipeline.h"
+#include "../include/alloccount.h"
+#include "../include/trace.h"
+#include <omp.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor / Destructor
+//
+// One slot is computed by the surface thread, depth are queued and one is
+// captured by the solver, so a slot is always free when the queue has room.
+///////////////////////////////////////////////////////////////////////////////
+surfacepipeline::surfacepipeline(int depth, int dropPolicy, int threads) :
+    _depth(depth < 0 ? 0 : depth), _dropPolicy(dropPolicy), _threads(threads < 1 ? 1 : threads),
+    _queueHead(0), _queueCount(0), _busy(false), _stop(false),
+    _dropped(0), _completed(0), _resamples(0)
+{
+    if (_depth == 0)
+        return;
+    _jobs.resize(_depth + 2);
+    _queue.resize(_depth);
+    for (int x = (int)_jobs.size() - 1; x >= 0; x--)
+        _free.push_back(x);
+    _thread = thread(&surfacepipeline::run, this);
+}
+
+surfacepipeline::~surfacepipeline()
+{
+    if (_depth == 0)
+        return;
+    {
+        lock_guard<mutex> lock(_mutex);
+        _stop = true;
+    }
+    _queued.notify_all();
+    _thread.join();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Called by the solver thread only. Without a queue the surface is
+// computed right away
+///////////////////////////////////////////////////////////////////////////////
+bool surfacepipeline::submit(FIELD_3D<>& grid, const VEC3F& boxSize, float cellSize,
+                             const surfacesettings& settings, long step)
+{
+    if (_depth == 0)
+    {
+        if (_jobs.empty())
+            _jobs.resize(1);
+        job& work = _jobs[0];
+        work.snapshot.capture(grid, boxSize, cellSize);
+        work.settings = settings;
+        work.step = step;
+        process(work);
+        return true;
+    }
+
+    int slot;
+    {
+        unique_lock<mutex> lock(_mutex);
+        if (_queueCount == _depth)
+        {
+            if (_dropPolicy == SURFACE_DROP_NEWEST)
+            {
+                _dropped++;
+                return false;
+            }
+            if (_dropPolicy == SURFACE_DROP_OLDEST)
+            {
+                _free.push_back(_queue[_queueHead]);
+                _queueHead = (_queueHead + 1) % _depth;
+                _queueCount--;
+                _dropped++;
+            }
+            else
+            {
+                TRACE_SCOPE("surfaceWait");
+                _done.wait(lock, [this] { return _queueCount < _depth; });
+            }
+        }
+        slot = _free.back();
+        _free.pop_back();
+    }
+
+    // the solver does not touch the particles while they are copied, the
+    // surface thread only ever sees the copy
+    job& work = _jobs[slot];
+    work.snapshot.capture(grid, boxSize, cellSize);
+    work.settings = settings;
+    work.step = step;
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        _queue[(_queueHead + _queueCount) % _depth] = slot;
+        _queueCount++;
+    }
+    _queued.notify_one();
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Swap frames, so that the memory of the old one is reused for the next
+///////////////////////////////////////////////////////////////////////////////
+bool surfacepipeline::fetch(surfaceframe& frame)
+{
+    lock_guard<mutex> lock(_readyMutex);
+    if (_ready.step <= frame.step)
+        return false;
+    swap(frame, _ready);
+    return true;
+}
+
+void surfacepipeline::flush()
+{
+    if (_depth == 0)
+        return;
+    unique_lock<mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _queueCount == 0 && !_busy; });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Surface thread: compute the queued snapshots oldest first
+///////////////////////////////////////////////////////////////////////////////
+void surfacepipeline::run()
+{
+    // its own OpenMP team, so the solver keeps its threads
+    omp_set_num_threads(_threads);
+    traceThreadName("surface");
+#pragma omp parallel
+    allocCountingIgnoreThread();
+
+    while (true)
+    {
+        int slot;
+        {
+            unique_lock<mutex> lock(_mutex);
+            _queued.wait(lock, [this] { return _stop || _queueCount > 0; });
+            if (_stop)
+                return;
+            slot = _queue[_queueHead];
+            _queueHead = (_queueHead + 1) % _depth;
+            _queueCount--;
+            _busy = true;
+        }
+        // room in the queue for a waiting solver
+        _done.notify_all();
+
+        process(_jobs[slot]);
+
+        {
+            lock_guard<mutex> lock(_mutex);
+            _free.push_back(slot);
+            _busy = false;
+        }
+        _done.notify_all();
+    }
+}
+
+void surfacepipeline::process(job& work)
+{
+    _surface.compute(work.snapshot, work.settings);
+    _resamples = _surface.resamples();
+
+    const SCALAR_FIELD_3D* grid = _surface.grid();
+    lock_guard<mutex> lock(_readyMutex);
+    swap(_ready.mesh, _surface.mesh);
+    _ready.step = work.step;
+    _ready.updateFraction = _surface.updateFraction();
+    _ready.origin = grid->origin();
+    _ready.spacing = grid->spacing();
+    _ready.res[0] = grid->xRes();
+    _ready.res[1] = grid->yRes();
+    _ready.res[2] = grid->zRes();
+    _ready.storedBlocks = grid->storedBlocks();
+    _completed++;
+}
@@ -0,0 +1,45 @@
+#include <chrono>
+#include <omp.h>
+#include "../include/threadload.h"
+
+std::atomic<bool> threadLoadOn(false);
+
+// one cache line per thread, the threads write their own at the same time
+struct alignas(64) threadload {
+    unsigned long long busy[LOAD_PHASES];
+};
+
+static threadload threadLoads[LOAD_MAX_THREADS];
+
+void threadLoadEnable(bool enable)
+{
+    threadLoadOn.store(enable, std::memory_order_relaxed);
+}
+
+void threadLoadReset()
+{
+    for (int thread = 0; thread < LOAD_MAX_THREADS; thread++)
+        for (int phase = 0; phase < LOAD_PHASES; phase++)
+            threadLoads[thread].busy[phase] = 0;
+}
+
+double threadLoadBusy(int phase, int thread)
+{
+    if (thread < 0 || thread >= LOAD_MAX_THREADS)
+        return 0.0;
+    return threadLoads[thread].busy[phase] / 1e6;
+}
+
+void threadLoadRecord(int phase, unsigned long long nanoseconds)
+{
+    int thread = omp_get_thread_num();
+    if (thread < LOAD_MAX_THREADS)
+        threadLoads[thread].busy[phase] += nanoseconds;
+}
+
+// never 0, a scope started while measuring is off is 0
+unsigned long long threadLoadNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count() + 1;
+}
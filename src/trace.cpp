@@ -0,0 +1,123 @@
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+#include "../include/trace.h"
+
+std::atomic<bool> traceOn(false);
+
+struct traceevent {
+    const char* name;
+    unsigned long long start;
+    unsigned long long end;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Written by its thread only. count is published after the event so that
+// a reader never sees a slot before it is filled
+///////////////////////////////////////////////////////////////////////////////
+struct tracebuffer {
+    tracebuffer(int id, const char* threadName) : tid(id), name(threadName), count(0), events(TRACE_CAPACITY) {}
+
+    int tid;
+    const char* name;
+    std::atomic<unsigned long> count;
+    std::vector<traceevent> events;
+};
+
+// buffers are kept after their thread exits, so that its events are written
+static std::mutex traceMutex;
+static std::vector<tracebuffer*> traceBuffers;
+static thread_local tracebuffer* threadBuffer = NULL;
+static thread_local const char* threadName = NULL;
+
+static tracebuffer* buffer()
+{
+    if (!threadBuffer) {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        threadBuffer = new tracebuffer((int)traceBuffers.size() + 1, threadName);
+        traceBuffers.push_back(threadBuffer);
+    }
+    return threadBuffer;
+}
+
+unsigned long long traceNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count() + 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The calling thread gets its buffer right away, so that the solver does
+// not allocate it in the middle of a step
+///////////////////////////////////////////////////////////////////////////////
+void traceEnable(bool enable)
+{
+    if (enable)
+        buffer();
+    traceOn.store(enable, std::memory_order_relaxed);
+}
+
+void traceThreadName(const char* name)
+{
+    threadName = name;
+    if (threadBuffer)
+        threadBuffer->name = name;
+}
+
+void traceRecord(const char* name, unsigned long long start, unsigned long long end)
+{
+    tracebuffer* b = buffer();
+    unsigned long n = b->count.load(std::memory_order_relaxed);
+    traceevent& event = b->events[n & (TRACE_CAPACITY - 1)];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    b->count.store(n + 1, std::memory_order_release);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Complete ("X") events in microseconds from the first kept event, and a
+// thread_name metadata event for the named threads
+///////////////////////////////////////////////////////////////////////////////
+bool traceWrite(const char* filename)
+{
+    std::lock_guard<std::mutex> lock(traceMutex);
+    unsigned long long origin = 0;
+    for (tracebuffer* b : traceBuffers) {
+        unsigned long count = b->count.load(std::memory_order_acquire);
+        unsigned long first = count > TRACE_CAPACITY ? count - TRACE_CAPACITY : 0;
+        for (unsigned long x = first; x < count; x++) {
+            unsigned long long start = b->events[x & (TRACE_CAPACITY - 1)].start;
+            if (origin == 0 || start < origin)
+                origin = start;
+        }
+    }
+
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        printf("Couldn't open file %s!\n", filename);
+        return false;
+    }
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool first = true;
+    for (tracebuffer* b : traceBuffers) {
+        if (b->name) {
+            fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                    first ? "" : ",\n", b->tid, b->name);
+            first = false;
+        }
+        unsigned long count = b->count.load(std::memory_order_acquire);
+        for (unsigned long x = count > TRACE_CAPACITY ? count - TRACE_CAPACITY : 0; x < count; x++) {
+            const traceevent& event = b->events[x & (TRACE_CAPACITY - 1)];
+            fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    first ? "" : ",\n", event.name, b->tid,
+                    (event.start - origin) / 1000.0, (event.end - event.start) / 1000.0);
+            first = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    bool success = !ferror(file);
+    success = fclose(file) == 0 && success;
+    return success;
+}
@@ -0,0 +1,503 @@
+#include "../include/trajectory.h"
+#include "../include/particle.h"
+#include "../include/trace.h"
+#include <cstring>
+#include <algorithm>
+#ifdef SPH_ZLIB
+#include <zlib.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define TRAJECTORY_MMAP
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor
+///////////////////////////////////////////////////////////////////////////////
+trajectoryframe::trajectoryframe() :
+    step(0), attributes(0)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Count the particles of every cell, then copy every cell to its range
+///////////////////////////////////////////////////////////////////////////////
+void trajectoryframe::capture(FIELD_3D<>& grid, int attributes, long step)
+{
+    TRACE_SCOPE("trajectorySnapshot");
+    this->step = step;
+    this->attributes = attributes;
+    const int cellCount = grid.cellCount();
+    _cellStart.resize(cellCount + 1);
+    int total = 0;
+    for (int gridCellIndex = 0; gridCellIndex < cellCount; gridCellIndex++)
+    {
+        _cellStart[gridCellIndex] = total;
+        total += grid.data()[gridCellIndex].size();
+    }
+    _cellStart[cellCount] = total;
+
+    ids.resize(total);
+    positions.resize(attributes & TRAJ_POSITION ? total : 0);
+    velocities.resize(attributes & TRAJ_VELOCITY ? total : 0);
+    densities.resize(attributes & TRAJ_DENSITY ? total : 0);
+    flags.resize(attributes & TRAJ_FLAGS ? total : 0);
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int gridCellIndex = 0; gridCellIndex < cellCount; gridCellIndex++)
+    {
+        int i = _cellStart[gridCellIndex];
+        for (particle& p : grid.data()[gridCellIndex])
+        {
+            ids[i] = p.id();
+            if (attributes & TRAJ_POSITION)
+                positions[i] = p.position();
+            if (attributes & TRAJ_VELOCITY)
+                velocities[i] = p.velocity();
+            if (attributes & TRAJ_DENSITY)
+                densities[i] = p.density();
+            if (attributes & TRAJ_FLAGS)
+                flags[i] = (p.flag() ? 1 : 0) | (p.splash() ? 2 : 0);
+            i++;
+        }
+    }
+}
+
+int defaultTrajectoryCodec()
+{
+#ifdef SPH_ZLIB
+    return TRAJ_CODEC_DEFLATE;
+#else
+    return TRAJ_CODEC_NONE;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Blocks
+//
+// Floats of neighboring particles mostly differ in their low bytes. Grouping
+// the sign and exponent bytes, then the high mantissa bytes and so on, gives
+// zlib long runs of similar bytes to work with.
+///////////////////////////////////////////////////////////////////////////////
+static void shuffle(const unsigned char* raw, size_t bytes, int width, unsigned char* shuffled)
+{
+    const size_t words = bytes / width;
+    for (int b = 0; b < width; b++)
+        for (size_t w = 0; w < words; w++)
+            shuffled[b * words + w] = raw[w * width + b];
+}
+
+static void unshuffle(const unsigned char* shuffled, size_t bytes, int width, unsigned char* raw)
+{
+    const size_t words = bytes / width;
+    for (int b = 0; b < width; b++)
+        for (size_t w = 0; w < words; w++)
+            raw[w * width + b] = shuffled[b * words + w];
+}
+
+// append a block of the bytes to out, stored raw when compressing does not pay
+static void encodeBlock(int attribute, int codec, const unsigned char* raw, size_t bytes, int width,
+                        vector<unsigned char>& scratch, vector<unsigned char>& out)
+{
+    blockheader header;
+    header.attribute = attribute;
+    header.codec = TRAJ_CODEC_NONE;
+    header.rawBytes = (unsigned int)bytes;
+    header.storedBytes = (unsigned int)bytes;
+    const size_t start = out.size();
+    out.resize(start + sizeof(header));
+
+#ifdef SPH_ZLIB
+    if (codec == TRAJ_CODEC_DEFLATE)
+    {
+        scratch.resize(bytes);
+        shuffle(raw, bytes, width, scratch.data());
+        uLongf stored = compressBound(bytes);
+        out.resize(start + sizeof(header) + stored);
+        if (compress2(&out[start + sizeof(header)], &stored, scratch.data(), bytes, Z_BEST_SPEED) == Z_OK && stored < bytes)
+        {
+            header.codec = TRAJ_CODEC_DEFLATE;
+            header.storedBytes = (unsigned int)stored;
+        }
+    }
+#endif
+    if (header.codec == TRAJ_CODEC_NONE)
+    {
+        out.resize(start + sizeof(header) + bytes);
+        memcpy(&out[start + sizeof(header)], raw, bytes);
+    }
+    out.resize(start + sizeof(header) + header.storedBytes);
+    memcpy(&out[start], &header, sizeof(header));
+}
+
+static bool decodeBlock(const blockheader& header, const unsigned char* stored, int width,
+                        vector<unsigned char>& scratch, unsigned char* raw)
+{
+    if (header.codec == TRAJ_CODEC_NONE)
+    {
+        if (header.storedBytes != header.rawBytes)
+            return false;
+        memcpy(raw, stored, header.rawBytes);
+        return true;
+    }
+#ifdef SPH_ZLIB
+    if (header.codec == TRAJ_CODEC_DEFLATE)
+    {
+        scratch.resize(header.rawBytes);
+        uLongf length = header.rawBytes;
+        if (uncompress(scratch.data(), &length, stored, header.storedBytes) != Z_OK || length != header.rawBytes)
+            return false;
+        unshuffle(scratch.data(), header.rawBytes, width, raw);
+        return true;
+    }
+#endif
+    return false;
+}
+
+// the arrays of a frame in file order, with their element width for
+// shuffling. Without ids and positions when they are quantized
+struct framearray {
+    int attribute;
+    unsigned char* data;
+    size_t bytes;
+    int width;
+};
+
+static int frameArrays(trajectoryframe& frame, bool quantized, framearray arrays[5])
+{
+    const size_t count = frame.ids.size();
+    int n = 0;
+    if (!quantized)
+        arrays[n++] = { TRAJ_IDS, (unsigned char*)frame.ids.data(), count * sizeof(int), 4 };
+    if (!quantized && (frame.attributes & TRAJ_POSITION))
+        arrays[n++] = { TRAJ_POSITION, (unsigned char*)frame.positions.data(), count * sizeof(VEC3F), 4 };
+    if (frame.attributes & TRAJ_VELOCITY)
+        arrays[n++] = { TRAJ_VELOCITY, (unsigned char*)frame.velocities.data(), count * sizeof(VEC3F), 4 };
+    if (frame.attributes & TRAJ_DENSITY)
+        arrays[n++] = { TRAJ_DENSITY, (unsigned char*)frame.densities.data(), count * sizeof(float), 4 };
+    if (frame.attributes & TRAJ_FLAGS)
+        arrays[n++] = { TRAJ_FLAGS, frame.flags.data(), count, 1 };
+    return n;
+}
+
+// the other attributes of frame in the order of the quantized particles
+static void reorder(const trajectoryframe& frame, const vector<int>& order, trajectoryframe& ordered)
+{
+    const int count = (int)order.size();
+    ordered.step = frame.step;
+    ordered.attributes = frame.attributes;
+    ordered.ids.resize(count);
+    ordered.velocities.resize(frame.velocities.empty() ? 0 : count);
+    ordered.densities.resize(frame.densities.empty() ? 0 : count);
+    ordered.flags.resize(frame.flags.empty() ? 0 : count);
+    for (int i = 0; i < count; i++) {
+        if (!frame.velocities.empty())
+            ordered.velocities[i] = frame.velocities[order[i]];
+        if (!frame.densities.empty())
+            ordered.densities[i] = frame.densities[order[i]];
+        if (!frame.flags.empty())
+            ordered.flags[i] = frame.flags[order[i]];
+    }
+}
+
+int encodeFrame(const trajectoryframe& frame, int codec, positioncodec* positions, bool& key,
+                framescratch& scratch, vector<unsigned char>& out)
+{
+    const bool quantized = positions != NULL && (frame.attributes & TRAJ_POSITION);
+    int blocks = 0;
+    framearray arrays[5];
+    int n;
+    if (quantized)
+    {
+        const size_t start = out.size();
+        out.resize(start + sizeof(blockheader));
+        key = positions->encode(frame.ids.data(), frame.positions.data(), frame.particleCount(), key, scratch.order, out);
+        blockheader header;
+        header.attribute = TRAJ_IDS | TRAJ_POSITION;
+        header.codec = TRAJ_CODEC_QUANTIZED;
+        header.rawBytes = (unsigned int)(frame.ids.size() * (sizeof(int) + sizeof(VEC3F)));
+        header.storedBytes = (unsigned int)(out.size() - start - sizeof(header));
+        memcpy(&out[start], &header, sizeof(header));
+        blocks++;
+        reorder(frame, scratch.order, scratch.ordered);
+        n = frameArrays(scratch.ordered, true, arrays);
+    }
+    else
+    {
+        key = true;
+        n = frameArrays(const_cast<trajectoryframe&>(frame), false, arrays);
+    }
+    for (int a = 0; a < n; a++)
+    {
+        for (size_t offset = 0; offset < arrays[a].bytes; offset += TRAJ_BLOCK_BYTES)
+        {
+            encodeBlock(arrays[a].attribute, codec, arrays[a].data + offset,
+                        std::min<size_t>(TRAJ_BLOCK_BYTES, arrays[a].bytes - offset), arrays[a].width, scratch.bytes, out);
+            blocks++;
+        }
+    }
+    return blocks;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reader
+///////////////////////////////////////////////////////////////////////////////
+trajectoryreader::trajectoryreader() :
+    _file(NULL), _size(0), _mapped(NULL), _attributes(0), _quantum(0.f), _frameBytes(0), _frameFlags(0),
+    _indexed(false), _frame(0)
+{
+}
+
+trajectoryreader::~trajectoryreader()
+{
+    close();
+}
+
+bool trajectoryreader::open(const char* filename, bool mapped)
+{
+    close();
+    _file = fopen(filename, "rb");
+    if (_file == NULL)
+        return false;
+    if (fseek(_file, 0, SEEK_END) != 0 || (_size = ftell(_file)) < 0)
+    {
+        close();
+        return false;
+    }
+#ifdef TRAJECTORY_MMAP
+    if (mapped && _size > 0)
+    {
+        void* mapping = mmap(NULL, (size_t)_size, PROT_READ, MAP_PRIVATE, fileno(_file), 0);
+        if (mapping != MAP_FAILED)
+            _mapped = (const unsigned char*)mapping;
+    }
+#endif
+
+    trajectoryheader header;
+    if (!readAt(0, &header, sizeof(header)) ||
+        header.magic != TRAJECTORY_MAGIC || header.version != TRAJECTORY_VERSION)
+    {
+        close();
+        return false;
+    }
+    _attributes = header.attributes;
+    _quantum = header.quantum;
+    _box = VEC3F(header.box[0], header.box[1], header.box[2]);
+    if (_quantum > 0.f && !_positions.configure(_box, _quantum))
+    {
+        close();
+        return false;
+    }
+    _indexed = readIndex();
+    if (!_indexed && !scanIndex())
+    {
+        close();
+        return false;
+    }
+    _positions.reset();
+    _frame = 0;
+    return true;
+}
+
+void trajectoryreader::close()
+{
+#ifdef TRAJECTORY_MMAP
+    if (_mapped)
+        munmap((void*)_mapped, (size_t)_size);
+#endif
+    _mapped = NULL;
+    if (_file)
+        fclose(_file);
+    _file = NULL;
+    _size = 0;
+    _index.clear();
+    _indexed = false;
+    _frame = 0;
+}
+
+bool trajectoryreader::readAt(long long offset, void* data, size_t bytes)
+{
+    if (offset < 0 || offset + (long long)bytes > _size)
+        return false;
+    if (_mapped)
+    {
+        memcpy(data, _mapped + offset, bytes);
+        return true;
+    }
+    return fseek(_file, offset, SEEK_SET) == 0 && fread(data, 1, bytes, _file) == bytes;
+}
+
+const unsigned char* trajectoryreader::bytesAt(long long offset, size_t bytes)
+{
+    if (offset < 0 || offset + (long long)bytes > _size)
+        return NULL;
+    if (_mapped)
+        return _mapped + offset;
+    _stored.resize(bytes);
+    if (bytes > 0 && !readAt(offset, _stored.data(), bytes))
+        return NULL;
+    return _stored.data();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The index at the end of a closed file, checked against the file size
+///////////////////////////////////////////////////////////////////////////////
+bool trajectoryreader::readIndex()
+{
+    _index.clear();
+    trajectoryfooter footer;
+    if (_size < (long long)(sizeof(trajectoryheader) + sizeof(footer)) ||
+        !readAt(_size - sizeof(footer), &footer, sizeof(footer)) ||
+        footer.magic != INDEX_MAGIC || footer.frames < 0 || footer.indexOffset < (long long)sizeof(trajectoryheader) ||
+        footer.indexOffset + footer.frames * (long long)sizeof(frameindexentry) + (long long)sizeof(footer) != _size)
+        return false;
+
+    _index.resize(footer.frames);
+    if (!readAt(footer.indexOffset, _index.data(), _index.size() * sizeof(frameindexentry)))
+    {
+        _index.clear();
+        return false;
+    }
+    long long end = sizeof(trajectoryheader);
+    for (const frameindexentry& entry : _index)
+    {
+        if (entry.offset < end || entry.particles < 0)
+        {
+            _index.clear();
+            return false;
+        }
+        end = entry.offset + (long long)sizeof(frameheader);
+    }
+    return end <= footer.indexOffset || _index.empty();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Without a footer, hop from frame header to frame header. The index ends
+// at the first frame that is cut off, of a writer that did not finish
+///////////////////////////////////////////////////////////////////////////////
+bool trajectoryreader::scanIndex()
+{
+    _index.clear();
+    long long offset = sizeof(trajectoryheader);
+    frameheader header;
+    while (readAt(offset, &header, sizeof(header)) &&
+           header.magic == FRAME_MAGIC && header.particles >= 0 && header.bytes >= 0 &&
+           offset + (long long)sizeof(header) + header.bytes <= _size)
+    {
+        frameindexentry entry;
+        entry.offset = offset;
+        entry.step = header.step;
+        entry.particles = header.particles;
+        entry.flags = header.flags;
+        _index.push_back(entry);
+        offset += (long long)sizeof(header) + header.bytes;
+    }
+    return true;
+}
+
+long trajectoryreader::findStep(long long step) const
+{
+    vector<frameindexentry>::const_iterator found = std::lower_bound(_index.begin(), _index.end(), step,
+        [](const frameindexentry& entry, long long step) { return entry.step < step; });
+    if (found == _index.end() || found->step != step)
+        return -1;
+    return (long)(found - _index.begin());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decode onwards from the keyframe before frame, or from the current frame
+// when it is on the way. The frames in between only need their positions
+///////////////////////////////////////////////////////////////////////////////
+bool trajectoryreader::seek(long frame)
+{
+    if (_file == NULL || frame < 0 || frame >= frameCount())
+        return false;
+    long key = frame;
+    while (key > 0 && !(_index[key].flags & FRAME_KEYFRAME))
+        key--;
+    if (_frame <= key || _frame > frame)
+    {
+        _positions.reset();
+        _frame = key;
+    }
+    while (_frame < frame)
+        if (!read(_skipped, true))
+            return false;
+    return true;
+}
+
+bool trajectoryreader::next(trajectoryframe& frame)
+{
+    if (_file == NULL || _frame >= frameCount())
+        return false;
+    return read(frame, false);
+}
+
+bool trajectoryreader::read(trajectoryframe& frame, bool positionsOnly)
+{
+    // a frame that fails leaves the decoder out of step, seek() starts over
+    const long current = _frame;
+    _frame = frameCount();
+    frameheader header;
+    if (!readAt(_index[current].offset, &header, sizeof(header)) || header.magic != FRAME_MAGIC ||
+        header.particles < 0 || header.bytes < 0)
+        return false;
+    const unsigned char* stored = bytesAt(_index[current].offset + sizeof(header), (size_t)header.bytes);
+    if (stored == NULL)
+        return false;
+    const size_t storedBytes = (size_t)header.bytes;
+    _frameBytes = (long long)sizeof(header) + header.bytes;
+    _frameFlags = header.flags;
+
+    frame.step = header.step;
+    frame.attributes = _attributes;
+    frame.ids.resize(header.particles);
+    frame.positions.resize(_attributes & TRAJ_POSITION ? header.particles : 0);
+    frame.velocities.resize(_attributes & TRAJ_VELOCITY ? header.particles : 0);
+    frame.densities.resize(_attributes & TRAJ_DENSITY ? header.particles : 0);
+    frame.flags.resize(_attributes & TRAJ_FLAGS ? header.particles : 0);
+
+    // the blocks of every array follow each other, in the order of the arrays
+    const bool quantized = _quantum > 0.f && (_attributes & TRAJ_POSITION);
+    framearray arrays[5];
+    const int n = frameArrays(frame, quantized, arrays);
+    size_t filled[5] = { 0, 0, 0, 0, 0 };
+    size_t position = 0;
+    for (int block = 0; block < header.blocks; block++)
+    {
+        blockheader blockHeader;
+        if (position + sizeof(blockHeader) > storedBytes)
+            return false;
+        memcpy(&blockHeader, stored + position, sizeof(blockHeader));
+        position += sizeof(blockHeader);
+        if (quantized && block == 0)
+        {
+            if (blockHeader.attribute != (TRAJ_IDS | TRAJ_POSITION) || blockHeader.codec != TRAJ_CODEC_QUANTIZED ||
+                position + blockHeader.storedBytes > storedBytes ||
+                !_positions.decode(stored + position, blockHeader.storedBytes, frame.ids, frame.positions) ||
+                frame.particleCount() != header.particles)
+                return false;
+            position += blockHeader.storedBytes;
+            // the frames seek() passes only keep the decoder in step
+            if (positionsOnly)
+            {
+                _frame = current + 1;
+                return true;
+            }
+            continue;
+        }
+        int a = 0;
+        while (a < n && arrays[a].attribute != blockHeader.attribute)
+            a++;
+        if (a == n || position + blockHeader.storedBytes > storedBytes ||
+            filled[a] + blockHeader.rawBytes > arrays[a].bytes ||
+            !decodeBlock(blockHeader, stored + position, arrays[a].width, _scratch, arrays[a].data + filled[a]))
+            return false;
+        filled[a] += blockHeader.rawBytes;
+        position += blockHeader.storedBytes;
+    }
+    for (int a = 0; a < n; a++)
+        if (filled[a] != arrays[a].bytes)
+            return false;
+    _frame = current + 1;
+    return true;
+}
@@ -0,0 +1,186 @@
+#include "../include/trajectoryplayer.h"
+#include "../include/alloccount.h"
+#include "../include/trace.h"
+#include <iostream>
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor / Destructor
+///////////////////////////////////////////////////////////////////////////////
+trajectoryplayer::trajectoryplayer() :
+    _frameCount(0), _shownFrame(-1), _wanted(-1), _playing(false), _loop(false), _fps(PLAYBACK_FPS), _playShown(0),
+    _request(-1), _requested(-1), _decodedFrame(-1), _failedFrame(-1), _slowestDecode(0.0), _stop(false)
+{
+}
+
+trajectoryplayer::~trajectoryplayer()
+{
+    close();
+}
+
+bool trajectoryplayer::open(const char* filename)
+{
+    close();
+    if (!_reader.open(filename, true)) {
+        cerr << filename << " is missing or not a trajectory of version " << TRAJECTORY_VERSION << endl;
+        return false;
+    }
+    if (!_reader.next(_shown)) {
+        cerr << filename << " has no frames" << endl;
+        _reader.close();
+        return false;
+    }
+    _frameCount = _reader.frameCount();
+    _box = _reader.box();
+    _shownFrame = 0;
+    _wanted = -1;
+    _playing = false;
+    _request = -1;
+    _requested = -1;
+    _decodedFrame = -1;
+    _failedFrame = -1;
+    _slowestDecode = 0.0;
+    _stop = false;
+    _thread = thread(&trajectoryplayer::run, this);
+    request(1);
+    return true;
+}
+
+void trajectoryplayer::close()
+{
+    if (_thread.joinable()) {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _stop = true;
+        }
+        _requestedCondition.notify_all();
+        _thread.join();
+    }
+    _reader.close();
+    _frameCount = 0;
+    _shownFrame = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Display loop side
+///////////////////////////////////////////////////////////////////////////////
+void trajectoryplayer::request(long frame)
+{
+    if (frame < 0 || frame >= _frameCount)
+        return;
+    {
+        lock_guard<mutex> lock(_mutex);
+        // already asked for, or decoded with nothing else in flight that
+        // would overwrite it
+        if (_requested == frame || (_requested < 0 && _decodedFrame == frame))
+            return;
+        _request = frame;
+        _requested = frame;
+    }
+    _requestedCondition.notify_one();
+}
+
+void trajectoryplayer::play(bool playing)
+{
+    if (playing && _shownFrame == _frameCount - 1 && _wanted < 0)
+        seek(0);
+    _playing = playing;
+    _playStart = std::chrono::steady_clock::now();
+    _playShown = 0;
+}
+
+void trajectoryplayer::seek(long frame)
+{
+    if (_frameCount == 0)
+        return;
+    _wanted = frame < 0 ? 0 : (frame >= _frameCount ? _frameCount - 1 : frame);
+    request(_wanted);
+}
+
+double trajectoryplayer::shownFps() const
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _playStart).count();
+    return seconds > 0.0 ? _playShown / seconds : 0.0;
+}
+
+bool trajectoryplayer::update()
+{
+    if (_frameCount == 0)
+        return false;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (_playing && _wanted < 0 && std::chrono::duration<double>(now - _lastShown).count() >= 1.0 / _fps) {
+        if (_shownFrame + 1 < _frameCount)
+            seek(_shownFrame + 1);
+        else if (_loop)
+            seek(0);
+        else
+            _playing = false;
+    }
+    if (_wanted < 0)
+        return false;
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        if (_failedFrame == _wanted) {
+            cerr << "frame " << _wanted << " of the trajectory is damaged" << endl;
+            _failedFrame = -1;
+            _wanted = -1;
+            _playing = false;
+            return false;
+        }
+        if (_decodedFrame != _wanted)
+            return false;
+        swap(_shown, _decoded);
+        _shownFrame = _decodedFrame;
+        _decodedFrame = -1;
+    }
+    _wanted = -1;
+    _lastShown = now;
+    _playShown++;
+    // decode the next frame while this one is shown
+    request(_shownFrame + 1 < _frameCount ? _shownFrame + 1 : (_loop ? 0 : -1));
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decoder thread: decode the frame asked for last. A frame that is no longer
+// wanted when it is done is dropped
+///////////////////////////////////////////////////////////////////////////////
+void trajectoryplayer::run()
+{
+    traceThreadName("playback");
+    allocCountingIgnoreThread();
+
+    while (true)
+    {
+        long frame;
+        {
+            unique_lock<mutex> lock(_mutex);
+            _requestedCondition.wait(lock, [this] { return _stop || _request >= 0; });
+            if (_stop)
+                return;
+            frame = _request;
+            _request = -1;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool decoded;
+        {
+            TRACE_SCOPE("playbackDecode");
+            decoded = (_reader.position() == frame || _reader.seek(frame)) && _reader.next(_decoding);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        lock_guard<mutex> lock(_mutex);
+        if (_request >= 0)
+            continue;
+        _requested = -1;
+        if (decoded) {
+            swap(_decoded, _decoding);
+            _decodedFrame = frame;
+            _slowestDecode = std::max(_slowestDecode.load(), seconds);
+        }
+        else
+            _failedFrame = frame;
+    }
+}
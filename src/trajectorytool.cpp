@@ -0,0 +1,211 @@
+// <chrono> before the solver headers, which define h
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <omp.h>
+#include "../include/particle.h"
+#include "../include/trajectory.h"
+#include "../include/particleexport.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Inspects trajectory files: lists the frames of the index, writes a single
+// frame as text, or decodes all of them split into one frame range per
+// thread, each with its own reader seeking to the start of its range
+///////////////////////////////////////////////////////////////////////////////
+
+struct trajectoryoptions {
+    trajectoryoptions() : frame(-1), step(-1), threads(0), list(false), decode(false) {}
+
+    string input;
+    string output;
+    string vtu;
+    string ply;
+    long frame;
+    long long step;
+    int threads;
+    bool list;
+    bool decode;
+};
+
+static void usage(const char* program)
+{
+    cerr << "usage: " << program << " FILE [options]" << endl
+         << "  --list            print every frame of the index" << endl
+         << "  --frame N         seek to frame N, counted from 0" << endl
+         << "  --step N          seek to the frame of step N" << endl
+         << "  --output FILE     write the frame sought to FILE as text, like sph_headless --output" << endl
+         << "  --vtu FILE        write the frame sought to FILE as binary VTK unstructured grid" << endl
+         << "  --ply FILE        write the frame sought to FILE as binary PLY" << endl
+         << "  --decode          decode all frames, one frame range per thread" << endl
+         << "  --threads N       OpenMP threads (default: OpenMP's choice)" << endl;
+}
+
+static bool parseOptions(int argc, char** argv, trajectoryoptions& opts)
+{
+    for (int x = 1; x < argc; x++) {
+        string arg = argv[x];
+        if (arg == "--help" || arg == "-h")
+            return false;
+        if (arg == "--list") {
+            opts.list = true;
+            continue;
+        }
+        if (arg == "--decode") {
+            opts.decode = true;
+            continue;
+        }
+        if (arg.compare(0, 2, "--") != 0) {
+            if (!opts.input.empty()) {
+                cerr << "more than one trajectory given" << endl;
+                return false;
+            }
+            opts.input = arg;
+            continue;
+        }
+        if (arg != "--frame" && arg != "--step" && arg != "--output" && arg != "--threads" &&
+            arg != "--vtu" && arg != "--ply") {
+            cerr << "unknown option " << arg << endl;
+            return false;
+        }
+        if (x + 1 >= argc) {
+            cerr << "missing value for " << arg << endl;
+            return false;
+        }
+        const char* value = argv[++x];
+        if (arg == "--frame")
+            opts.frame = atol(value);
+        else if (arg == "--step")
+            opts.step = atoll(value);
+        else if (arg == "--output")
+            opts.output = value;
+        else if (arg == "--vtu")
+            opts.vtu = value;
+        else if (arg == "--ply")
+            opts.ply = value;
+        else
+            opts.threads = atoi(value);
+    }
+    if (opts.input.empty()) {
+        cerr << "no trajectory given" << endl;
+        return false;
+    }
+    if (opts.threads < 0) {
+        cerr << "--threads must be positive" << endl;
+        return false;
+    }
+    return true;
+}
+
+static bool writeFrame(const char* filename, const trajectoryframe& frame)
+{
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        printf("Couldn't open file %s!\n", filename);
+        return false;
+    }
+    fprintf(file, "step %ld %d\n", frame.step, frame.particleCount());
+    for (int i = 0; i < frame.particleCount(); i++) {
+        VEC3F position = frame.positions.empty() ? VEC3F() : frame.positions[i];
+        VEC3F velocity = frame.velocities.empty() ? VEC3F() : frame.velocities[i];
+        float density = frame.densities.empty() ? 0.0f : frame.densities[i];
+        fprintf(file, "%d %g %g %g %g %g %g %g\n", frame.ids[i], position.x, position.y, position.z,
+                velocity.x, velocity.y, velocity.z, density);
+    }
+    bool success = !ferror(file);
+    success = fclose(file) == 0 && success;
+    return success;
+}
+
+// decode all frames, thread t the t-th contiguous range. Returns the frames decoded
+static long decodeAll(const char* filename, long frames, long long& bytes)
+{
+    long decoded = 0;
+    bytes = 0;
+#pragma omp parallel reduction(+:decoded, bytes)
+    {
+        const int threads = omp_get_num_threads();
+        const int thread = omp_get_thread_num();
+        const long first = frames * thread / threads;
+        const long last = frames * (thread + 1) / threads;
+        trajectoryreader reader;
+        trajectoryframe frame;
+        if (first < last && reader.open(filename, true) && reader.seek(first))
+            for (long x = first; x < last && reader.next(frame); x++) {
+                decoded++;
+                bytes += reader.frameBytes();
+            }
+    }
+    return decoded;
+}
+
+int main(int argc, char** argv)
+{
+    trajectoryoptions opts;
+    if (!parseOptions(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opts.threads > 0)
+        omp_set_num_threads(opts.threads);
+
+    trajectoryreader reader;
+    if (!reader.open(opts.input.c_str())) {
+        cerr << opts.input << " is missing or not a trajectory of version " << TRAJECTORY_VERSION << endl;
+        return 1;
+    }
+    long keyframes = 0;
+    for (long x = 0; x < reader.frameCount(); x++)
+        if (reader.frameEntry(x).flags & FRAME_KEYFRAME)
+            keyframes++;
+    cout << opts.input << ": " << reader.frameCount() << " frames, " << keyframes << " keyframes, "
+         << (reader.indexed() ? "indexed" : "not closed, index rebuilt from the frames");
+    if (reader.quantum() > 0.f)
+        cout << ", positions within " << 0.5f * reader.quantum() << " (" << 0.5f * reader.quantum() / h << " h)";
+    cout << endl;
+    if (opts.list)
+        for (long x = 0; x < reader.frameCount(); x++) {
+            const frameindexentry& entry = reader.frameEntry(x);
+            cout << "  frame " << x << ": step " << entry.step << ", " << entry.particles << " particles at "
+                 << entry.offset << (entry.flags & FRAME_KEYFRAME ? " (key)" : "") << endl;
+        }
+
+    long frame = opts.frame;
+    if (opts.step >= 0 && (frame = reader.findStep(opts.step)) < 0) {
+        cerr << "no frame of step " << opts.step << " in " << opts.input << endl;
+        return 1;
+    }
+    if (frame >= 0) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        trajectoryframe particles;
+        if (!reader.seek(frame) || !reader.next(particles)) {
+            cerr << "reading frame " << frame << " of " << opts.input << " failed" << endl;
+            return 1;
+        }
+        cout << "frame " << frame << " of step " << particles.step << ", " << particles.particleCount()
+             << " particles, read in " << 1000.0 * std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+             << " ms" << endl;
+        if (!opts.output.empty() && !writeFrame(opts.output.c_str(), particles))
+            return 1;
+        particleexporter exporter;
+        if (!opts.vtu.empty() && !exporter.writeVtu(opts.vtu.c_str(), particles))
+            return 1;
+        if (!opts.ply.empty() && !exporter.writePly(opts.ply.c_str(), particles))
+            return 1;
+    }
+
+    if (opts.decode) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        long long bytes;
+        long decoded = decodeAll(opts.input.c_str(), reader.frameCount(), bytes);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        cout << decoded << " frames decoded on " << omp_get_max_threads() << " threads in " << seconds << " s, "
+             << decoded / seconds << " frames/s, " << bytes / 1048576.0 / seconds << " MB/s stored" << endl;
+        if (decoded != reader.frameCount()) {
+            cerr << reader.frameCount() - decoded << " frames of " << opts.input << " are damaged" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,222 @@
+// <chrono> before the solver headers, which define h
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include "../include/trajectorywriter.h"
+#include "../include/alloccount.h"
+#include "../include/trace.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Constructor / Destructor
+///////////////////////////////////////////////////////////////////////////////
+trajectorywriter::trajectorywriter() :
+    _file(NULL), _attributes(TRAJ_ALL), _depth(TRAJECTORY_QUEUE_DEPTH), _codec(TRAJ_CODEC_NONE), _quantum(0.f), _keyInterval(POSITION_KEY_INTERVAL),
+    _queueHead(0), _queueCount(0), _stop(false), _lastKey(0), _offset(0), _encodeSeconds(0.0),
+    _failed(false), _frames(0), _rawBytes(0), _storedBytes(0), _stalls(0), _stallSeconds(0.0)
+{
+}
+
+trajectorywriter::~trajectorywriter()
+{
+    close();
+}
+
+bool trajectorywriter::open(const char* filename, int attributes, int depth, int codec, float quantum, const VEC3F& box)
+{
+    close();
+    _quantum = quantum > 0.f ? quantum : 0.f;
+    if (_quantum > 0.f && !_positions.configure(box, _quantum)) {
+        cerr << "trajectory position error " << 0.5f * _quantum << " is too fine for the box" << endl;
+        return false;
+    }
+    _file = fopen(filename, "wb");
+    if (_file == NULL) {
+        printf("Couldn't open file %s!\n", filename);
+        return false;
+    }
+    _filename = filename;
+    _attributes = attributes & TRAJ_ALL;
+    _depth = depth < 0 ? 0 : depth;
+    _codec = codec;
+    _failed = false;
+    _frames = 0;
+    _rawBytes = 0;
+    _storedBytes = 0;
+    _stalls = 0;
+    _stallSeconds = 0.0;
+    _encodeSeconds = 0.0;
+    _frameStats.clear();
+    _index.clear();
+    _lastKey = 0;
+    _offset = sizeof(trajectoryheader);
+
+    trajectoryheader header;
+    header.magic = TRAJECTORY_MAGIC;
+    header.version = TRAJECTORY_VERSION;
+    header.attributes = _attributes;
+    header.quantum = _quantum;
+    header.box[0] = box[0];
+    header.box[1] = box[1];
+    header.box[2] = box[2];
+    header.reserved = 0;
+    if (fwrite(&header, sizeof(header), 1, _file) != 1)
+        _failed = true;
+
+    // one slot is written while depth are queued, the solver fills a free one
+    _slots.resize(_depth + 1);
+    _queue.assign(_depth, 0);
+    _queueHead = 0;
+    _queueCount = 0;
+    _free.clear();
+    for (int x = (int)_slots.size() - 1; x >= 0; x--)
+        _free.push_back(x);
+    _stop = false;
+    if (_depth > 0)
+        _thread = thread(&trajectorywriter::run, this);
+    return !_failed;
+}
+
+bool trajectorywriter::close()
+{
+    if (_file == NULL)
+        return true;
+    if (_thread.joinable()) {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _stop = true;
+        }
+        _queued.notify_all();
+        _thread.join();
+    }
+
+    // the index is the last thing written, a file without it was not finished
+    if (!_failed) {
+        trajectoryfooter footer;
+        footer.magic = INDEX_MAGIC;
+        footer.reserved = 0;
+        footer.frames = (long long)_index.size();
+        footer.indexOffset = _offset;
+        if (fwrite(_index.data(), sizeof(frameindexentry), _index.size(), _file) != _index.size() ||
+            fwrite(&footer, sizeof(footer), 1, _file) != 1)
+            _failed = true;
+    }
+    bool success = !_failed;
+    success = fclose(_file) == 0 && success;
+    _file = NULL;
+    if (!success)
+        cerr << "writing " << _filename << " failed" << endl;
+    return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Called by the solver thread only. Without a queue the frame is written
+// right away
+///////////////////////////////////////////////////////////////////////////////
+bool trajectorywriter::submit(FIELD_3D<>& grid, long step)
+{
+    if (_file == NULL || _failed)
+        return false;
+    if (_depth == 0) {
+        _slots[0].capture(grid, _attributes, step);
+        return write(_slots[0]);
+    }
+
+    int slot;
+    {
+        unique_lock<mutex> lock(_mutex);
+        if (_queueCount == _depth) {
+            TRACE_SCOPE("trajectoryWait");
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            _done.wait(lock, [this] { return _queueCount < _depth; });
+            double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (_stalls++ == 0)
+                cerr << "warning: trajectory frame of step " << step << " waited " << 1000.0 * waited
+                     << " ms for the writer, the queue of " << _depth << " frames is full" << endl;
+            _stallSeconds += waited;
+        }
+        slot = _free.back();
+        _free.pop_back();
+    }
+
+    // the writer thread only ever sees the copy
+    _slots[slot].capture(grid, _attributes, step);
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        _queue[(_queueHead + _queueCount) % _depth] = slot;
+        _queueCount++;
+    }
+    _queued.notify_one();
+    return !_failed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writer thread: write the queued frames oldest first, and all of them
+// before stopping
+///////////////////////////////////////////////////////////////////////////////
+void trajectorywriter::run()
+{
+    traceThreadName("trajectory");
+    allocCountingIgnoreThread();
+
+    while (true)
+    {
+        int slot;
+        {
+            unique_lock<mutex> lock(_mutex);
+            _queued.wait(lock, [this] { return _stop || _queueCount > 0; });
+            if (_queueCount == 0)
+                return;
+            slot = _queue[_queueHead];
+            _queueHead = (_queueHead + 1) % _depth;
+            _queueCount--;
+        }
+
+        // a failed file only drains the queue
+        if (!_failed)
+            write(_slots[slot]);
+
+        {
+            lock_guard<mutex> lock(_mutex);
+            _free.push_back(slot);
+        }
+        _done.notify_all();
+    }
+}
+
+bool trajectorywriter::write(const trajectoryframe& frame)
+{
+    TRACE_SCOPE("trajectoryWrite");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _encoded.resize(sizeof(frameheader));
+    frameheader header;
+    header.magic = FRAME_MAGIC;
+    header.particles = frame.particleCount();
+    header.step = frame.step;
+    bool key = _frames == 0 || _frames - _lastKey >= _keyInterval;
+    header.blocks = encodeFrame(frame, _codec, _quantum > 0.f ? &_positions : NULL, key, _scratch, _encoded);
+    header.flags = key ? FRAME_KEYFRAME : 0;
+    header.bytes = (long long)(_encoded.size() - sizeof(header));
+    memcpy(_encoded.data(), &header, sizeof(header));
+    double encodeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (fwrite(_encoded.data(), 1, _encoded.size(), _file) != _encoded.size()) {
+        _failed = true;
+        return false;
+    }
+    long long raw = (long long)frame.ids.size() * sizeof(int) + (long long)frame.positions.size() * sizeof(VEC3F) +
+                    (long long)frame.velocities.size() * sizeof(VEC3F) + (long long)frame.densities.size() * sizeof(float) +
+                    (long long)frame.flags.size();
+    _rawBytes += raw;
+    _storedBytes += (long long)_encoded.size();
+    if (key)
+        _lastKey = _frames;
+    frameindexentry entry = { _offset, header.step, header.particles, header.flags };
+    _index.push_back(entry);
+    _offset += (long long)_encoded.size();
+    _encodeSeconds += encodeSeconds;
+    trajectoryframestats stats = { frame.step, header.particles, key, raw, (long long)_encoded.size(), encodeSeconds };
+    _frameStats.push_back(stats);
+    _frames++;
+    return true;
+}
@@ -0,0 +1,198 @@
+#include "../include/viewer.h"
+#include <algorithm>
+
+static VEC3F blue(0,0,1);
+static VEC3F green(0,1,0);
+static VEC3F purpleColor(0.88,0.08,0.88);
+
+///////////////////////////////////////////////////////////////////////////////
+// OGL drawing
+///////////////////////////////////////////////////////////////////////////////
+void viewer::draw()
+{
+    FIELD_3D<>* grid = _system.grid;
+    const VEC3F& boxSize = _system.box();
+    static VEC3F blackColor(0,0,0);
+    static VEC3F blueColor(0,0,1);
+    static VEC3F whiteColor(1,1,1);
+    static VEC3F greyColor(0.2, 0.2, 0.2);
+    static VEC3F lightGreyColor(0.8,0.8,0.8);
+    //static VEC3F greenColor(34.0 / 255, 139.0 / 255, 34.0 / 255);
+    static float shininess = 10.0;
+    // draw the particles
+    glEnable(GL_LIGHTING);
+    //glMaterialfv(GL_FRONT, GL_DIFFUSE, blueColor);
+    glMaterialfv(GL_FRONT, GL_SPECULAR, whiteColor);
+    glMaterialfv(GL_FRONT, GL_SHININESS, &shininess);
+    //#pragma omp parallel for
+    for (int gridCellIndex = 0; gridCellIndex < (*grid).cellCount(); gridCellIndex++)
+    {
+        vector<particle>& particles = (*grid).data()[gridCellIndex];
+        for (int p = 0; p < particles.size(); p++)
+        {
+            particle& particle = particles[p];
+            glMaterialfv(GL_FRONT, GL_DIFFUSE, blueColor);
+            drawParticle(particle);
+        }
+    }
+    _system.fetchSurface();
+    const surfaceframe& surfaceFrame = _system.surfaceFrame;
+    const surfacemesh& surfaceMesh = surfaceFrame.mesh;
+    if (_system.marchingCube() && surfaceMesh.triangleCount() > 0)
+    {
+        glMaterialfv(GL_FRONT, GL_DIFFUSE, blueColor);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(VEC3F), &surfaceMesh.vertices[0]);
+        glNormalPointer(GL_FLOAT, sizeof(VEC3F), &surfaceMesh.normals[0]);
+        glDrawElements(GL_TRIANGLES, surfaceMesh.indices.size(), GL_UNSIGNED_INT, &surfaceMesh.indices[0]);
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+    glDisable(GL_LIGHTING);
+    if (_system.gridVisible()) {
+        // draw the grid
+        glColor3fv(lightGreyColor);
+        //float offset = -BOX_SIZE/2.0+h/2.0;
+        for(int z = 0; z < grid->zRes(); ++z )
+        {
+            for(int y = 0; y < grid->yRes(); ++y)
+            {
+                for(int x = 0; x < grid->xRes(); ++x)
+                {
+                    glColor3fv(VEC3F(x,y,z) / VEC3F(grid->xRes()-1,grid->yRes()-1,grid->zRes()-1));
+                    glPushMatrix();
+                    glTranslated(x*h-boxSize.x/2.0+h/2.0, y*h-boxSize.y/2.0+h/2.0, z*h-boxSize.z/2.0+h/2.0);
+                    glutWireCube(h);
+                    glPopMatrix();
+                }
+            }
+        }
+
+    }
+    if (_system.marchingGrid() && surfaceFrame.step >= 0) {
+        glPointSize(3.f);
+        glBegin(GL_POINTS);
+        // draw the stored samples of the surface shown
+        const int* res = surfaceFrame.res;
+        const int blockRes[3] = { (res[0] + FIELD_BLOCK - 1) / FIELD_BLOCK, (res[1] + FIELD_BLOCK - 1) / FIELD_BLOCK, (res[2] + FIELD_BLOCK - 1) / FIELD_BLOCK };
+        VEC3F resolution(res[0]-1, res[1]-1, res[2]-1);
+        for(int block : surfaceFrame.storedBlocks)
+        {
+            int lower[3] = { block % blockRes[0] * FIELD_BLOCK, block / blockRes[0] % blockRes[1] * FIELD_BLOCK, block / (blockRes[0] * blockRes[1]) * FIELD_BLOCK };
+            for(int z = lower[2]; z < std::min(lower[2] + FIELD_BLOCK, res[2]); ++z )
+            {
+                for(int y = lower[1]; y < std::min(lower[1] + FIELD_BLOCK, res[1]); ++y)
+                {
+                    for(int x = lower[0]; x < std::min(lower[0] + FIELD_BLOCK, res[0]); ++x)
+                    {
+                        glColor3fv(VEC3F(x,y,z) / resolution);
+                        glVertex3fv(surfaceFrame.origin + VEC3F(x,y,z) * surfaceFrame.spacing);
+                    }
+                }
+            }
+        }
+    glEnd();
+    }
+    glColor3fv(greyColor);
+    glPopMatrix();
+    glScaled(boxSize.x, boxSize.y, boxSize.z);
+    glutWireCube(1.0);
+    glPopMatrix();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// OGL drawing
+///////////////////////////////////////////////////////////////////////////////
+void viewer::drawParticle(particle& p)
+{
+  if(!particle::display)
+      return;
+
+  if (p.flag() && particle::isSurfaceVisible)
+    glMaterialfv(GL_FRONT, GL_DIFFUSE, purpleColor);
+  else
+    glMaterialfv(GL_FRONT, GL_DIFFUSE,blue);
+
+  //Since splash are surface red == surface
+  if(p.splash() && particle::showSplash)
+         glMaterialfv(GL_FRONT, GL_DIFFUSE, green);
+  glPushMatrix();
+  glTranslated(p.position()[0], p.position()[1], p.position()[2]);
+  glutSolidSphere(PARTICLE_DRAW_RADIUS, 10, 10);
+  glPopMatrix();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// OGL drawing
+///////////////////////////////////////////////////////////////////////////////
+void viewer::drawWall(wall& w)
+{
+  glPushMatrix();
+  // translate to the point
+  glTranslated(w.getPoint()[0], w.getPoint()[1], w.getPoint()[2]);
+    
+    // apply a rotation
+  double angle1 = asin(w.getNormal()[0]) / (2 * M_PI) * 360.0;
+  double angle2 = asin(w.getNormal()[1]) / (2 * M_PI) * 360.0;
+  //double angle3 = asin(_normal[2]) / (2 * M_PI) * 360.0;
+
+  
+    glRotatef(-angle1, 0, 1, 0);
+  //cout << "1: " << angle1 << " 2: " << angle2 << " 3: " << angle3 << endl;
+  glRotatef(-angle2, 1, 0, 0);
+
+    // make it a plane at 0,0
+    glTranslated(0, 0, WALL_DRAW_THICKNESS/2.0);
+    glScalef(20,20,1);
+    glutSolidCube(WALL_DRAW_THICKNESS);
+  
+    
+  glPopMatrix();
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// OGL drawing
+///////////////////////////////////////////////////////////////////////////////
+void playbackviewer::draw()
+{
+    static VEC3F greyColor(0.2, 0.2, 0.2);
+    const trajectoryframe& frame = _player.frame();
+    const int count = frame.positions.empty() || !particle::display ? 0 : frame.particleCount();
+
+    // the flags of the frame are those of drawParticle()
+    _colors.resize(count);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < count; i++)
+    {
+        const unsigned char flags = frame.flags.empty() ? 0 : frame.flags[i];
+        if (flags & 2 && particle::showSplash)
+            _colors[i] = green;
+        else if (flags & 1 && particle::isSurfaceVisible)
+            _colors[i] = purpleColor;
+        else
+            _colors[i] = blue;
+    }
+
+    glDisable(GL_LIGHTING);
+    if (count > 0)
+    {
+        glPointSize(3.f);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3, GL_FLOAT, sizeof(VEC3F), &frame.positions[0]);
+        glColorPointer(3, GL_FLOAT, sizeof(VEC3F), &_colors[0]);
+        glDrawArrays(GL_POINTS, 0, count);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+
+    const VEC3F& boxSize = _player.box();
+    glColor3fv(greyColor);
+    glPushMatrix();
+    glScaled(boxSize.x, boxSize.y, boxSize.z);
+    glutWireCube(1.0);
+    glPopMatrix();
+}